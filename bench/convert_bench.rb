@@ -0,0 +1,54 @@
+#
+# Benchmark: Client side conversion of EBCDIC string messages
+#
+# Compares WMQ::Queue#get(convert: ccsid), which converts locally using lookup
+# tables, with WMQ::Queue#get(convert: true), where MQGMO_CONVERT has the queue
+# manager or MQ client library convert the message.
+#
+# The local conversion alone does not require a queue manager, set Q_MGR_NAME
+# to also compare the round trip through a queue:
+#   Q_MGR_NAME=TEST ruby bench/convert_bench.rb
+#
+require 'benchmark'
+require 'wmq'
+
+size  = (ENV['SIZE'] || 64 * 1024).to_i
+n     = (ENV['COUNT'] || 1_000).to_i
+ascii = ('The quick brown fox jumps over the lazy dog. ' * (size / 45 + 1))[0, size]
+data  = WMQ::Message.convert(ascii, 819, 37)
+
+puts "EBCDIC message of #{data.size} bytes, #{n} iterations"
+Benchmark.bmbm do |x|
+  x.report('37 => 819')   { n.times { WMQ::Message.convert(data, 37, 819) } }
+  x.report('37 => 1208')  { n.times { WMQ::Message.convert(data, 37, 1208) } }
+  x.report('819 => 1208') { n.times { WMQ::Message.convert(ascii, 819, 1208) } }
+  x.report('1208 => 37')  { n.times { WMQ::Message.convert(ascii, 1208, 37) } }
+end
+
+if q_mgr_name = ENV['Q_MGR_NAME']
+  WMQ::QueueManager.connect(q_mgr_name: q_mgr_name) do |qmgr|
+    qmgr.open_queue(q_name: 'SYSTEM.DEFAULT.MODEL.QUEUE', dynamic_q_name: 'BENCH.CONVERT.*', mode: :input) do |in_queue|
+      qmgr.open_queue(q_name: in_queue.name, mode: :output) do |out_queue|
+        message = WMQ::Message.new(data: data)
+        message.descriptor[:format]            = WMQ::MQFMT_STRING
+        message.descriptor[:coded_char_set_id] = 37
+
+        received = WMQ::Message.new
+        Benchmark.bmbm do |x|
+          x.report('MQGMO_CONVERT') do
+            n.times do
+              out_queue.put(message: message)
+              in_queue.get(message: received, convert: true)
+            end
+          end
+          x.report('convert: 819') do
+            n.times do
+              out_queue.put(message: message)
+              in_queue.get(message: received, convert: 819)
+            end
+          end
+        end
+      end
+    end
+  end
+end
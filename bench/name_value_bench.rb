@@ -0,0 +1,22 @@
+#
+# Benchmark: Decoding of RFH NameValueStrings
+#
+# Compares the original character-at-a-time decoder with the block scanning
+# decoder used by Message#headers for MQRFH headers.
+#
+# Does not require a queue manager
+#
+require 'benchmark'
+require 'wmq'
+
+pairs = (1..200).collect do |i|
+  "name#{i} value#{'x' * (i % 64)} \"quoted name#{i}\" \"a \"\"quoted\"\" value #{'y' * (i % 128)}\""
+end
+str = pairs.join('  ')
+n   = 2_000
+
+puts "NameValueString of #{str.size} bytes, #{n} iterations"
+Benchmark.bmbm do |x|
+  x.report('legacy') { n.times { WMQ::Message.decode_name_value(str, true) } }
+  x.report('block')  { n.times { WMQ::Message.decode_name_value(str) } }
+end
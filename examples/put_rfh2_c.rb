@@ -0,0 +1,29 @@
+#
+# Sample : put() : Put a message to a queue with a Rules and Formatting header 2
+#          built from a Hash of folders
+#
+require 'wmq'
+
+# The folders are supplied as a Hash of properties. Frozen folders, such as mcd below,
+# are only serialized on the first put, subsequent puts copy the serialized folder.
+#
+header = {
+  header_type: :rf_header_2,
+  xml:         {
+    mcd: {Msd: 'jms_text'}.freeze,
+    usr: {}
+  }
+}
+
+WMQ::QueueManager.connect(q_mgr_name: 'REID') do |qmgr|
+  qmgr.open_queue(q_name: 'TEST.QUEUE', mode: :output) do |queue|
+    10.times do |order_id|
+      header[:xml][:usr] = {OrderId: order_id, Price: 12.5, Express: order_id.even?}
+
+      message                     = WMQ::Message.new(data: 'Hello World', headers: [header])
+      message.descriptor[:format] = WMQ::MQFMT_STRING
+
+      queue.put(message: message)
+    end
+  end
+end
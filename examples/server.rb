@@ -9,7 +9,10 @@
 #             prevent messages being if the program terminates unexpectedly
 #             or an error occurrs.
 #             Uses:  sync: true
-#           - Queue#each will backout any message changes if an excecption is raised
+#           - Queue#each commits the messages received and the replies sent in batches
+#             of up to 200 messages, or every 50ms, rather than after every message.
+#             Uses:  commit_every: 200, commit_interval_ms: 50
+#           - Queue#each will backout the whole batch if an excecption is raised
 #             but not handled within the each block
 #
 #     A "well-behaved" WebSphere MQ application should adhere to the following rules:
@@ -50,7 +53,7 @@ require 'wmq'
 
 WMQ::QueueManager.connect(q_mgr_name: 'REID') do |qmgr|
   qmgr.open_queue(q_name: 'TEST.QUEUE', mode: :input) do |queue|
-    queue.each(wait: 60000, sync: true, convert: true) do |request|
+    queue.each(wait: 60000, convert: true, commit_every: 200, commit_interval_ms: 50) do |request|
       puts 'Data Received:'
       puts request.data
 
@@ -77,7 +80,6 @@ WMQ::QueueManager.connect(q_mgr_name: 'REID') do |qmgr|
         # If it fails to put to the dead letter queue, this program will terminate and
         # the changes will be "backed out". E.g. Queue Full, ...
       end
-      qmgr.commit
     end
   end
   puts 'No more messages found after 60 second wait interval'
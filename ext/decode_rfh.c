@@ -119,7 +119,7 @@ void rfh_set_debug_mode(int on_if_true)
 
 static const char *rfh_state_to_s(state_t state)
 {
-    static struct
+    static const struct
     {
         state_t state;
         const char *str;
@@ -142,7 +142,7 @@ static const char *rfh_state_to_s(state_t state)
 
 const char *rfh_toktype_to_s(rfh_toktype_t toktype)
 {
-    static struct
+    static const struct
     {
         rfh_toktype_t toktype;
         const char *str;
@@ -346,3 +346,235 @@ rfh_toktype_t rfh_decode_name_val_str(const char *nvstr, size_t len, CALLBACK_FN
 
     return toktype;
 }
+
+/*
+ * Block scanning decoder
+ *
+ * Rather than copying a character at a time into a token buffer, the
+ * separators and quotes are located 16 bytes at a time (SSE2) or with
+ * memchr, and each name and value is handed to the callback as a pointer
+ * into the NameValueString plus a length.
+ *
+ * Only quoted tokens containing doubled quotes ("") are copied, into a
+ * scratch buffer that is allocated on first use. Since the scratch buffer
+ * is as large as the NameValueString itself there is no token length limit.
+ */
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define RFH_USE_SSE2
+#endif
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+typedef struct {
+    const char *ptr;            /* Start of token, excluding any opening quote */
+    size_t      len;            /* Length of token, excluding any closing quote */
+    int         escaped;        /* Non-zero when token contains doubled quotes */
+} slice_t;
+
+#if defined(RFH_USE_SSE2)
+/* Index of the lowest set bit. mask must not be zero */
+static unsigned int first_bit(unsigned int mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned int)index;
+#else
+    return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+#endif
+
+static const char *skip_separators(const char *charp, const char *endp)
+{
+#if defined(RFH_USE_SSE2)
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i nul   = _mm_setzero_si128();
+
+    /* Tokens are usually separated by a single blank, so check before going wide */
+    if (charp < endp && !IS_SEPARATOR(*charp))
+        return charp;
+
+    while (endp - charp >= 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)charp);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, blank), _mm_cmpeq_epi8(block, nul)));
+
+        if (mask != 0xFFFF)
+            return charp + first_bit(~mask & 0xFFFF);
+        charp += 16;
+    }
+#endif
+    SKIP_SEPARATORS(charp, endp);
+    return charp;
+}
+
+/* Returns pointer to first separator or quote, or endp */
+static const char *find_unquoted_end(const char *charp, const char *endp)
+{
+#if defined(RFH_USE_SSE2)
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i nul   = _mm_setzero_si128();
+    const __m128i quote = _mm_set1_epi8(QUOTE);
+
+    while (endp - charp >= 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)charp);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, blank), _mm_cmpeq_epi8(block, nul)),
+                         _mm_cmpeq_epi8(block, quote)));
+
+        if (mask)
+            return charp + first_bit(mask);
+        charp += 16;
+    }
+#endif
+    while (charp < endp && IS_UNQUOTED_ID_CHAR(*charp))
+        ++charp;
+    return charp;
+}
+
+static rfh_toktype_t get_slice(const char **charpp, const char *endp, slice_t *slice)
+{
+    const char *charp = skip_separators(*charpp, endp);
+    const char *quotep;
+
+    slice->escaped = 0;
+
+    if (charp >= endp)
+    {
+        *charpp = charp;
+        return TT_END;
+    }
+
+    if (*charp != QUOTE)
+    {
+        slice->ptr = charp;
+        charp = find_unquoted_end(charp, endp);
+        slice->len = (size_t)(charp - slice->ptr);
+        *charpp = charp;
+
+        /* Not allowed in unquoted string */
+        return (charp < endp && *charp == QUOTE) ? TT_ILLEGAL_QUOTE : TT_TOKEN;
+    }
+
+    slice->ptr = ++charp;                             /* Skip opening quote */
+    for (;;)
+    {
+        quotep = (const char *)memchr(charp, QUOTE, (size_t)(endp - charp));
+        if (quotep == NULL)
+        {
+            *charpp = endp;
+            return TT_UNEXPECTED_EOS;
+        }
+
+        if (quotep + 1 < endp && quotep[1] == QUOTE)  /* Found escaped quote */
+        {
+            slice->escaped = 1;
+            charp = quotep + 2;
+        }
+        else if (quotep + 1 == endp || IS_SEPARATOR(quotep[1])) /* End of token */
+        {
+            slice->len = (size_t)(quotep - slice->ptr);
+            *charpp = quotep + 1;
+            return TT_TOKEN;
+        }
+        else                                          /* Error: Unescaped quote */
+        {
+            *charpp = quotep + 1;
+            return TT_UNESCAPED_QUOTE;
+        }
+    }
+}
+
+/* Collapse doubled quotes into target, returns length of unescaped token */
+static size_t unescape_slice(const slice_t *slice, char *target)
+{
+    const char *charp = slice->ptr, *endp = slice->ptr + slice->len;
+    const char *quotep;
+    char *tokp = target;
+    size_t run;
+
+    while (charp < endp)
+    {
+        quotep = (const char *)memchr(charp, QUOTE, (size_t)(endp - charp));
+        if (quotep == NULL)
+        {
+            run = (size_t)(endp - charp);
+            memcpy(tokp, charp, run);
+            tokp += run;
+            break;
+        }
+        run = (size_t)(quotep - charp) + 1;           /* Up to and including first quote */
+        memcpy(tokp, charp, run);
+        tokp += run;
+        charp = quotep + 2;                           /* Skip second quote */
+    }
+
+    return (size_t)(tokp - target);
+}
+
+rfh_toktype_t rfh_decode_name_val_slices(const char *nvstr, size_t len, SLICE_CALLBACK_FN callback, void *user_data)
+{
+    const char *charp = nvstr, *endp = nvstr + len;
+    char *scratch = NULL;                             /* Allocated on first escaped token */
+    slice_t name, value;
+    rfh_toktype_t toktype;
+
+    for (;;)
+    {
+        if ((toktype = get_slice(&charp, endp, &name)) != TT_TOKEN)
+        {
+            break;
+        }
+
+        if ((toktype = get_slice(&charp, endp, &value)) != TT_TOKEN)
+        {
+            if (toktype == TT_END) /* Expected a value! */
+                toktype = TT_UNEXPECTED_EOS;
+            break;
+        }
+
+        if (name.escaped || value.escaped)
+        {
+            /* Unescaped name and value together never exceed the input length */
+            if (scratch == NULL && (scratch = (char *)malloc(len)) == NULL)
+            {
+                toktype = TT_ALLOC_FAILURE;
+                break;
+            }
+
+            if (name.escaped)
+            {
+                name.len = unescape_slice(&name, scratch);
+                name.ptr = scratch;
+            }
+
+            if (value.escaped)
+            {
+                char *target = scratch + (name.escaped ? name.len : 0);
+                value.len = unescape_slice(&value, target);
+                value.ptr = target;
+            }
+        }
+
+        if (debug_mode)
+            fprintf(stderr, "name = [%.*s], value = [%.*s]\n",
+                    (int)name.len, name.ptr, (int)value.len, value.ptr);
+
+        callback(name.ptr, name.len, value.ptr, value.len, user_data);
+    }
+
+    if (debug_mode && toktype != TT_END)
+        fprintf(stderr, "-- leaving; returned toktype = %s at offset %ld\n",
+                rfh_toktype_to_s(toktype), (long)(charp - nvstr));
+
+    free(scratch);
+
+    return toktype;
+}
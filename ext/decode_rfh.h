@@ -18,6 +18,12 @@
 
 typedef void (*CALLBACK_FN)(const char *name, const char *value, void *user_data);
 
+/* Name and value are not null-terminated, they point into the
+ * NameValueString or into a scratch buffer only when unescaping was needed */
+typedef void (*SLICE_CALLBACK_FN)(const char *name, size_t name_len,
+                                  const char *value, size_t value_len,
+                                  void *user_data);
+
 typedef enum {
     TT_TOKEN,
     TT_UNESCAPED_QUOTE, /* '"' not followed by '"' in quoted string */
@@ -36,6 +42,15 @@ rfh_decode_name_val_str(const char *nvstr,
                         CALLBACK_FN callback,
                         void *user_data);
 
+/* Same as rfh_decode_name_val_str, but without a token length limit
+ * and without copying tokens that do not need unescaping.
+ * Returns TT_END on success, other on error */
+rfh_toktype_t
+rfh_decode_name_val_slices(const char *nvstr,
+                           size_t len,
+                           SLICE_CALLBACK_FN callback,
+                           void *user_data);
+
 /* Translates toktype_t to string */
 const char *rfh_toktype_to_s(rfh_toktype_t toktype);
 
@@ -0,0 +1,468 @@
+/*
+ * This decoder handles the XML-like folders found in the NameValueData of an
+ * MQRFH2 header. Each folder is a single element containing properties and
+ * nested groups:
+ *
+ *  <usr><OrderId dt="i4">1234</OrderId><Customer><Name>Jack</Name></Customer></usr>
+ *
+ * Only the subset of XML that WebSphere MQ writes into RFH2 folders is
+ * supported:
+ *
+ *   * Elements, with optional single or double quoted attributes
+ *   * Empty elements: <Name/>
+ *   * The entities &lt; &gt; &amp; &quot; &apos; and character references
+ *     &#nnn; / &#xhhh;
+ *   * The dt attribute to specify the data type of a property
+ *   * The xsi:nil attribute to indicate a null property
+ *
+ * An element whose content starts with another element is reported as a group,
+ * otherwise it is reported as a property. Whitespace between elements is
+ * ignored, whitespace within a property value is significant.
+ *
+ * Names and values are passed to the callbacks as slices of the folder. Only
+ * values containing entities are copied into a scratch buffer.
+ */
+
+#include <string.h>
+#include "decode_rfh2.h"
+
+typedef struct {
+    const char           *p;                  /* Next character to examine */
+    const char           *end;                /* Byte after last character */
+    const RFH2_CALLBACKS *callbacks;
+    void                 *user_data;
+    char                 *scratch;            /* Buffer for replacing entities, allocated on demand */
+    size_t                scratch_size;
+} rfh2_parser_t;
+
+typedef struct {
+    const char *name;
+    size_t      name_len;
+    rfh2_dt_t   dt;
+    int         is_nil;
+    int         is_empty;                     /* <Name/> */
+} rfh2_tag_t;
+
+static int is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static int is_name_end(char c)
+{
+    return is_space(c) || c == '>' || c == '/' || c == '=';
+}
+
+static void skip_space(rfh2_parser_t *parser)
+{
+    while (parser->p < parser->end && is_space(*parser->p))
+        parser->p++;
+}
+
+static int slice_equals(const char *slice, size_t len, const char *str)
+{
+    return strlen(str) == len && memcmp(slice, str, len) == 0;
+}
+
+static rfh2_dt_t data_type(const char *value, size_t len)
+{
+    if (slice_equals(value, len, "i1") || slice_equals(value, len, "i2") ||
+        slice_equals(value, len, "i4") || slice_equals(value, len, "i8") ||
+        slice_equals(value, len, "int"))
+        return RFH2_DT_INTEGER;
+    if (slice_equals(value, len, "r4") || slice_equals(value, len, "r8"))
+        return RFH2_DT_FLOAT;
+    if (slice_equals(value, len, "boolean"))
+        return RFH2_DT_BOOLEAN;
+    if (slice_equals(value, len, "bin.hex"))
+        return RFH2_DT_BIN_HEX;
+    return RFH2_DT_STRING;
+}
+
+/*
+ * Parse a start tag, parser must be positioned at the '<'
+ */
+static rfh2_status_t parse_start_tag(rfh2_parser_t *parser, rfh2_tag_t *tag)
+{
+    const char *p   = parser->p + 1;
+    const char *end = parser->end;
+
+    memset(tag, 0, sizeof(*tag));
+    tag->name = p;
+    while (p < end && !is_name_end(*p))
+        p++;
+    tag->name_len = p - tag->name;
+    if (p >= end)
+        return RFH2_UNEXPECTED_EOS;
+    if (tag->name_len == 0)
+        return RFH2_MALFORMED_TAG;
+
+    for (;;)
+    {
+        const char *attr_name;
+        size_t      attr_name_len;
+        const char *value;
+        const char *value_end;
+
+        while (p < end && is_space(*p))
+            p++;
+        if (p >= end)
+            return RFH2_UNEXPECTED_EOS;
+
+        if (*p == '>')
+        {
+            parser->p = p + 1;
+            return RFH2_OK;
+        }
+        if (*p == '/')
+        {
+            if (p + 1 >= end)
+                return RFH2_UNEXPECTED_EOS;
+            if (p[1] != '>')
+                return RFH2_MALFORMED_TAG;
+            tag->is_empty = 1;
+            parser->p = p + 2;
+            return RFH2_OK;
+        }
+
+        /* Attribute: name="value" */
+        attr_name = p;
+        while (p < end && !is_name_end(*p))
+            p++;
+        attr_name_len = p - attr_name;
+        while (p < end && is_space(*p))
+            p++;
+        if (p >= end)
+            return RFH2_UNEXPECTED_EOS;
+        if (attr_name_len == 0 || *p != '=')
+            return RFH2_MALFORMED_TAG;
+        p++;
+        while (p < end && is_space(*p))
+            p++;
+        if (p >= end)
+            return RFH2_UNEXPECTED_EOS;
+        if (*p != '"' && *p != '\'')
+            return RFH2_MALFORMED_TAG;
+        value = p + 1;
+        value_end = memchr(value, *p, end - value);
+        if (value_end == NULL)
+            return RFH2_UNEXPECTED_EOS;
+        p = value_end + 1;
+
+        if (slice_equals(attr_name, attr_name_len, "dt"))
+        {
+            tag->dt = data_type(value, value_end - value);
+        }
+        else if (slice_equals(attr_name, attr_name_len, "xsi:nil"))
+        {
+            tag->is_nil = slice_equals(value, value_end - value, "true") ||
+                          slice_equals(value, value_end - value, "1");
+        }
+    }
+}
+
+/*
+ * Parse an end tag, which must match the start tag. Parser must be positioned
+ * at the "</"
+ */
+static rfh2_status_t parse_end_tag(rfh2_parser_t *parser, const rfh2_tag_t *tag)
+{
+    const char *p = parser->p + 2;
+
+    if ((size_t)(parser->end - p) < tag->name_len + 1)
+        return RFH2_UNEXPECTED_EOS;
+    if (memcmp(p, tag->name, tag->name_len) != 0)
+        return RFH2_MISMATCHED_TAG;
+    p += tag->name_len;
+    while (p < parser->end && is_space(*p))
+        p++;
+    if (p >= parser->end)
+        return RFH2_UNEXPECTED_EOS;
+    if (*p != '>')
+        return RFH2_MISMATCHED_TAG;
+    parser->p = p + 1;
+    return RFH2_OK;
+}
+
+/*
+ * Append a unicode code point as UTF-8
+ */
+static char *put_utf8(char *out, unsigned long cp)
+{
+    if (cp < 0x80)
+    {
+        *out++ = (char)cp;
+    }
+    else if (cp < 0x800)
+    {
+        *out++ = (char)(0xC0 | (cp >> 6));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        *out++ = (char)(0xE0 | (cp >> 12));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        *out++ = (char)(0xF0 | (cp >> 18));
+        *out++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+/*
+ * Replace entities in value, the result is never longer than the input
+ */
+static rfh2_status_t unescape_value(rfh2_parser_t *parser,
+                                    const char *value, size_t len,
+                                    const char **p_out, size_t *p_out_len)
+{
+    const char *p   = value;
+    const char *end = value + len;
+    char       *out;
+
+    if (parser->scratch_size < len)
+    {
+        char *scratch = realloc(parser->scratch, len);
+        if (scratch == NULL)
+            return RFH2_ALLOC_FAILURE;
+        parser->scratch = scratch;
+        parser->scratch_size = len;
+    }
+    out = parser->scratch;
+
+    while (p < end)
+    {
+        const char *amp = memchr(p, '&', end - p);
+        const char *semi;
+        size_t      entity_len;
+
+        if (amp == NULL)
+        {
+            memcpy(out, p, end - p);
+            out += end - p;
+            break;
+        }
+        memcpy(out, p, amp - p);
+        out += amp - p;
+
+        semi = memchr(amp, ';', end - amp);
+        if (semi == NULL)
+            return RFH2_BAD_ENTITY;
+        entity_len = semi - amp - 1;
+
+        if (slice_equals(amp + 1, entity_len, "lt"))
+            *out++ = '<';
+        else if (slice_equals(amp + 1, entity_len, "gt"))
+            *out++ = '>';
+        else if (slice_equals(amp + 1, entity_len, "amp"))
+            *out++ = '&';
+        else if (slice_equals(amp + 1, entity_len, "quot"))
+            *out++ = '"';
+        else if (slice_equals(amp + 1, entity_len, "apos"))
+            *out++ = '\'';
+        else if (entity_len >= 2 && amp[1] == '#')
+        {
+            /* Character reference: &#nnn; or &#xhhh; */
+            const char   *digit = amp + 2;
+            int           hex   = (*digit == 'x' || *digit == 'X');
+            unsigned long cp    = 0;
+
+            if (hex)
+                digit++;
+            if (digit == semi || semi - digit > 8)
+                return RFH2_BAD_ENTITY;
+            for (; digit < semi; digit++)
+            {
+                char c = *digit;
+                if (c >= '0' && c <= '9')
+                    cp = cp * (hex ? 16 : 10) + (c - '0');
+                else if (hex && c >= 'a' && c <= 'f')
+                    cp = cp * 16 + (c - 'a' + 10);
+                else if (hex && c >= 'A' && c <= 'F')
+                    cp = cp * 16 + (c - 'A' + 10);
+                else
+                    return RFH2_BAD_ENTITY;
+            }
+            /* The UTF-8 encoding is never longer than the character reference itself */
+            if (cp > 0x10FFFF)
+                return RFH2_BAD_ENTITY;
+            out = put_utf8(out, cp);
+        }
+        else
+            return RFH2_BAD_ENTITY;
+
+        p = semi + 1;
+    }
+
+    *p_out     = parser->scratch;
+    *p_out_len = out - parser->scratch;
+    return RFH2_OK;
+}
+
+/*
+ * Parse the content of an element up to and including its end tag.
+ * Parser must be positioned after the start tag
+ */
+static rfh2_status_t parse_content(rfh2_parser_t *parser, const rfh2_tag_t *tag, int depth, int is_folder)
+{
+    const char   *content = parser->p;
+    const char   *lt;
+    rfh2_status_t status;
+
+    if (depth > RFH2_MAX_DEPTH)
+        return RFH2_TOO_DEEP;
+
+    skip_space(parser);
+    if (parser->p + 1 < parser->end && parser->p[0] == '<' && parser->p[1] != '/')
+    {
+        /* Group: One or more child elements */
+        if (!is_folder && parser->callbacks->start_group)
+            parser->callbacks->start_group(tag->name, tag->name_len, parser->user_data);
+
+        while (parser->p < parser->end && parser->p[0] == '<')
+        {
+            rfh2_tag_t child;
+
+            if (parser->p + 1 < parser->end && parser->p[1] == '/')
+                break;
+            status = parse_start_tag(parser, &child);
+            if (status != RFH2_OK)
+                return status;
+            if (child.is_empty)
+            {
+                if (parser->callbacks->property)
+                    parser->callbacks->property(child.name, child.name_len, child.dt, child.is_nil,
+                                                "", 0, parser->user_data);
+            }
+            else
+            {
+                status = parse_content(parser, &child, depth + 1, 0);
+                if (status != RFH2_OK)
+                    return status;
+            }
+            skip_space(parser);
+        }
+        if (parser->p >= parser->end)
+            return RFH2_UNEXPECTED_EOS;
+        if (parser->p[0] != '<')
+            return RFH2_MALFORMED_TAG;          /* Text mixed in with elements */
+
+        status = parse_end_tag(parser, tag);
+        if (status == RFH2_OK && !is_folder && parser->callbacks->end_group)
+            parser->callbacks->end_group(parser->user_data);
+        return status;
+    }
+
+    /* Property: Text up to the end tag */
+    lt = memchr(content, '<', parser->end - content);
+    if (lt == NULL || lt + 1 >= parser->end)
+        return RFH2_UNEXPECTED_EOS;
+    if (lt[1] != '/')
+        return RFH2_MALFORMED_TAG;
+    parser->p = lt;
+    status = parse_end_tag(parser, tag);
+    if (status != RFH2_OK)
+        return status;
+
+    if (is_folder)
+        return RFH2_OK;                          /* Ignore text directly within a folder */
+
+    if (parser->callbacks->property)
+    {
+        const char *value     = content;
+        size_t      value_len = lt - content;
+
+        if (memchr(value, '&', value_len))
+        {
+            status = unescape_value(parser, content, lt - content, &value, &value_len);
+            if (status != RFH2_OK)
+                return status;
+        }
+        parser->callbacks->property(tag->name, tag->name_len, tag->dt, tag->is_nil,
+                                    value, value_len, parser->user_data);
+    }
+    return RFH2_OK;
+}
+
+rfh2_status_t
+rfh2_folder_name(const char *folder,
+                 size_t len,
+                 const char **p_name,
+                 size_t *p_name_len)
+{
+    const char *p   = folder;
+    const char *end = folder + len;
+
+    while (p < end && is_space(*p))
+        p++;
+    if (p >= end)
+        return RFH2_UNEXPECTED_EOS;
+    if (*p != '<')
+        return RFH2_MALFORMED_TAG;
+    *p_name = ++p;
+    while (p < end && !is_name_end(*p))
+        p++;
+    *p_name_len = p - *p_name;
+    if (p >= end)
+        return RFH2_UNEXPECTED_EOS;
+    return *p_name_len ? RFH2_OK : RFH2_MALFORMED_TAG;
+}
+
+rfh2_status_t
+rfh2_decode_folder(const char *folder,
+                   size_t len,
+                   const RFH2_CALLBACKS *callbacks,
+                   void *user_data)
+{
+    rfh2_parser_t parser;
+    rfh2_tag_t    tag;
+    rfh2_status_t status;
+
+    parser.p            = folder;
+    parser.end          = folder + len;
+    parser.callbacks    = callbacks;
+    parser.user_data    = user_data;
+    parser.scratch      = NULL;
+    parser.scratch_size = 0;
+
+    skip_space(&parser);
+    if (parser.p >= parser.end)
+        return RFH2_UNEXPECTED_EOS;
+    if (*parser.p != '<')
+        return RFH2_MALFORMED_TAG;
+
+    status = parse_start_tag(&parser, &tag);
+    if (status == RFH2_OK && !tag.is_empty)
+        status = parse_content(&parser, &tag, 0, 1);
+
+    free(parser.scratch);
+    return status;
+}
+
+const char *rfh2_status_to_s(rfh2_status_t status)
+{
+    switch (status)
+    {
+    case RFH2_OK:
+        return "OK";
+    case RFH2_UNEXPECTED_EOS:
+        return "Unexpected end of folder";
+    case RFH2_MALFORMED_TAG:
+        return "Malformed element";
+    case RFH2_MISMATCHED_TAG:
+        return "End tag does not match start tag";
+    case RFH2_BAD_ENTITY:
+        return "Invalid entity or character reference";
+    case RFH2_TOO_DEEP:
+        return "Groups nested too deeply";
+    case RFH2_ALLOC_FAILURE:
+        return "Memory allocation failure";
+    default:
+        return "Unknown status";
+    }
+}
@@ -0,0 +1,60 @@
+#if !defined(DECODE_RFH2_INCLUDED)
+#define DECODE_RFH2_INCLUDED
+
+#include <stdlib.h> /* For size_t */
+
+/*
+ * Decoder for the subset of XML used in MQRFH2 NameValueData folders
+ * E.g. <usr><OrderId dt="i4">1234</OrderId><Customer><Name>Jack</Name></Customer></usr>
+ */
+
+#define RFH2_MAX_DEPTH 64   /* Maximum nesting of groups within a folder */
+
+typedef enum {
+    RFH2_DT_STRING,      /* No dt attribute, or an unknown data type */
+    RFH2_DT_BOOLEAN,     /* dt="boolean"                            */
+    RFH2_DT_BIN_HEX,     /* dt="bin.hex"                            */
+    RFH2_DT_INTEGER,     /* dt="i1", "i2", "i4", "i8" or "int"      */
+    RFH2_DT_FLOAT        /* dt="r4" or "r8"                         */
+} rfh2_dt_t;
+
+/* Names and values are not null-terminated, they point into the
+ * folder or into a scratch buffer only when entities had to be replaced */
+typedef struct {
+    void (*start_group)(const char *name, size_t name_len, void *user_data);
+    void (*end_group)(void *user_data);
+    void (*property)(const char *name, size_t name_len,
+                     rfh2_dt_t dt, int is_nil,
+                     const char *value, size_t value_len,
+                     void *user_data);
+} RFH2_CALLBACKS;
+
+typedef enum {
+    RFH2_OK,
+    RFH2_UNEXPECTED_EOS,
+    RFH2_MALFORMED_TAG,
+    RFH2_MISMATCHED_TAG,  /* End tag does not match start tag */
+    RFH2_BAD_ENTITY,      /* Unknown or malformed &entity;    */
+    RFH2_TOO_DEEP,        /* Groups nested too deeply         */
+    RFH2_ALLOC_FAILURE
+} rfh2_status_t;
+
+/* Returns the name of the folder (the outer element) without decoding it */
+rfh2_status_t
+rfh2_folder_name(const char *folder,
+                 size_t len,
+                 const char **p_name,
+                 size_t *p_name_len);
+
+/* Calls back for every property and nested group in the folder.
+ * The outer element itself is not reported */
+rfh2_status_t
+rfh2_decode_folder(const char *folder,
+                   size_t len,
+                   const RFH2_CALLBACKS *callbacks,
+                   void *user_data);
+
+/* Translates rfh2_status_t to string */
+const char *rfh2_status_to_s(rfh2_status_t status);
+
+#endif
@@ -18,6 +18,9 @@ else
 end
 
 have_header('cmqc.h')
+have_func('rb_fiber_scheduler_current', 'ruby/fiber/scheduler.h')
+have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+have_func('rb_ext_ractor_safe', 'ruby.h')
 
 # Check for WebSphere MQ Server library
 unless (RUBY_PLATFORM =~ /win/i) || (RUBY_PLATFORM =~ /solaris/i) || (RUBY_PLATFORM =~ /linux/i)
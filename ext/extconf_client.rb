@@ -20,5 +20,8 @@ unless (RUBY_PLATFORM =~ /win/i) || (RUBY_PLATFORM =~ /solaris/i) || (RUBY_PLATF
   GenerateStructs.new(include_path+'/', '../../generate').generate
 
   have_header('cmqc.h')
+  have_func('rb_fiber_scheduler_current', 'ruby/fiber/scheduler.h')
+  have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+  have_func('rb_ext_ractor_safe', 'ruby.h')
   create_makefile('wmq_client')
 end
@@ -64,6 +64,7 @@ class GenerateConst
 
   def GenerateConst.wmq_const(path)
     str = <<END_OF_STRING
+# frozen_string_literal: true
 ################################################################################
 #
 #  WARNING: DO NOT MODIFY THIS FILE
@@ -104,6 +105,7 @@ END_OF_STRING
 
   def GenerateConst.admin_consts(path)
     str = <<END_OF_STRING
+# frozen_string_literal: true
 ################################################################################
 #
 #  WARNING: DO NOT MODIFY THIS FILE
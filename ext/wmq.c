@@ -3,11 +3,19 @@
 VALUE wmq_queue;
 VALUE wmq_queue_manager;
 VALUE wmq_message;
+VALUE wmq_rfh2_folders;
+VALUE wmq_message_properties;
+VALUE wmq_async_consumer;
 VALUE wmq_exception;
 
 void Init_wmq() {
     VALUE wmq;
 
+  #ifdef HAVE_RB_EXT_RACTOR_SAFE
+    /* No mutable global state, every QueueManager and Queue has its own buffers */
+    rb_ext_ractor_safe(true);
+  #endif
+
     wmq = rb_define_module("WMQ");
 
     wmq_queue_manager = rb_define_class_under(wmq, "QueueManager", rb_cObject);
@@ -27,6 +35,7 @@ void Init_wmq() {
     rb_define_method(wmq_queue_manager, "reason", QueueManager_reason, 0);          /* in wmq_queue_manager.c */
     rb_define_method(wmq_queue_manager, "exception_on_error", QueueManager_exception_on_error, 0); /* in wmq_queue_manager.c */
     rb_define_method(wmq_queue_manager, "connected?", QueueManager_connected_q, 0); /* in wmq_queue_manager.c */
+    rb_define_method(wmq_queue_manager, "alive?", QueueManager_alive_q, 0);         /* in wmq_queue_manager.c */
     rb_define_method(wmq_queue_manager, "name", QueueManager_name, 0);              /* in wmq_queue_manager.c */
     rb_define_method(wmq_queue_manager, "execute", QueueManager_execute, 1);        /* in wmq_queue_manager.c */
 
@@ -44,10 +53,40 @@ void Init_wmq() {
     rb_define_method(wmq_queue, "reason_code", Queue_reason_code, 0);               /* in wmq_queue.c */
     rb_define_method(wmq_queue, "reason", Queue_reason, 0);                         /* in wmq_queue.c */
     rb_define_method(wmq_queue, "open?", Queue_open_q, 0);                          /* in wmq_queue.c */
+    rb_define_method(wmq_queue, "stats", Queue_stats, 0);                           /* in wmq_queue.c */
 
     wmq_message = rb_define_class_under(wmq, "Message", rb_cObject);
     rb_define_method(wmq_message, "initialize", Message_initialize, -1);            /* in wmq_message.c */
     rb_define_method(wmq_message, "clear", Message_clear, 0);                       /* in wmq_message.c */
+    rb_define_singleton_method(wmq_message, "decode_name_value", Message_singleton_decode_name_value, -1); /* in wmq_message.c */
+    rb_define_singleton_method(wmq_message, "convert", Message_singleton_convert, 3); /* in wmq_message.c */
+
+    wmq_rfh2_folders = rb_define_class_under(wmq, "RFH2Folders", rb_cObject);
+    rb_include_module(wmq_rfh2_folders, rb_mEnumerable);
+    rb_define_method(wmq_rfh2_folders, "initialize", RFH2Folders_initialize, 1);    /* in wmq_message.c */
+    rb_define_method(wmq_rfh2_folders, "[]", RFH2Folders_aref, 1);                  /* in wmq_message.c */
+    rb_define_method(wmq_rfh2_folders, "keys", RFH2Folders_keys, 0);                /* in wmq_message.c */
+    rb_define_method(wmq_rfh2_folders, "each", RFH2Folders_each, 0);                /* in wmq_message.c */
+    rb_define_method(wmq_rfh2_folders, "to_h", RFH2Folders_to_h, 0);                /* in wmq_message.c */
+
+    wmq_message_properties = rb_define_class_under(wmq, "MessageProperties", rb_cObject);
+    rb_undef_alloc_func(wmq_message_properties);                                    /* Only created by WMQ::Queue#get */
+    rb_define_method(wmq_message_properties, "[]", MessageProperties_aref, 1);      /* in wmq_queue.c */
+    rb_define_method(wmq_message_properties, "to_h", MessageProperties_to_h, 0);    /* in wmq_queue.c */
+
+    wmq_async_consumer = rb_define_class_under(wmq, "AsyncConsumer", rb_cObject);
+    rb_define_alloc_func(wmq_async_consumer, ASYNC_CONSUMER_alloc);
+    rb_define_method(wmq_async_consumer, "initialize", AsyncConsumer_initialize, 1); /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "register", AsyncConsumer_register, -1);   /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "start", AsyncConsumer_start, 0);          /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "stop", AsyncConsumer_stop, 0);            /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "pop_nonblock", AsyncConsumer_pop_nonblock, 0); /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "to_io", AsyncConsumer_to_io, 0);          /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "size", AsyncConsumer_size, 0);            /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "started?", AsyncConsumer_started_q, 0);   /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "comp_code", AsyncConsumer_comp_code, 0);  /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "reason_code", AsyncConsumer_reason_code, 0); /* in wmq_async_consumer.c */
+    rb_define_method(wmq_async_consumer, "reason", AsyncConsumer_reason, 0);        /* in wmq_async_consumer.c */
 
     /*
      * WMQException is thrown whenever an MQ operation fails and
@@ -60,6 +99,7 @@ void Init_wmq() {
      */
     Message_id_init();
     Queue_id_init();
+    AsyncConsumer_id_init();
     QueueManager_id_init();
     QueueManager_selector_id_init();
     QueueManager_command_id_init();
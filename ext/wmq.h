@@ -24,6 +24,10 @@
 #include <cmqc.h>
 #include <cmqxc.h>
 
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+  #include <ruby/thread.h>
+#endif
+
 /* Todo: Add a #ifdef here to exclude the following includes when applicable  */
 #include <cmqcfc.h>                        /* PCF                             */
 #include <cmqbc.h>                         /* MQAI                            */
@@ -52,6 +56,10 @@ VALUE QueueManager_comp_code(VALUE self);
 VALUE QueueManager_reason(VALUE self);
 VALUE QueueManager_exception_on_error(VALUE self);
 VALUE QueueManager_connected_q(VALUE self);
+VALUE QueueManager_alive_q(VALUE self);
+int   QueueManager_connection_error(MQLONG reason_code);
+int   QueueManager_reconnect(VALUE self, long connection_id);
+int   QueueManager_after_fork(VALUE self);
 VALUE QueueManager_name(VALUE self);
 VALUE QueueManager_execute(VALUE self, VALUE hash);
 
@@ -69,12 +77,35 @@ VALUE Queue_reason_code(VALUE self);
 VALUE Queue_comp_code(VALUE self);
 VALUE Queue_reason(VALUE self);
 VALUE Queue_open_q(VALUE self);
+VALUE Queue_stats(VALUE self);
+
+MQHOBJ Queue_hobj(VALUE self, MQHCONN hcon);
+
+VALUE MessageProperties_aref(VALUE self, VALUE name);
+VALUE MessageProperties_to_h(VALUE self);
 
 void Queue_extract_put_message_options(VALUE hash, PMQPMO ppmo);
 
+void  AsyncConsumer_id_init();
+VALUE ASYNC_CONSUMER_alloc(VALUE klass);
+VALUE AsyncConsumer_initialize(VALUE self, VALUE parms);
+VALUE AsyncConsumer_register(int argc, VALUE *argv, VALUE self);
+VALUE AsyncConsumer_start(VALUE self);
+VALUE AsyncConsumer_stop(VALUE self);
+VALUE AsyncConsumer_pop_nonblock(VALUE self);
+VALUE AsyncConsumer_to_io(VALUE self);
+VALUE AsyncConsumer_size(VALUE self);
+VALUE AsyncConsumer_started_q(VALUE self);
+VALUE AsyncConsumer_comp_code(VALUE self);
+VALUE AsyncConsumer_reason_code(VALUE self);
+VALUE AsyncConsumer_reason(VALUE self);
+
 extern VALUE wmq_queue;
 extern VALUE wmq_queue_manager;
 extern VALUE wmq_message;
+extern VALUE wmq_rfh2_folders;
+extern VALUE wmq_message_properties;
+extern VALUE wmq_async_consumer;
 extern VALUE wmq_exception;
 
 #define WMQ_EXEC_STRING_INQ_BUFFER_SIZE 32768           /* Todo: Should we make the mqai string return buffer dynamic? */
@@ -90,6 +121,15 @@ extern VALUE wmq_exception;
     MQLONG   exception_on_error;      /* Non-Zero means throw exception*/
     MQLONG   already_connected;       /* Already connected means don't disconnect */
     MQLONG   trace_level;             /* Trace level. 0==None, 1==Info 2==Debug ..*/
+    MQLONG   share_handle;            /* Non-Zero means hcon is shared between threads */
+    MQLONG   release_gvl;             /* Non-Zero means call MQ without the GVL */
+    MQHOBJ   inquire_hobj;            /* Queue manager object opened by alive? */
+    MQLONG   reconnect_attempts;      /* Non-Zero means reconnect when the connection breaks */
+    MQLONG   reconnect_wait;          /* Milliseconds to wait before the first reconnect attempt */
+    MQLONG   reconnecting;            /* Non-Zero while a reconnect is in progress */
+    long     connection_id;           /* Incremented by every successful connect */
+    rb_pid_t pid;                     /* Process that connected, hcon is not valid in a forked child */
+    MQLONG   reconnect_after_fork;    /* Non-Zero means connect again on first use in a forked child */
     MQCNO    connect_options;         /* MQCONNX Connection Options    */
   #ifdef MQCNO_VERSION_2
     MQCD     client_conn;             /* Client Connection             */
@@ -129,6 +169,17 @@ extern VALUE wmq_exception;
     void(*MQINQ)  (MQHCONN,MQHOBJ,MQLONG,PMQLONG,MQLONG,PMQLONG,MQLONG,PMQCHAR,PMQLONG,PMQLONG);
     void(*MQSET)  (MQHCONN,MQHOBJ,MQLONG,PMQLONG,MQLONG,PMQLONG,MQLONG,PMQCHAR,PMQLONG,PMQLONG);
 
+  #ifdef MQHM_UNUSABLE_HMSG
+    void(*MQCRTMH)(MQHCONN,PMQVOID,PMQHMSG,PMQLONG,PMQLONG);
+    void(*MQDLTMH)(MQHCONN,PMQHMSG,PMQVOID,PMQLONG,PMQLONG);
+    void(*MQINQMP)(MQHCONN,MQHMSG,PMQVOID,PMQVOID,PMQVOID,PMQLONG,MQLONG,PMQVOID,PMQLONG,PMQLONG,PMQLONG);
+    void(*MQSETMP)(MQHCONN,MQHMSG,PMQVOID,PMQVOID,PMQVOID,MQLONG,MQLONG,PMQVOID,PMQLONG,PMQLONG);
+  #endif
+  #ifdef MQCBT_MESSAGE_CONSUMER
+    void(*MQCB)   (MQHCONN,MQLONG,PMQVOID,MQHOBJ,PMQVOID,PMQVOID,PMQLONG,PMQLONG);
+    void(*MQCTL)  (MQHCONN,MQLONG,PMQVOID,PMQLONG,PMQLONG);
+  #endif
+
     void(*mqCreateBag)(MQLONG,PMQHBAG,PMQLONG,PMQLONG);
     void(*mqDeleteBag)(PMQHBAG,PMQLONG,PMQLONG);
     void(*mqClearBag)(MQHBAG,PMQLONG,PMQLONG);
@@ -145,11 +196,54 @@ extern VALUE wmq_exception;
 
 void Queue_manager_mq_load(PQUEUE_MANAGER pqm);
 void Queue_manager_mq_free(PQUEUE_MANAGER pqm);
+int  Queue_manager_put_properties(PQUEUE_MANAGER pqm, VALUE hash, PMQPMO ppmo);
+void Queue_manager_delete_hmsg(PQUEUE_MANAGER pqm, PMQPMO ppmo);
+
+/*
+ * Run FUNC(ARG) without the GVL with :release_gvl or :share_handle, so that
+ * a call waiting on MQ does not stop other Ruby threads.
+ * MQ calls cannot be interrupted, so no unblocking function is supplied.
+ */
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+  #define WMQ_CALL_WITHOUT_GVL(RELEASE, FUNC, ARG)             \
+    if (RELEASE) rb_thread_call_without_gvl(FUNC, ARG, 0, 0); \
+    else         FUNC(ARG);
+#else
+  #define WMQ_CALL_WITHOUT_GVL(RELEASE, FUNC, ARG) FUNC(ARG);
+#endif
 
 
 /*
  * Message
  */
+/* Byte swap an MQLONG in a header whose Encoding does not match the platform */
+#if defined(__GNUC__) || defined(__clang__)
+  #define WMQ_SWAP_MQLONG(x) ((MQLONG)__builtin_bswap32((unsigned int)(x)))
+#elif defined(_MSC_VER)
+  #define WMQ_SWAP_MQLONG(x) ((MQLONG)_byteswap_ulong((unsigned long)(x)))
+#else
+  #define WMQ_SWAP_MQLONG(x) ((MQLONG)((((unsigned int)(x) & 0x000000FFU) << 24) | \
+                                      (((unsigned int)(x) & 0x0000FF00U) << 8)  | \
+                                      (((unsigned int)(x) & 0x00FF0000U) >> 8)  | \
+                                      (((unsigned int)(x) & 0xFF000000U) >> 24)))
+#endif
+
+/* True when the integers described by an Encoding are in the opposite byte order to MQENC_NATIVE */
+#define WMQ_ENCODING_SWAP(enc)                                                          \
+    ((((enc) & MQENC_INTEGER_MASK) == MQENC_INTEGER_NORMAL ||                           \
+      ((enc) & MQENC_INTEGER_MASK) == MQENC_INTEGER_REVERSED) &&                        \
+     ((enc) & MQENC_INTEGER_MASK) != (MQENC_NATIVE & MQENC_INTEGER_MASK))
+
+/* Encoding after its integers have been swapped to native byte order */
+#define WMQ_ENCODING_NATIVE_INTEGER(enc) (((enc) & ~MQENC_INTEGER_MASK) | (MQENC_NATIVE & MQENC_INTEGER_MASK))
+
+/* Counters maintained by Message_build, returned by WMQ::Queue#stats */
+struct Message_build_stats {
+    long     builds;                                  /* Messages built with headers */
+    long     buffer_resizes;                          /* Buffer grown to the exact message size before building */
+    long     build_reallocations;                     /* Buffer grown while building, expected to remain 0 */
+};
+
 struct Message_build_header_arg {
     PMQBYTE* pp_buffer;                               /* Autosize: Pointer to start of total buffer */
     PMQLONG  p_buffer_size;                           /* Autosize: Size of total buffer */
@@ -158,24 +252,41 @@ struct Message_build_header_arg {
     MQLONG   trace_level;                             /* Trace level. 0==None, 1==Info 2==Debug ..*/
     ID       next_header_id;                          /* Used for setting MQ Format to next header */
     PMQBYTE  data_format;                             /* Format of data. Used when next_header_id == 0 */
+    struct Message_build_stats* p_stats;              /* Optional counters, may be 0 */
 };
 
 void    Message_id_init();
 VALUE   Message_initialize(int argc, VALUE *argv, VALUE self);
 VALUE   Message_clear(VALUE self);
+VALUE   Message_singleton_decode_name_value(int argc, VALUE *argv, VALUE self);
 PMQBYTE Message_autogrow_data_buffer(struct Message_build_header_arg* parg, MQLONG additional_size);
+MQLONG  Message_size_rf_header (VALUE hash);
 void    Message_build_rf_header (VALUE hash, struct Message_build_header_arg* parg);
 MQLONG  Message_deblock_rf_header (VALUE hash, PMQBYTE p_data, MQLONG data_len);
+MQLONG  Message_size_rf_header_2 (VALUE hash);
 void    Message_build_rf_header_2 (VALUE hash, struct Message_build_header_arg* parg);
 MQLONG  Message_deblock_rf_header_2 (VALUE hash, PMQBYTE p_data, MQLONG data_len);
+void    Message_convert_rf_header (PMQBYTE p_data, MQLONG data_len, MQLONG ccsid);
+void    Message_convert_rf_header_2 (PMQBYTE p_data, MQLONG data_len, MQLONG ccsid);
+void    Message_swap_rf_header_2 (PMQBYTE p_data, MQLONG data_len);
+VALUE   Message_convert_string(PMQBYTE p_data, MQLONG data_len, MQLONG from_ccsid, MQLONG to_ccsid);
+VALUE   Message_singleton_convert(VALUE self, VALUE data, VALUE from_ccsid, VALUE to_ccsid);
+
+VALUE   RFH2Folders_initialize(VALUE self, VALUE xml);
+VALUE   RFH2Folders_aref(VALUE self, VALUE name);
+VALUE   RFH2Folders_keys(VALUE self);
+VALUE   RFH2Folders_each(VALUE self);
+VALUE   RFH2Folders_to_h(VALUE self);
 
 void    Message_build_set_format(ID header_type, PMQBYTE p_format);
 void    Message_build(PMQBYTE* pq_pp_buffer, PMQLONG pq_p_buffer_size, MQLONG trace_level,
-                      VALUE parms, PPMQVOID pp_buffer, PMQLONG p_total_length, PMQMD pmqmd);
+                      VALUE parms, PPMQVOID pp_buffer, PMQLONG p_total_length, PMQMD pmqmd,
+                      struct Message_build_stats* p_stats);
 void    Message_build_mqmd(VALUE self, PMQMD pmqmd);
-void    Message_deblock(VALUE message, PMQMD pmqmd, PMQBYTE p_buffer, MQLONG total_length, MQLONG trace_level);
+void    Message_deblock(VALUE message, PMQMD pmqmd, PMQBYTE p_buffer, MQLONG total_length, MQLONG convert_ccsid, MQLONG trace_level);
 
-int  Message_build_header(VALUE hash, struct Message_build_header_arg* parg);
+int    Message_build_header(VALUE hash, struct Message_build_header_arg* parg);
+MQLONG Message_size_header(VALUE hash);
 
 /* Utility methods */
 
@@ -0,0 +1,636 @@
+#include "wmq.h"
+
+#if defined(MQCBT_MESSAGE_CONSUMER) && !defined(_WIN32)
+  #define WMQ_ASYNC_CONSUMER
+  #include <ruby/io.h>
+  #include <pthread.h>
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <errno.h>
+  #include <stddef.h>
+#endif
+
+#ifndef MQENTRY
+  #define MQENTRY
+#endif
+
+static ID ID_new;
+static ID ID_queue_manager;
+static ID ID_capacity;
+static ID ID_sync;
+static ID ID_convert;
+static ID ID_fail_if_quiescing;
+static ID ID_options;
+
+void AsyncConsumer_id_init(void)
+{
+    ID_new                  = rb_intern("new");
+    ID_queue_manager        = rb_intern("queue_manager");
+    ID_capacity             = rb_intern("capacity");
+    ID_sync                 = rb_intern("sync");
+    ID_convert              = rb_intern("convert");
+    ID_fail_if_quiescing    = rb_intern("fail_if_quiescing");
+    ID_options              = rb_intern("options");
+}
+
+/* --------------------------------------------------
+ * Messages received by the MQ callback thread are
+ * copied into a linked list of ASYNC_MESSAGE, with a
+ * single producer (MQ only runs one callback at a time
+ * for a connection) and a single consumer (Ruby, under
+ * the GVL), so neither side takes a lock.
+ *
+ * The consumer always holds one already consumed node
+ * at head, so the producer never touches a node that
+ * the consumer frees.
+ * --------------------------------------------------*/
+ typedef struct tagASYNC_MESSAGE ASYNC_MESSAGE;
+ typedef ASYNC_MESSAGE MQPOINTER PASYNC_MESSAGE;
+
+ struct tagASYNC_MESSAGE {
+    PASYNC_MESSAGE next;
+    MQHOBJ   hobj;                    /* Queue the message was received from */
+    MQMD     md;                      /* Message descriptor            */
+    MQLONG   length;                  /* Length of data                */
+    MQBYTE   data[1];                 /* Message data, headers included */
+ };
+
+ typedef struct tagASYNC_CONSUMER ASYNC_CONSUMER;
+ typedef ASYNC_CONSUMER MQPOINTER PASYNC_CONSUMER;
+
+ struct tagASYNC_CONSUMER {
+    VALUE    queue_manager;           /* WMQ::QueueManager owning the connection */
+    VALUE    queues;                  /* Hash of object handle => WMQ::Queue */
+    VALUE    io;                      /* IO signalled when messages arrive */
+    MQHCONN  hcon;                    /* connection handle             */
+    MQLONG   comp_code;               /* completion code               */
+    MQLONG   reason_code;             /* reason code                   */
+    MQLONG   exception_on_error;      /* Non-Zero means throw exception*/
+    MQLONG   trace_level;             /* Trace level. 0==None, 1==Info 2==Debug ..*/
+    long     capacity;                /* Callback waits while this many messages are queued */
+    int      started;                 /* Non-Zero between start and stop */
+    rb_pid_t pid;                     /* Process that started delivery */
+  #ifdef WMQ_ASYNC_CONSUMER
+    PASYNC_MESSAGE head;              /* Consumer: last node consumed  */
+    PASYNC_MESSAGE tail;              /* Producer: last node added     */
+    long     count;                   /* Messages waiting to be consumed */
+    int      stopping;                /* Callback no longer waits for capacity */
+    int      producer_waiting;        /* Callback is waiting for capacity */
+    MQLONG   event_comp_code;         /* Failure reported to the callback, E.g. Connection broken */
+    MQLONG   event_reason_code;
+    int      fds[2];                  /* Pipe: Callback writes, Ruby waits on fds[0] */
+    pthread_mutex_t mutex;
+    pthread_cond_t  not_full;
+
+    void(*MQCB)   (MQHCONN,MQLONG,PMQVOID,MQHOBJ,PMQVOID,PMQVOID,PMQLONG,PMQLONG);
+    void(*MQCTL)  (MQHCONN,MQLONG,PMQVOID,PMQLONG,PMQLONG);
+  #endif
+ };
+
+#ifdef WMQ_ASYNC_CONSUMER
+/*
+ * Runs on the MQ callback thread, without the GVL. Must not call Ruby.
+ */
+static void MQENTRY AsyncConsumer_callback(MQHCONN hconn, PMQVOID pmd, PMQVOID pgmo, PMQVOID buffer, PMQCBC pcontext)
+{
+    PASYNC_CONSUMER pac = (PASYNC_CONSUMER)pcontext->CallbackArea;
+    PASYNC_MESSAGE  node;
+
+    if (pcontext->CallType != MQCBCT_MSG_REMOVED && pcontext->CallType != MQCBCT_MSG_NOT_REMOVED)
+    {
+        if (pcontext->CompCode == MQCC_FAILED)           /* E.g. Connection broken, Queue Manager quiescing */
+        {
+            __atomic_store_n(&pac->event_reason_code, pcontext->Reason, __ATOMIC_RELAXED);
+            __atomic_store_n(&pac->event_comp_code, pcontext->CompCode, __ATOMIC_RELEASE);
+            if (write(pac->fds[1], "", 1) < 0) { /* Pipe full, Ruby is already signalled */ }
+        }
+        return;
+    }
+    if (pcontext->CompCode == MQCC_FAILED)
+    {
+        if(pac->trace_level) printf("WMQ::AsyncConsumer Callback failed with reason:%s\n", wmq_reason(pcontext->Reason));
+        return;
+    }
+
+    /* Backpressure: Hold the callback, and therefore further deliveries, while Ruby catches up */
+    if (__atomic_load_n(&pac->count, __ATOMIC_SEQ_CST) >= pac->capacity &&
+        !__atomic_load_n(&pac->stopping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&pac->mutex);
+        __atomic_store_n(&pac->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pac->count, __ATOMIC_SEQ_CST) >= pac->capacity &&
+               !__atomic_load_n(&pac->stopping, __ATOMIC_SEQ_CST))
+        {
+            pthread_cond_wait(&pac->not_full, &pac->mutex);
+        }
+        __atomic_store_n(&pac->producer_waiting, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pac->mutex);
+    }
+
+    node = (PASYNC_MESSAGE)malloc(offsetof(ASYNC_MESSAGE, data) + (size_t)pcontext->DataLength);
+    if (!node)
+    {
+        __atomic_store_n(&pac->event_reason_code, MQRC_STORAGE_NOT_AVAILABLE, __ATOMIC_RELAXED);
+        __atomic_store_n(&pac->event_comp_code, MQCC_FAILED, __ATOMIC_RELEASE);
+        if (write(pac->fds[1], "", 1) < 0) { /* Pipe full, Ruby is already signalled */ }
+        return;
+    }
+    node->next   = 0;
+    node->hobj   = pcontext->Hobj;
+    node->length = pcontext->DataLength;
+    memcpy(&node->md, pmd, sizeof(MQMD));
+    memcpy(node->data, buffer, (size_t)pcontext->DataLength);
+
+    __atomic_store_n(&pac->tail->next, node, __ATOMIC_RELEASE);
+    pac->tail = node;
+
+    if (__atomic_fetch_add(&pac->count, 1, __ATOMIC_SEQ_CST) == 0)   /* Only signal Ruby when it may be waiting */
+    {
+        if (write(pac->fds[1], "", 1) < 0) { /* Pipe full, Ruby is already signalled */ }
+    }
+}
+
+/*
+ * Remove the next message, or return 0 when there are none
+ * The returned node remains valid until the next call
+ */
+static PASYNC_MESSAGE AsyncConsumer_shift(PASYNC_CONSUMER pac)
+{
+    PASYNC_MESSAGE next = __atomic_load_n(&pac->head->next, __ATOMIC_ACQUIRE);
+
+    if (!next)
+    {
+        return 0;
+    }
+    free(pac->head);
+    pac->head = next;
+
+    __atomic_fetch_sub(&pac->count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pac->producer_waiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&pac->mutex);
+        pthread_cond_signal(&pac->not_full);
+        pthread_mutex_unlock(&pac->mutex);
+    }
+    return next;
+}
+
+/* Discard any signals, so that the next wait only returns once a new message arrives */
+static void AsyncConsumer_drain(PASYNC_CONSUMER pac)
+{
+    char buffer[64];
+    while (read(pac->fds[0], buffer, sizeof(buffer)) > 0) ;
+}
+
+/* Release the callback from waiting for capacity, so that MQCTL(MQOP_STOP) can complete */
+static void AsyncConsumer_release(PASYNC_CONSUMER pac)
+{
+    __atomic_store_n(&pac->stopping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&pac->mutex);
+    pthread_cond_broadcast(&pac->not_full);
+    pthread_mutex_unlock(&pac->mutex);
+}
+#endif
+
+/* --------------------------------------------------
+ * C Structure to store MQ data types and other
+ *   C internal values
+ * --------------------------------------------------*/
+static void ASYNC_CONSUMER_mark(void* p)
+{
+    PASYNC_CONSUMER pac = (PASYNC_CONSUMER)p;
+    rb_gc_mark(pac->queue_manager);
+    rb_gc_mark(pac->queues);
+    rb_gc_mark(pac->io);
+}
+
+static void ASYNC_CONSUMER_free(void* p)
+{
+    PASYNC_CONSUMER pac = (PASYNC_CONSUMER)p;
+    if(pac->trace_level) printf("WMQ::AsyncConsumer Freeing ASYNC_CONSUMER structure\n");
+
+  #ifdef WMQ_ASYNC_CONSUMER
+    if (pac->started && pac->pid == getpid())  /* MQCTL(MQOP_STOP) was not called, and not a forked child */
+    {
+        printf("WMQ::AsyncConsumer#stop was not called. Automatically calling stop()\n");
+        {
+            MQCTLO ctlo = {MQCTLO_DEFAULT};
+            AsyncConsumer_release(pac);
+            pac->MQCTL(pac->hcon, MQOP_STOP, &ctlo, &pac->comp_code, &pac->reason_code);
+        }
+    }
+    while (AsyncConsumer_shift(pac)) ;
+    free(pac->head);
+    if (pac->fds[1] >= 0) close(pac->fds[1]); /* fds[0] is closed by the IO */
+    pthread_mutex_destroy(&pac->mutex);
+    pthread_cond_destroy(&pac->not_full);
+  #endif
+    free(p);
+}
+
+VALUE ASYNC_CONSUMER_alloc(VALUE klass)
+{
+    PASYNC_CONSUMER pac = ALLOC(ASYNC_CONSUMER);
+
+    pac->queue_manager = Qnil;
+    pac->queues = Qnil;
+    pac->io = Qnil;
+    pac->hcon = 0;
+    pac->comp_code = 0;
+    pac->reason_code = 0;
+    pac->exception_on_error = 1;
+    pac->trace_level = 0;
+    pac->capacity = 1000;
+    pac->started = 0;
+    pac->pid = 0;
+  #ifdef WMQ_ASYNC_CONSUMER
+    pac->head = (PASYNC_MESSAGE)malloc(sizeof(ASYNC_MESSAGE)); /* Nodes are freed by the consumer with free() */
+    pac->head->next = 0;
+    pac->tail = pac->head;
+    pac->count = 0;
+    pac->stopping = 0;
+    pac->producer_waiting = 0;
+    pac->event_comp_code = MQCC_OK;
+    pac->event_reason_code = MQRC_NONE;
+    pac->fds[0] = -1;
+    pac->fds[1] = -1;
+    pthread_mutex_init(&pac->mutex, 0);
+    pthread_cond_init(&pac->not_full, 0);
+    pac->MQCB = 0;
+    pac->MQCTL = 0;
+  #endif
+
+    return Data_Wrap_Struct(klass, ASYNC_CONSUMER_mark, ASYNC_CONSUMER_free, pac);
+}
+
+static VALUE AsyncConsumer_error(PASYNC_CONSUMER pac, const char* method)
+{
+    if (pac->exception_on_error)
+    {
+        rb_raise(wmq_exception,
+                 "WMQ::AsyncConsumer#%s(). Error, reason:%s",
+                 method,
+                 wmq_reason(pac->reason_code));
+    }
+    return Qfalse;
+}
+
+/*
+ * call-seq:
+ *   new(...)
+ *
+ * Receive messages from many queues on a single connection, without
+ * dedicating a thread to each queue.
+ *
+ * MQ delivers messages to a callback (MQCB) on its own thread, where they are
+ * copied into an internal queue. Ruby threads or fibers then remove the messages
+ * with #pop, or wait for them with IO.select on #to_io.
+ *
+ * Parameters:
+ * * Since the number of parameters can vary dramatically, all parameters are passed by name in a hash
+ * * Summary of parameters:
+ *  consumer = AsyncConsumer.new(
+ *    queue_manager: queue_manager,     # Instance of QueueManager
+ *    capacity:      1000               # Maximum number of messages waiting for #pop
+ *  )
+ *
+ * Mandatory Parameters
+ * * :queue_manager
+ *   * An instance of the WMQ::QueueManager class, connected.
+ *   * Once started, MQ does not allow any other calls on the connection until
+ *     the consumer is stopped. Use a separate QueueManager for putting messages.
+ *
+ * Optional Parameters
+ * * :capacity => Integer
+ *   * Once this many messages are waiting, MQ waits for #pop to remove messages
+ *     before delivering any more
+ *      Default: 1000
+ *
+ * Example:
+ *   WMQ::QueueManager.connect(q_mgr_name: 'REID') do |qmgr|
+ *     consumer = WMQ::AsyncConsumer.new(queue_manager: qmgr)
+ *     queues = ['TEST.QUEUE1', 'TEST.QUEUE2'].collect do |name|
+ *       qmgr.open_queue(q_name: name, mode: :input).tap { |queue| consumer.register(queue) }
+ *     end
+ *     consumer.start
+ *     consumer.each { |message, queue| p message.data }
+ *   end
+ *
+ * Requires WebSphere MQ V7 or later
+ */
+VALUE AsyncConsumer_initialize(VALUE self, VALUE hash)
+{
+    VALUE           val;
+    PQUEUE_MANAGER  pqm;
+    PASYNC_CONSUMER pac;
+
+    Check_Type(hash, T_HASH);
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+
+    val = rb_hash_aref(hash, ID2SYM(ID_queue_manager));    /* :queue_manager */
+    if (NIL_P(val))
+    {
+        rb_raise(rb_eArgError, "Mandatory parameter :queue_manager missing from WMQ::AsyncConsumer::new");
+    }
+    Data_Get_Struct(val, QUEUE_MANAGER, pqm);
+    pac->queue_manager      = val;
+    pac->exception_on_error = pqm->exception_on_error;  /* Copy exception_on_error from Queue Manager setting */
+    pac->trace_level        = pqm->trace_level;         /* Copy trace_level from Queue Manager setting */
+
+    val = rb_hash_aref(hash, ID2SYM(ID_capacity));          /* :capacity */
+    if (!NIL_P(val))
+    {
+        pac->capacity = NUM2LONG(val);
+        if (pac->capacity < 1)
+        {
+            rb_raise(rb_eArgError, ":capacity must be at least 1");
+        }
+    }
+
+    pac->queues = rb_hash_new();
+
+  #ifdef WMQ_ASYNC_CONSUMER
+    if (pipe(pac->fds) != 0)
+    {
+        rb_sys_fail("WMQ::AsyncConsumer pipe");
+    }
+    fcntl(pac->fds[0], F_SETFL, fcntl(pac->fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(pac->fds[1], F_SETFL, fcntl(pac->fds[1], F_GETFL) | O_NONBLOCK);
+    fcntl(pac->fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pac->fds[1], F_SETFD, FD_CLOEXEC);
+    pac->io = rb_io_fdopen(pac->fds[0], O_RDONLY, 0);
+
+    pac->MQCB  = pqm->MQCB;
+    pac->MQCTL = pqm->MQCTL;
+  #else
+    rb_raise(rb_eNotImpError, "WMQ::AsyncConsumer requires WebSphere MQ V7 or later on a POSIX platform");
+  #endif
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   register(queue, options = {})
+ *
+ * Register a queue, opened for input on the same queue manager connection,
+ * so that its messages are returned by #pop
+ *
+ * Parameters:
+ * * :sync => true or false
+ *   * Retrieve messages under syncpoint. Call QueueManager#commit on the same
+ *     connection, once the consumer is stopped.
+ *      Default: false
+ * * :convert => true or false
+ *   * Have MQ convert the message data. See WMQ::Queue#get
+ *      Default: false
+ * * :fail_if_quiescing => true or false
+ *      Default: true
+ * * :options => Integer, MQGMO_* options to add
+ *
+ * Returns true on success, false when MQ failed and exception_on_error is false
+ */
+VALUE AsyncConsumer_register(int argc, VALUE *argv, VALUE self)
+{
+    VALUE           queue;
+    VALUE           hash;
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+
+    rb_scan_args(argc, argv, "11", &queue, &hash);
+    if (NIL_P(hash))
+    {
+        hash = rb_hash_new();
+    }
+    Check_Type(hash, T_HASH);
+
+  #ifdef WMQ_ASYNC_CONSUMER
+    {
+        VALUE          val;
+        MQLONG         flag;
+        MQHOBJ         hobj;
+        PQUEUE_MANAGER pqm;
+        MQCBD          cbd = {MQCBD_DEFAULT};
+        MQMD           md  = {MQMD_DEFAULT};
+        MQGMO          gmo = {MQGMO_DEFAULT};
+
+        if (!rb_obj_is_kind_of(queue, wmq_queue))
+        {
+            rb_raise(rb_eTypeError, "WMQ::AsyncConsumer#register expects a WMQ::Queue");
+        }
+        Data_Get_Struct(pac->queue_manager, QUEUE_MANAGER, pqm);
+        pac->hcon = pqm->hcon;
+        hobj = Queue_hobj(queue, pac->hcon);
+        if (!hobj)
+        {
+            rb_raise(rb_eArgError, "WMQ::AsyncConsumer#register Queue must be open on the consumer's queue manager");
+        }
+
+        gmo.Options = 0;
+        WMQ_HASH2MQLONG(hash,options, gmo.Options)          /* :options */
+        IF_TRUE(sync, 0)
+        gmo.Options |= flag ? MQGMO_SYNCPOINT : MQGMO_NO_SYNCPOINT;
+        IF_TRUE(convert, 0)
+        if (flag) gmo.Options |= MQGMO_CONVERT;
+        IF_TRUE(fail_if_quiescing, 1)
+        if (flag) gmo.Options |= MQGMO_FAIL_IF_QUIESCING;
+
+        cbd.CallbackType     = MQCBT_MESSAGE_CONSUMER;
+        cbd.CallbackFunction = (MQPTR)AsyncConsumer_callback;
+        cbd.CallbackArea     = (MQPTR)pac;
+        cbd.MaxMsgLength     = MQCBD_FULL_MSG_LENGTH;
+
+        pac->MQCB(pac->hcon, MQOP_REGISTER, &cbd, hobj, &md, &gmo, &pac->comp_code, &pac->reason_code);
+
+        if(pac->trace_level) printf("WMQ::AsyncConsumer#register() MQCB ended with reason:%s\n", wmq_reason(pac->reason_code));
+
+        if (pac->comp_code == MQCC_FAILED)
+        {
+            return AsyncConsumer_error(pac, "register");
+        }
+        rb_hash_aset(pac->queues, LONG2NUM((long)hobj), queue);
+    }
+  #endif
+    return Qtrue;
+}
+
+/*
+ * Start delivering messages from the registered queues (MQCTL MQOP_START)
+ *
+ * Returns true on success, false when MQ failed and exception_on_error is false
+ */
+VALUE AsyncConsumer_start(VALUE self)
+{
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+
+  #ifdef WMQ_ASYNC_CONSUMER
+    {
+        MQCTLO ctlo = {MQCTLO_DEFAULT};
+
+        if (pac->started)
+        {
+            return Qtrue;
+        }
+        __atomic_store_n(&pac->stopping, 0, __ATOMIC_SEQ_CST);
+        pac->event_comp_code   = MQCC_OK;
+        pac->event_reason_code = MQRC_NONE;
+        ctlo.Options = MQCTLO_FAIL_IF_QUIESCING;
+
+        pac->MQCTL(pac->hcon, MQOP_START, &ctlo, &pac->comp_code, &pac->reason_code);
+
+        if(pac->trace_level) printf("WMQ::AsyncConsumer#start() MQCTL ended with reason:%s\n", wmq_reason(pac->reason_code));
+
+        if (pac->comp_code == MQCC_FAILED)
+        {
+            return AsyncConsumer_error(pac, "start");
+        }
+        pac->started = 1;
+        pac->pid = getpid();
+    }
+  #endif
+    return Qtrue;
+}
+
+/*
+ * Stop delivering messages (MQCTL MQOP_STOP)
+ *
+ * Messages already received remain available to #pop
+ * Any thread waiting in #pop returns nil once no messages remain
+ */
+VALUE AsyncConsumer_stop(VALUE self)
+{
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+
+  #ifdef WMQ_ASYNC_CONSUMER
+    {
+        MQCTLO ctlo = {MQCTLO_DEFAULT};
+
+        if (!pac->started)
+        {
+            return Qtrue;
+        }
+        AsyncConsumer_release(pac);
+        pac->MQCTL(pac->hcon, MQOP_STOP, &ctlo, &pac->comp_code, &pac->reason_code);
+
+        if(pac->trace_level) printf("WMQ::AsyncConsumer#stop() MQCTL ended with reason:%s\n", wmq_reason(pac->reason_code));
+
+        pac->started = 0;
+        if (write(pac->fds[1], "", 1) < 0) { /* Pipe full, waiting threads are already signalled */ }
+
+        if (pac->comp_code == MQCC_FAILED)
+        {
+            return AsyncConsumer_error(pac, "stop");
+        }
+    }
+  #endif
+    return Qtrue;
+}
+
+/*
+ * Returns [message, queue] for the next message received, or nil when there are none
+ *
+ * Raises WMQ::WMQException when there are no more messages and MQ reported a
+ * failure to the consumer, such as the connection being broken.
+ * When exception_on_error is false, returns nil and sets #reason_code instead.
+ */
+VALUE AsyncConsumer_pop_nonblock(VALUE self)
+{
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+
+  #ifdef WMQ_ASYNC_CONSUMER
+    {
+        PASYNC_MESSAGE node = AsyncConsumer_shift(pac);
+        VALUE          message;
+
+        if (!node)
+        {
+            AsyncConsumer_drain(pac);
+            node = AsyncConsumer_shift(pac);           /* Arrived before the signal was drained */
+        }
+        if (!node)
+        {
+            if (__atomic_load_n(&pac->event_comp_code, __ATOMIC_ACQUIRE) == MQCC_FAILED)
+            {
+                pac->comp_code   = MQCC_FAILED;
+                pac->reason_code = __atomic_load_n(&pac->event_reason_code, __ATOMIC_RELAXED);
+                AsyncConsumer_error(pac, "pop");
+            }
+            return Qnil;
+        }
+
+        if(pac->trace_level>1) printf("WMQ::AsyncConsumer#pop() Message length:%ld\n", (long)node->length);
+
+        message = rb_funcall(wmq_message, ID_new, 0);
+        Message_deblock(message, &node->md, node->data, node->length, 0, pac->trace_level);
+        return rb_assoc_new(message, rb_hash_aref(pac->queues, LONG2NUM((long)node->hobj)));
+    }
+  #else
+    return Qnil;
+  #endif
+}
+
+/*
+ * Returns an IO that becomes readable when messages arrive, for use with IO.select
+ */
+VALUE AsyncConsumer_to_io(VALUE self)
+{
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+    return pac->io;
+}
+
+/*
+ * Returns the number of messages received and not yet popped
+ */
+VALUE AsyncConsumer_size(VALUE self)
+{
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+  #ifdef WMQ_ASYNC_CONSUMER
+    return LONG2NUM(__atomic_load_n(&pac->count, __ATOMIC_RELAXED));
+  #else
+    return INT2FIX(0);
+  #endif
+}
+
+/*
+ * Returns whether messages are being delivered, between #start and #stop
+ */
+VALUE AsyncConsumer_started_q(VALUE self)
+{
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+    return pac->started ? Qtrue : Qfalse;
+}
+
+/*
+ * Return the completion code for the last MQ operation on this consumer
+ */
+VALUE AsyncConsumer_comp_code(VALUE self)
+{
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+    return LONG2NUM(pac->comp_code);
+}
+
+/*
+ * Return the reason code for the last MQ operation on this consumer
+ */
+VALUE AsyncConsumer_reason_code(VALUE self)
+{
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+    return LONG2NUM(pac->reason_code);
+}
+
+/*
+ * Returns a textual representation of the reason_code for the last MQ operation on this consumer
+ */
+VALUE AsyncConsumer_reason(VALUE self)
+{
+    PASYNC_CONSUMER pac;
+    Data_Get_Struct(self, ASYNC_CONSUMER, pac);
+    return rb_str_new2(wmq_reason(pac->reason_code));
+}
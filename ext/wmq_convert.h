@@ -0,0 +1,35 @@
+#if !defined(WMQ_CONVERT_INCLUDED)
+#define WMQ_CONVERT_INCLUDED
+
+#include <stdlib.h> /* For size_t */
+
+/*
+ * Client side character conversion between the most common CCSIDs:
+ *    37, 500, 1047: EBCDIC
+ *    819:           ISO-8859-1
+ *    1208:          UTF-8
+ */
+
+/* Returns non-zero if conversion to and from the CCSID is supported */
+int wmq_convert_supported(long ccsid);
+
+/* Returns the largest number of bytes that converting len bytes can produce */
+size_t wmq_convert_max_length(long from_ccsid, long to_ccsid, size_t len);
+
+/* Converts len bytes from in into out, which must hold at least
+ * wmq_convert_max_length bytes. Characters that cannot be represented in the
+ * target CCSID, and invalid UTF-8 sequences, are replaced with the
+ * substitution character (SUB) of the target CCSID.
+ * Returns the number of bytes written, or -1 if the conversion is not supported */
+long wmq_convert(long from_ccsid, long to_ccsid,
+                 const unsigned char *in, size_t len,
+                 unsigned char *out);
+
+/* Converts fixed length character fields, such as the MQCHAR fields in MQ
+ * headers, in place. Since these fields only contain single byte characters,
+ * 1208 is treated the same as 819.
+ * Returns 0 if the conversion is not supported */
+int wmq_convert_in_place(long from_ccsid, long to_ccsid,
+                         unsigned char *buffer, size_t len);
+
+#endif
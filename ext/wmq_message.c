@@ -1,5 +1,8 @@
 #include "wmq.h"
+#include <math.h>
 #include "decode_rfh.h"
+#include "decode_rfh2.h"
+#include "wmq_convert.h"
 
 /* --------------------------------------------------
  * Initialize Ruby ID's for Message Class
@@ -12,11 +15,13 @@ static ID ID_data;
 static ID ID_message;
 static ID ID_descriptor;
 static ID ID_headers;
+static ID ID_properties;
 static ID ID_data_set;
 static ID ID_size;
 static ID ID_name_value;
 static ID ID_xml;
-static ID ID_gsub;
+static ID ID_folders;
+static ID ID_rfh2_cache;
 static ID ID_header_type;
 
 void Message_id_init()
@@ -26,15 +31,26 @@ void Message_id_init()
     ID_data_set        = rb_intern("data=");
     ID_descriptor      = rb_intern("descriptor");
     ID_headers         = rb_intern("headers");
+    ID_properties      = rb_intern("properties");
     ID_message         = rb_intern("message");
     ID_name_value      = rb_intern("name_value");
     ID_xml             = rb_intern("xml");
-    ID_gsub            = rb_intern("gsub");
+    ID_folders         = rb_intern("folders");
+    ID_rfh2_cache      = rb_intern("wmq_rfh2_cache"); /* No @, hidden from Ruby */
     ID_header_type     = rb_intern("header_type");
 }
 
+/*
+ * Build the message to be put from the :data and/or :message parameters
+ *
+ * When headers are present, the exact size of the headers and data is first
+ * calculated so that the buffer only needs to be grown once, before anything
+ * is written into it. The headers are then written directly into the buffer,
+ * followed by the data.
+ */
 void Message_build(PMQBYTE* pq_pp_buffer, PMQLONG pq_p_buffer_size, MQLONG trace_level,
-                   VALUE parms, PPMQVOID pp_buffer, PMQLONG p_total_length, PMQMD pmqmd)
+                   VALUE parms, PPMQVOID pp_buffer, PMQLONG p_total_length, PMQMD pmqmd,
+                   struct Message_build_stats* p_stats)
 {
     VALUE    data;
     VALUE    descriptor;
@@ -73,6 +89,7 @@ void Message_build(PMQBYTE* pq_pp_buffer, PMQLONG pq_p_buffer_size, MQLONG trace
              (NUM2LONG(rb_funcall(headers, ID_size, 0))>0) )
         {
             MQLONG  data_offset = 0;
+            MQLONG  total_size  = RSTRING_LEN(data);
             struct  Message_build_header_arg arg;
             VALUE   next_header;
             VALUE   first_header;
@@ -83,17 +100,24 @@ void Message_build(PMQBYTE* pq_pp_buffer, PMQLONG pq_p_buffer_size, MQLONG trace
             if(trace_level>2)
                 printf ("WMQ::Queue#put %ld Header(s) supplied\n", NUM2LONG(rb_funcall(headers, ID_size, 0)));
 
-            /* First sanity check: Do we even have enough space for the data being written and a small header */
-            if(RSTRING_LEN(data) + 128 >= *pq_p_buffer_size)
+            /* Sizing pass: Exact size of all headers and the data */
+            for(index = 0; index < RARRAY_LEN(headers); index++)
+            {
+                total_size += Message_size_header(RARRAY_AREF(headers, index));
+            }
+
+            if(total_size > *pq_p_buffer_size)
             {
-                MQLONG new_size = RSTRING_LEN(data) + 512; /* Add space for data and a header */
                 if(trace_level>2)
-                    printf ("WMQ::Queue#reallocate Resizing buffer from %ld to %ld bytes\n", *pq_p_buffer_size, (long)new_size);
+                    printf ("WMQ::Queue#reallocate Resizing buffer from %ld to %ld bytes\n", *pq_p_buffer_size, (long)total_size);
 
-                *pq_p_buffer_size = new_size;
+                /* Nothing written yet, so no need to copy the old buffer */
                 free(*pq_pp_buffer);
-                *pq_pp_buffer = ALLOC_N(unsigned char, new_size);
+                *pq_p_buffer_size = total_size;
+                *pq_pp_buffer = ALLOC_N(unsigned char, total_size);
+                if(p_stats) p_stats->buffer_resizes++;
             }
+            if(p_stats) p_stats->builds++;
 
             arg.pp_buffer      = pq_pp_buffer;
             arg.p_buffer_size  = pq_p_buffer_size;
@@ -102,6 +126,7 @@ void Message_build(PMQBYTE* pq_pp_buffer, PMQLONG pq_p_buffer_size, MQLONG trace
             arg.trace_level    = trace_level;
             arg.next_header_id = 0;
             arg.data_format    = pmqmd->Format;
+            arg.p_stats        = p_stats;
 
             if(trace_level>2)
                 printf ("WMQ::Queue#put Building %ld headers.\n", RARRAY_LEN(headers));
@@ -201,6 +226,7 @@ VALUE Message_initialize(int argc, VALUE *argv, VALUE self)
         rb_iv_set(self, "@data", Qnil);
         rb_iv_set(self, "@headers", rb_ary_new());
         rb_iv_set(self, "@descriptor", rb_hash_new());
+        rb_iv_set(self, "@properties", Qnil);
     }
     else
     {
@@ -228,13 +254,15 @@ VALUE Message_initialize(int argc, VALUE *argv, VALUE self)
         {
             rb_iv_set(self, "@descriptor", val);
         }
+
+        rb_iv_set(self, "@properties", rb_hash_aref(parms, ID2SYM(ID_properties)));
     }
 
     return Qnil;
 }
 
 /*
- * Clear out the message data and headers
+ * Clear out the message data, headers and properties
  *
  * Note:
  * * The descriptor is not affected in any way
@@ -243,6 +271,7 @@ VALUE Message_clear(VALUE self)
 {
     rb_iv_set(self, "@data", Qnil);
     rb_iv_set(self, "@headers", rb_ary_new());
+    rb_iv_set(self, "@properties", Qnil);
 
     return self;
 }
@@ -259,12 +288,15 @@ VALUE Message_clear(VALUE self)
 PMQBYTE Message_autogrow_data_buffer(struct Message_build_header_arg* parg, MQLONG additional_size)
 {
     MQLONG size = *(parg->p_data_offset) + parg->data_length + additional_size;
-    /* Is buffer large enough for headers */
-    if(size >= *(parg->p_buffer_size))
+    /*
+     * Is buffer large enough for headers
+     * Message_build already sized the buffer, so this should never happen
+     */
+    if(size > *(parg->p_buffer_size))
     {
         PMQBYTE old_buffer = *(parg->pp_buffer);
-        size += 512;                   /* Additional space for subsequent headers */
 
+        if(parg->p_stats) parg->p_stats->build_reallocations++;
         if(parg->trace_level>2)
             printf ("WMQ::Message Reallocating buffer from %ld to %ld\n", *(parg->p_buffer_size), (long)size);
 
@@ -277,120 +309,186 @@ PMQBYTE Message_autogrow_data_buffer(struct Message_build_header_arg* parg, MQLO
 }
 
 /*
- * Concatenate the passed name or value element to the existing string
+ * Encoding of a name or value element in an RFH NameValueString
+ *
+ * Elements containing spaces or double quotes, or empty elements, are enclosed
+ * in double quotes, with any embedded double quotes doubled up.
+ *
+ * Encoding is performed in 2 passes over the name_value hash: The first pass
+ * (Message_size_rf_header) measures the total length so that Message_build can
+ * size the message buffer exactly, the second writes the encoded elements
+ * directly into the message buffer
  */
-static void Message_name_value_concat(VALUE string, VALUE element)
+static MQLONG Message_name_value_measure(VALUE str)
 {
-    VALUE str = StringValue(element);
-    if (RSTRING_LEN(str) == 0)                       /* Empty String: "" */
+    long    len = RSTRING_LEN(str);
+    char*   p_str = RSTRING_PTR(str);
+    char*   p_end = p_str + len;
+    char*   p_quote;
+    MQLONG  quotes = 0;
+
+    if (len == 0)                                     /* Empty String: "" */
     {
-        rb_str_concat(string, rb_str_new2("\"\""));
+        return 2;
     }
-    else
+
+    p_quote = memchr(p_str, '"', len);
+    if (p_quote == NULL)
     {
-        void*  contains_spaces = memchr(RSTRING_PTR(str),' ',RSTRING_LEN(str));
-        void*  contains_dbl_quotes = memchr(RSTRING_PTR(str),'"',RSTRING_LEN(str));
+        return memchr(p_str, ' ', len) ? len + 2 : len;
+    }
 
-        if(contains_spaces == NULL && contains_dbl_quotes == NULL)
-        {
-            rb_str_concat(string, str);
-        }
-        else
-        {
-            VALUE quote = rb_str_new2("\"");
-            rb_str_concat(string, quote);
-            if(contains_dbl_quotes)
-            {
-                rb_str_concat(string, rb_funcall(str, ID_gsub, 2, quote, rb_str_new2("\"\"")));
-            }
-            else
-            {
-                rb_str_concat(string, str);
-            }
-            rb_str_concat(string, quote);
-        }
+    while (p_quote)                                   /* Count quotes to be doubled up */
+    {
+        quotes++;
+        p_quote++;
+        p_quote = memchr(p_quote, '"', p_end - p_quote);
     }
+    return len + quotes + 2;
 }
 
-struct Message_build_rf_header_each_value_arg {
-    VALUE    string;
-    VALUE    key;
-    VALUE    space;
+static MQLONG Message_name_value_write(PMQBYTE p_out, VALUE str)
+{
+    long    len = RSTRING_LEN(str);
+    char*   p_str = RSTRING_PTR(str);
+    char*   p_end = p_str + len;
+    char*   p_quote;
+    PMQBYTE p_start = p_out;
+
+    if (len == 0)                                     /* Empty String: "" */
+    {
+        p_out[0] = '"';
+        p_out[1] = '"';
+        return 2;
+    }
+
+    p_quote = memchr(p_str, '"', len);
+    if (p_quote == NULL && memchr(p_str, ' ', len) == NULL)
+    {
+        memcpy(p_out, p_str, len);
+        return len;
+    }
+
+    *p_out++ = '"';
+    while (p_quote)                                   /* Copy up to and including each quote, then double it */
+    {
+        p_quote++;
+        memcpy(p_out, p_str, p_quote - p_str);
+        p_out += p_quote - p_str;
+        *p_out++ = '"';
+        p_str = p_quote;
+        p_quote = memchr(p_str, '"', p_end - p_str);
+    }
+    memcpy(p_out, p_str, p_end - p_str);
+    p_out += p_end - p_str;
+    *p_out++ = '"';
+    return p_out - p_start;
+}
+
+struct Message_build_rf_header_each_arg {
+    PMQBYTE  p_out;                                   /* Write pass: Next byte to write, Measure pass: 0 */
+    MQLONG   length;                                  /* Total length measured or written so far */
+    MQLONG   limit;                                   /* Write pass: Space available in the message buffer */
 };
 
-static VALUE Message_build_rf_header_each_value(VALUE value, struct Message_build_rf_header_each_value_arg* parg)
+static void Message_build_rf_header_pair(VALUE key, VALUE value, struct Message_build_rf_header_each_arg* parg)
 {
-    Message_name_value_concat(parg->string, parg->key);
-    rb_str_concat(parg->string, parg->space);
-    Message_name_value_concat(parg->string, value);
-    rb_str_concat(parg->string, parg->space);
-
-    return Qnil;
+    StringValue(key);
+    StringValue(value);
+    if (parg->p_out)
+    {
+        MQLONG size = Message_name_value_measure(key) + Message_name_value_measure(value) + 2;
+        if (parg->length + size > parg->limit)
+        {
+            rb_raise(rb_eArgError, ":name_value supplied in rf_header to WMQ::Message#headers was modified while building the header");
+        }
+        parg->p_out += Message_name_value_write(parg->p_out, key);
+        *(parg->p_out)++ = ' ';
+        parg->p_out += Message_name_value_write(parg->p_out, value);
+        *(parg->p_out)++ = ' ';
+        parg->length += size;
+    }
+    else
+    {
+        parg->length += Message_name_value_measure(key) + Message_name_value_measure(value) + 2;
+    }
 }
 
-static int Message_build_rf_header_each (VALUE key, VALUE value, VALUE string)
+static int Message_build_rf_header_each (VALUE key, VALUE value, VALUE arg)
 {
-    VALUE space = rb_str_new2(" ");
+    struct Message_build_rf_header_each_arg* parg = (struct Message_build_rf_header_each_arg*)arg;
+
     /* If Value is an Array, need to repeat name for each value */
     if (TYPE(value) == T_ARRAY)
     {
-        struct Message_build_rf_header_each_value_arg arg;
-        arg.key    = key;
-        arg.string = string;
-        arg.space  = space;
-        rb_iterate (rb_each, value, Message_build_rf_header_each_value, (VALUE)&arg);
+        long i;
+        for (i = 0; i < RARRAY_LEN(value); i++)
+        {
+            Message_build_rf_header_pair(key, RARRAY_AREF(value, i), parg);
+        }
     }
     else
     {
-        Message_name_value_concat(string, key);
-        rb_str_concat(string, space);
-        Message_name_value_concat(string, value);
-        rb_str_concat(string, space);
+        Message_build_rf_header_pair(key, value, parg);
     }
-    return 0;
+    return ST_CONTINUE;
 }
 
-void Message_build_rf_header (VALUE hash, struct Message_build_header_arg* parg)
+/*
+ * Returns the size of the RF Header, including the padded NameValueString
+ */
+MQLONG Message_size_rf_header (VALUE hash)
 {
-    PMQBYTE p_data = *(parg->pp_buffer) + *(parg->p_data_offset);
-
-    static  MQRFH MQRFH_DEF = {MQRFH_DEFAULT};
     MQLONG  name_value_len = 0;
-    PMQCHAR p_name_value = 0;
     VALUE   name_value = rb_hash_aref(hash, ID2SYM(ID_name_value));
 
-    MQRFH_DEF.CodedCharSetId = MQCCSI_INHERIT;
-
-    if(parg->trace_level>2)
-        printf ("WMQ::Message#build_rf_header Found rf_header\n");
-
     if (!NIL_P(name_value))
     {
         if (TYPE(name_value) == T_HASH)
         {
-            VALUE name_value_str = rb_str_buf_new(512);         /* Allocate 512 char buffer, will grow as needed */
-            rb_hash_foreach(name_value, Message_build_rf_header_each, name_value_str);
-            name_value = name_value_str;
+            struct Message_build_rf_header_each_arg each_arg = {0, 0, 0};
+            rb_hash_foreach(name_value, Message_build_rf_header_each, (VALUE)&each_arg);
+            name_value_len = each_arg.length;
         }
-        else if(TYPE(name_value) != T_STRING)
+        else if(TYPE(name_value) == T_STRING)
+        {
+            name_value_len = RSTRING_LEN(name_value);
+        }
+        else
         {
             rb_raise(rb_eArgError, ":name_value supplied in rf_header to WMQ::Message#headers must be either a String or a Hash");
         }
+    }
+    return sizeof(MQRFH) + name_value_len + ((name_value_len % 4) ? 4 - (name_value_len % 4) : 0);
+}
 
+void Message_build_rf_header (VALUE hash, struct Message_build_header_arg* parg)
+{
+    PMQBYTE p_data;
+
+    static const MQRFH MQRFH_DEF = {MQRFH_DEFAULT};
+    MQLONG  name_value_len = 0;
+    MQLONG  name_value_pad = 0;
+    VALUE   name_value = rb_hash_aref(hash, ID2SYM(ID_name_value));
+
+    if(parg->trace_level>2)
+        printf ("WMQ::Message#build_rf_header Found rf_header\n");
+
+    if (!NIL_P(name_value) && TYPE(name_value) == T_STRING)
+    {
         name_value_len = RSTRING_LEN(name_value);
-        if (name_value_len % 4)                           /* Not on 4 byte boundary ? */
-        {
-            rb_str_concat(name_value, rb_str_new("    ", 4 - (name_value_len % 4)));
-            name_value_len = RSTRING_LEN(name_value);
-        }
-        p_name_value   = RSTRING_PTR(name_value);
+        name_value_pad = (name_value_len % 4) ? 4 - (name_value_len % 4) : 0;
+    }
+    else if (!NIL_P(name_value) && TYPE(name_value) != T_HASH)
+    {
+        rb_raise(rb_eArgError, ":name_value supplied in rf_header to WMQ::Message#headers must be either a String or a Hash");
     }
 
-    p_data = Message_autogrow_data_buffer(parg, sizeof(MQRFH)+name_value_len);
+    p_data = Message_autogrow_data_buffer(parg, sizeof(MQRFH)+name_value_len+name_value_pad);
 
     memcpy(p_data, &MQRFH_DEF, sizeof(MQRFH));
+    ((PMQRFH)p_data)->CodedCharSetId = MQCCSI_INHERIT;
     Message_to_mqrfh(hash, (PMQRFH)p_data);
-    ((PMQRFH)p_data)->StrucLength = sizeof(MQRFH) + name_value_len;
     if(parg->next_header_id)
     {
         Message_build_set_format(parg->next_header_id, ((PMQRFH)p_data)->Format);
@@ -399,15 +497,33 @@ void Message_build_rf_header (VALUE hash, struct Message_build_header_arg* parg)
     {
         strncpy(((PMQRFH)p_data)->Format, parg->data_format, MQ_FORMAT_LENGTH);
     }
-
-    *(parg->p_data_offset) += sizeof(MQRFH);
     p_data += sizeof(MQRFH);
 
-    if(name_value_len)
+    if (!NIL_P(name_value) && TYPE(name_value) == T_HASH)
     {
-        memcpy(p_data, p_name_value, name_value_len);
-        *(parg->p_data_offset) += name_value_len;
+        /* Buffer was sized by Message_size_rf_header, so write directly into the remaining space */
+        struct Message_build_rf_header_each_arg each_arg;
+        each_arg.p_out  = p_data;
+        each_arg.limit  = *(parg->p_buffer_size) - *(parg->p_data_offset) - sizeof(MQRFH) - parg->data_length;
+        each_arg.length = 0;
+        rb_hash_foreach(name_value, Message_build_rf_header_each, (VALUE)&each_arg);
+
+        name_value_len = each_arg.length;
+        name_value_pad = (name_value_len % 4) ? 4 - (name_value_len % 4) : 0;
+        if (name_value_len + name_value_pad > each_arg.limit)
+        {
+            rb_raise(rb_eArgError, ":name_value supplied in rf_header to WMQ::Message#headers was modified while building the header");
+        }
     }
+    else if (name_value_len)
+    {
+        memcpy(p_data, RSTRING_PTR(name_value), name_value_len);
+    }
+    memset(p_data + name_value_len, ' ', name_value_pad);
+    name_value_len += name_value_pad;
+
+    ((PMQRFH)(p_data - sizeof(MQRFH)))->StrucLength = sizeof(MQRFH) + name_value_len;
+    *(parg->p_data_offset) += sizeof(MQRFH) + name_value_len;
 
     if(parg->trace_level>3)
         printf ("WMQ::Message#build_rf_header Sizeof namevalue string:%ld\n", (long)name_value_len);
@@ -416,12 +532,8 @@ void Message_build_rf_header (VALUE hash, struct Message_build_header_arg* parg)
         printf ("WMQ::Message#build_rf_header data offset:%ld\n", *(parg->p_data_offset));
 }
 
-static void Message_deblock_rf_header_each_pair(const char *p_name, const char *p_value, void* p_name_value_hash)
+static void Message_deblock_rf_header_add_pair(VALUE name_value_hash, VALUE key, VALUE value)
 {
-    VALUE name_value_hash = (VALUE)p_name_value_hash;
-    VALUE key             = rb_str_new2(p_name);
-    VALUE value           = rb_str_new2(p_value);
-
     /*
      * If multiple values arrive for the same name (key) need to put values in an array
      */
@@ -446,6 +558,20 @@ static void Message_deblock_rf_header_each_pair(const char *p_name, const char *
     }
 }
 
+static void Message_deblock_rf_header_each_pair(const char *p_name, const char *p_value, void* p_name_value_hash)
+{
+    Message_deblock_rf_header_add_pair((VALUE)p_name_value_hash, rb_str_new2(p_name), rb_str_new2(p_value));
+}
+
+static void Message_deblock_rf_header_each_slice(const char *p_name, size_t name_len,
+                                                 const char *p_value, size_t value_len,
+                                                 void* p_name_value_hash)
+{
+    Message_deblock_rf_header_add_pair((VALUE)p_name_value_hash,
+                                       rb_str_new(p_name, name_len),
+                                       rb_str_new(p_value, value_len));
+}
+
 /*
  * Deblock Any custom data following RF Header
  *   The RF Header has already been deblocked into hash
@@ -469,10 +595,10 @@ MQLONG Message_deblock_rf_header (VALUE hash, PMQBYTE p_data, MQLONG data_len)
         return 0;
     }
 
-    toktype = rfh_decode_name_val_str(p_data + sizeof(MQRFH),
-                                      size - sizeof(MQRFH),
-                                      Message_deblock_rf_header_each_pair,
-                                      (void*)name_value_hash);
+    toktype = rfh_decode_name_val_slices(p_data + sizeof(MQRFH),
+                                         size - sizeof(MQRFH),
+                                         Message_deblock_rf_header_each_slice,
+                                         (void*)name_value_hash);
 
     if (toktype != TT_END)
     {
@@ -484,6 +610,121 @@ MQLONG Message_deblock_rf_header (VALUE hash, PMQBYTE p_data, MQLONG data_len)
     return size;
 }
 
+/*
+ * Convert the NameValueString following an MQRFH from ccsid to the local code page
+ */
+void Message_convert_rf_header (PMQBYTE p_data, MQLONG data_len, MQLONG ccsid)
+{
+    MQLONG size = ((PMQRFH)p_data)->StrucLength;
+
+    if(size >= (MQLONG)sizeof(MQRFH) && size <= data_len)
+    {
+        wmq_convert_in_place(ccsid, 819, p_data + sizeof(MQRFH), size - sizeof(MQRFH));
+    }
+}
+
+/*
+ * call-seq:
+ *   decode_name_value(name_value_string, legacy=false)
+ *
+ * Decode an RFH NameValueString into a Hash, in the same way as the :name_value
+ * of an :rf_header is returned by WMQ::Queue#get
+ *
+ * Parameters:
+ * * name_value_string: String
+ *   * E.g. 'name1 value1 name2 "value 2"'
+ * * legacy: true or false
+ *   * Use the original character at a time decoder, instead of the block scanning one.
+ *     Only intended for verifying and benchmarking the decoders against each other
+ *      Default: false
+ *
+ * Raises ArgumentError if the NameValueString is not valid
+ *
+ * Example:
+ *   WMQ::Message.decode_name_value('name1 value1 name1 "value 2"')
+ *   # => {"name1"=>["value1", "value 2"]}
+ */
+VALUE Message_singleton_decode_name_value(int argc, VALUE *argv, VALUE self)
+{
+    VALUE name_value, legacy, str;
+    VALUE name_value_hash = rb_hash_new();
+    rfh_toktype_t toktype;
+
+    rb_scan_args(argc, argv, "11", &name_value, &legacy);
+
+    str = StringValue(name_value);
+    if (RTEST(legacy))
+    {
+        toktype = rfh_decode_name_val_str(RSTRING_PTR(str),
+                                          RSTRING_LEN(str),
+                                          Message_deblock_rf_header_each_pair,
+                                          (void*)name_value_hash);
+    }
+    else
+    {
+        toktype = rfh_decode_name_val_slices(RSTRING_PTR(str),
+                                             RSTRING_LEN(str),
+                                             Message_deblock_rf_header_each_slice,
+                                             (void*)name_value_hash);
+    }
+
+    if (toktype != TT_END)
+    {
+        rb_raise(rb_eArgError, "Could not parse rfh name value string, reason %s", rfh_toktype_to_s(toktype));
+    }
+
+    return name_value_hash;
+}
+
+/*
+ * Returns a new String with data converted between the supplied CCSIDs,
+ * or nil if either CCSID is not supported
+ */
+VALUE Message_convert_string(PMQBYTE p_data, MQLONG data_len, MQLONG from_ccsid, MQLONG to_ccsid)
+{
+    VALUE str;
+    long  length;
+
+    if (!wmq_convert_supported(from_ccsid) || !wmq_convert_supported(to_ccsid))
+    {
+        return Qnil;
+    }
+
+    str = rb_str_new(0, wmq_convert_max_length(from_ccsid, to_ccsid, data_len));
+    length = wmq_convert(from_ccsid, to_ccsid, p_data, data_len, (unsigned char*)RSTRING_PTR(str));
+    rb_str_resize(str, length);
+    return str;
+}
+
+/*
+ * call-seq:
+ *   convert(data, from_ccsid, to_ccsid)
+ *
+ * Convert a String between two of the Coded Character Set Ids supported by
+ * WMQ::Queue#get(convert: ccsid):
+ *   37, 500, 1047 (EBCDIC), 819 (ISO-8859-1) and 1208 (UTF-8)
+ *
+ * Characters that cannot be represented in to_ccsid are replaced with its
+ * substitution character
+ *
+ * Raises ArgumentError if either CCSID is not supported
+ *
+ * Example:
+ *   WMQ::Message.convert("\xC8\x85\x93\x93\x96", 37, 819)
+ *   # => "Hello"
+ */
+VALUE Message_singleton_convert(VALUE self, VALUE data, VALUE from_ccsid, VALUE to_ccsid)
+{
+    VALUE str    = StringValue(data);
+    VALUE result = Message_convert_string((PMQBYTE)RSTRING_PTR(str), RSTRING_LEN(str), NUM2LONG(from_ccsid), NUM2LONG(to_ccsid));
+
+    if (NIL_P(result))
+    {
+        rb_raise(rb_eArgError, "WMQ::Message.convert Unsupported CCSID. Supported values are 37, 500, 1047, 819 and 1208");
+    }
+    return result;
+}
+
 /*
  * RFH2 Header can contain multiple XML-like strings
  *   Message consists of:
@@ -493,6 +734,9 @@ MQLONG Message_deblock_rf_header (VALUE hash, PMQBYTE p_data, MQLONG data_len)
  *       xml-string2-length  (MQLONG)
  *       xml-string2         (Padded with spaces to match 4 byte boundary)
  *       ....
+ *
+ * The strings are returned in :xml, and a WMQ::RFH2Folders in :folders
+ * for accessing the properties in each folder
  */
 MQLONG Message_deblock_rf_header_2 (VALUE hash, PMQBYTE p_buffer, MQLONG data_len)
 {
@@ -501,6 +745,7 @@ MQLONG Message_deblock_rf_header_2 (VALUE hash, PMQBYTE p_buffer, MQLONG data_le
     PMQBYTE p_end   = p_buffer + size;                /* Points to byte after last character */
     MQLONG  xml_len = 0;
     VALUE   xml_ary = rb_ary_new();
+    VALUE   folders;
 
     PMQBYTE pChar;
     size_t  length;
@@ -513,6 +758,9 @@ MQLONG Message_deblock_rf_header_2 (VALUE hash, PMQBYTE p_buffer, MQLONG data_le
     }
 
     rb_hash_aset(hash, ID2SYM(ID_xml), xml_ary);
+    folders = rb_obj_alloc(wmq_rfh2_folders);         /* Folders are only decoded when accessed */
+    RFH2Folders_initialize(folders, xml_ary);
+    rb_hash_aset(hash, ID2SYM(ID_folders), folders);
 
     while(p_data < p_end)
     {
@@ -548,6 +796,355 @@ MQLONG Message_deblock_rf_header_2 (VALUE hash, PMQBYTE p_buffer, MQLONG data_le
     return size;
 }
 
+/*
+ * Byte swap the NameValueLength preceding each folder in an MQRFH2, once the
+ * MQRFH2 itself has been swapped
+ */
+void Message_swap_rf_header_2 (PMQBYTE p_buffer, MQLONG data_len)
+{
+    MQLONG  size    = ((PMQRFH2)p_buffer)->StrucLength;
+    PMQBYTE p_data  = p_buffer + sizeof(MQRFH2);
+    PMQBYTE p_end   = p_buffer + size;
+    MQLONG  xml_len;
+
+    if(size < (MQLONG)sizeof(MQRFH2) || size > data_len)
+    {
+        return;                                       /* Poison Message, reported by Message_deblock_rf_header_2 */
+    }
+
+    while(p_data + sizeof(MQLONG) <= p_end)
+    {
+        xml_len = WMQ_SWAP_MQLONG(*(PMQLONG)p_data);
+        *(PMQLONG)p_data = xml_len;
+        p_data += sizeof(MQLONG);
+        if (xml_len < 0 || p_data+xml_len > p_end)
+        {
+            return;
+        }
+        p_data += xml_len;
+    }
+}
+
+/*
+ * Convert the MQCHAR fields and any single byte NameValueData in an MQRFH2 to the
+ * local code page. UTF-8 NameValueData is left as is
+ */
+void Message_convert_rf_header_2 (PMQBYTE p_buffer, MQLONG data_len, MQLONG ccsid)
+{
+    PMQRFH2 p_header = (PMQRFH2)p_buffer;
+    MQLONG  size     = p_header->StrucLength;
+    PMQBYTE p_data   = p_buffer + sizeof(MQRFH2);
+    PMQBYTE p_end    = p_buffer + size;
+    MQLONG  xml_len;
+
+    if(size < (MQLONG)sizeof(MQRFH2) || size > data_len ||
+       p_header->NameValueCCSID == 1208 || p_header->NameValueCCSID == 819 ||
+       !wmq_convert_supported(p_header->NameValueCCSID))
+    {
+        return;
+    }
+
+    while(p_data + sizeof(MQLONG) <= p_end)
+    {
+        xml_len = *(PMQLONG)p_data;
+        p_data += sizeof(MQLONG);
+        if (xml_len < 0 || p_data+xml_len > p_end)
+        {
+            return;                                   /* Poison Message, reported by Message_deblock_rf_header_2 */
+        }
+        wmq_convert_in_place(p_header->NameValueCCSID, 819, p_data, xml_len);
+        p_data += xml_len;
+    }
+    p_header->NameValueCCSID = 819;
+}
+
+/*
+ * WMQ::RFH2Folders
+ *
+ * Lazily decodes the folders in the NameValueData of an MQRFH2 header.
+ * A folder is only decoded the first time it is accessed, folders that are
+ * never accessed cost nothing beyond the raw string already in :xml
+ */
+struct RFH2Folders_decode_arg {
+    VALUE stack[RFH2_MAX_DEPTH + 2];                  /* Hash for the folder, followed by nested groups */
+    int   depth;
+};
+
+static void RFH2Folders_start_group(const char *p_name, size_t name_len, void *user_data)
+{
+    struct RFH2Folders_decode_arg* parg = (struct RFH2Folders_decode_arg*)user_data;
+    VALUE group = rb_hash_new();
+
+    Message_deblock_rf_header_add_pair(parg->stack[parg->depth], rb_str_new(p_name, name_len), group);
+    parg->stack[++parg->depth] = group;
+}
+
+static void RFH2Folders_end_group(void *user_data)
+{
+    ((struct RFH2Folders_decode_arg*)user_data)->depth--;
+}
+
+static VALUE RFH2Folders_inum(VALUE number)
+{
+    return rb_cstr_to_inum((const char*)number, 10, 1);
+}
+
+/*
+ * Convert a property value to the Ruby type indicated by its dt attribute
+ */
+static VALUE RFH2Folders_value(rfh2_dt_t dt, const char *p_value, size_t value_len)
+{
+    char  number[64];
+    char* p_end;
+    VALUE value;
+    int   state;
+
+    switch (dt)
+    {
+    case RFH2_DT_INTEGER:
+    case RFH2_DT_FLOAT:
+        if (value_len > 0 && value_len < sizeof(number))
+        {
+            memcpy(number, p_value, value_len);
+            number[value_len] = 0;
+            if (dt == RFH2_DT_INTEGER)
+            {
+                value = rb_protect(RFH2Folders_inum, (VALUE)number, &state);
+                if (!state)
+                    return value;
+                rb_set_errinfo(Qnil);                 /* Not an integer, return it as is */
+                break;
+            }
+            value = DBL2NUM(strtod(number, &p_end));  /* Also accepts NaN and Infinity */
+            if (*p_end == 0)
+                return value;
+        }
+        break;
+
+    case RFH2_DT_BOOLEAN:
+        return (value_len == 1 && *p_value == '1') ||
+               (value_len == 4 && memcmp(p_value, "true", 4) == 0) ? Qtrue : Qfalse;
+
+    case RFH2_DT_BIN_HEX:
+        if (value_len % 2 == 0)
+        {
+            VALUE  str   = rb_str_new(0, value_len / 2);
+            char*  p_out = RSTRING_PTR(str);
+            size_t i;
+
+            for (i = 0; i < value_len; i++)
+            {
+                char c = p_value[i];
+                int  nibble;
+                if (c >= '0' && c <= '9')       nibble = c - '0';
+                else if (c >= 'a' && c <= 'f')  nibble = c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F')  nibble = c - 'A' + 10;
+                else break;
+
+                if (i % 2)
+                    p_out[i / 2] |= nibble;
+                else
+                    p_out[i / 2] = nibble << 4;
+            }
+            if (i == value_len)
+                return str;
+        }
+        break;
+
+    default:
+        break;
+    }
+    return rb_str_new(p_value, value_len);            /* String, or a value that does not match its type */
+}
+
+static void RFH2Folders_property(const char *p_name, size_t name_len,
+                                 rfh2_dt_t dt, int is_nil,
+                                 const char *p_value, size_t value_len,
+                                 void *user_data)
+{
+    struct RFH2Folders_decode_arg* parg = (struct RFH2Folders_decode_arg*)user_data;
+
+    Message_deblock_rf_header_add_pair(parg->stack[parg->depth],
+                                       rb_str_new(p_name, name_len),
+                                       is_nil ? Qnil : RFH2Folders_value(dt, p_value, value_len));
+}
+
+static const RFH2_CALLBACKS RFH2Folders_callbacks = {
+    RFH2Folders_start_group,
+    RFH2Folders_end_group,
+    RFH2Folders_property
+};
+
+/*
+ * Returns the folder name as a Symbol, or nil if the string is not a folder
+ */
+static VALUE RFH2Folders_folder_name(VALUE folder)
+{
+    const char *p_name;
+    size_t      name_len;
+
+    if (TYPE(folder) != T_STRING ||
+        rfh2_folder_name(RSTRING_PTR(folder), RSTRING_LEN(folder), &p_name, &name_len) != RFH2_OK)
+    {
+        return Qnil;
+    }
+    return ID2SYM(rb_intern2(p_name, name_len));
+}
+
+/*
+ * call-seq:
+ *   new(xml)
+ *
+ * Parameters:
+ * * xml: Array of Strings, one per folder
+ *   * Usually the :xml of an :rf_header_2 returned by WMQ::Queue#get
+ *
+ * Note: WMQ::Queue#get already returns an instance of this class as :folders
+ *       in every :rf_header_2. Folders are cached once decoded, so changes
+ *       made to :xml afterwards are not reflected.
+ */
+VALUE RFH2Folders_initialize(VALUE self, VALUE xml)
+{
+    Check_Type(xml, T_ARRAY);
+    rb_iv_set(self, "@xml", xml);
+    rb_iv_set(self, "@folders", Qnil);
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *   [](folder_name)
+ *
+ * Returns a Hash of the properties in the folder, nil if the folder is not present
+ *
+ * Property names are returned as Strings. Values are returned according to their
+ * dt attribute:
+ *   i1, i2, i4, i8, int: Integer
+ *   r4, r8:              Float
+ *   boolean:             true or false
+ *   bin.hex:             String of binary data
+ *   otherwise:           String
+ * Values that are not valid for their dt attribute are returned as a String.
+ * Properties with xsi:nil="true" are returned as nil. Nested groups are
+ * returned as a Hash, and repeated names as an Array of values.
+ *
+ * Raises ArgumentError if the folder is not valid
+ *
+ * Example:
+ *   message.headers.each do |header|
+ *     puts header[:folders][:usr]['OrderId'] if header[:header_type] == :rf_header_2
+ *   end
+ */
+VALUE RFH2Folders_aref(VALUE self, VALUE name)
+{
+    VALUE  folders = rb_iv_get(self, "@folders");
+    VALUE  xml     = rb_iv_get(self, "@xml");
+    VALUE  key     = (TYPE(name) == T_SYMBOL) ? name : ID2SYM(rb_to_id(name));
+    VALUE  folder_hash = Qnil;
+    long   i;
+
+    if (!NIL_P(folders))
+    {
+        folder_hash = rb_hash_lookup2(folders, key, Qundef);
+        if (folder_hash != Qundef)
+        {
+            return folder_hash;
+        }
+        folder_hash = Qnil;
+    }
+
+    for (i = 0; i < RARRAY_LEN(xml); i++)
+    {
+        VALUE folder = RARRAY_AREF(xml, i);
+        if (RFH2Folders_folder_name(folder) == key)
+        {
+            struct RFH2Folders_decode_arg arg;
+            rfh2_status_t status;
+
+            if (NIL_P(folder_hash))
+            {
+                folder_hash = rb_hash_new();
+            }
+            arg.stack[0] = folder_hash;
+            arg.depth    = 0;
+            status = rfh2_decode_folder(RSTRING_PTR(folder), RSTRING_LEN(folder), &RFH2Folders_callbacks, &arg);
+            if (status != RFH2_OK)                     /* Not cached, so that every access reports it */
+            {
+                rb_raise(rb_eArgError, "Could not parse rfh2 folder %s, reason %s",
+                         rb_id2name(SYM2ID(key)), rfh2_status_to_s(status));
+            }
+        }
+    }
+
+    if (!NIL_P(folder_hash))
+    {
+        if (NIL_P(folders))
+        {
+            folders = rb_hash_new();
+            rb_iv_set(self, "@folders", folders);
+        }
+        rb_hash_aset(folders, key, folder_hash);
+    }
+    return folder_hash;
+}
+
+/*
+ * Returns the names of the folders present as an Array of Symbols,
+ * without decoding any of them
+ */
+VALUE RFH2Folders_keys(VALUE self)
+{
+    VALUE xml  = rb_iv_get(self, "@xml");
+    VALUE keys = rb_ary_new();
+    long  i;
+
+    for (i = 0; i < RARRAY_LEN(xml); i++)
+    {
+        VALUE key = RFH2Folders_folder_name(RARRAY_AREF(xml, i));
+        if (!NIL_P(key) && !RTEST(rb_ary_includes(keys, key)))
+        {
+            rb_ary_push(keys, key);
+        }
+    }
+    return keys;
+}
+
+/*
+ * Yields the name and properties of every folder, decoding each one
+ */
+VALUE RFH2Folders_each(VALUE self)
+{
+    VALUE keys;
+    long  i;
+
+    RETURN_ENUMERATOR(self, 0, 0);
+
+    keys = RFH2Folders_keys(self);
+    for (i = 0; i < RARRAY_LEN(keys); i++)
+    {
+        VALUE key = RARRAY_AREF(keys, i);
+        rb_yield_values(2, key, RFH2Folders_aref(self, key));
+    }
+    return self;
+}
+
+/*
+ * Returns a Hash of all folders, decoding each one
+ */
+VALUE RFH2Folders_to_h(VALUE self)
+{
+    VALUE keys = RFH2Folders_keys(self);
+    VALUE hash = rb_hash_new();
+    long  i;
+
+    for (i = 0; i < RARRAY_LEN(keys); i++)
+    {
+        VALUE key = RARRAY_AREF(keys, i);
+        rb_hash_aset(hash, key, RFH2Folders_aref(self, key));
+    }
+    return hash;
+}
+
 static VALUE Message_build_rf_header_2_each(VALUE element, struct Message_build_header_arg* parg)
 {
     VALUE  str = StringValue(element);
@@ -582,6 +1179,403 @@ static VALUE Message_build_rf_header_2_each(VALUE element, struct Message_build_
     return Qnil;
 }
 
+/*
+ * Encoding of a Hash of folders into RFH2 NameValueData
+ *
+ * Like the RFH NameValueString, each folder is encoded in 2 passes: the first
+ * measures it and the second writes it. When p_out is 0 only the length is
+ * accumulated.
+ */
+struct Message_rfh2_writer {
+    PMQBYTE  p_out;                                   /* Write pass: Start of folder, Measure pass: 0 */
+    MQLONG   length;                                  /* Total length measured or written so far */
+    MQLONG   limit;                                   /* Write pass: Space available for the folder */
+    int      depth;                                   /* Nesting of Hashes and Arrays */
+};
+
+static void Message_rfh2_put(struct Message_rfh2_writer* pw, const char* p_str, long len)
+{
+    if (pw->p_out)
+    {
+        if (pw->length + len > pw->limit)
+        {
+            rb_raise(rb_eArgError, ":xml supplied in rf_header_2 to WMQ::Message#headers was modified while building the header");
+        }
+        memcpy(pw->p_out + pw->length, p_str, len);
+    }
+    pw->length += len;
+}
+
+#define WMQ_RFH2_PUT(pw, literal) Message_rfh2_put(pw, literal, sizeof(literal) - 1)
+
+/*
+ * Write text, replacing '&', '<' and '>' with entities
+ */
+static void Message_rfh2_put_escaped(struct Message_rfh2_writer* pw, const char* p_str, long len)
+{
+    const char* p_end = p_str + len;
+    const char* p;
+
+    for (p = p_str; p < p_end; p++)
+    {
+        if (*p == '&' || *p == '<' || *p == '>')
+        {
+            Message_rfh2_put(pw, p_str, p - p_str);
+            if (*p == '&')
+                WMQ_RFH2_PUT(pw, "&amp;");
+            else if (*p == '<')
+                WMQ_RFH2_PUT(pw, "&lt;");
+            else
+                WMQ_RFH2_PUT(pw, "&gt;");
+            p_str = p + 1;
+        }
+    }
+    Message_rfh2_put(pw, p_str, p_end - p_str);
+}
+
+/*
+ * Format a Float with the fewest digits that still read back as the same value
+ */
+static int Message_rfh2_format_float(double value, char* buffer, size_t size)
+{
+    int precision;
+    int len = 0;
+
+    if (isnan(value))
+        return snprintf(buffer, size, "NaN");
+    if (isinf(value))
+        return snprintf(buffer, size, value < 0 ? "-Infinity" : "Infinity");
+
+    for (precision = 15; precision <= 17; precision++)
+    {
+        len = snprintf(buffer, size, "%.*g", precision, value);
+        if (strtod(buffer, NULL) == value)
+            break;
+    }
+    return len;
+}
+
+static int Message_rfh2_put_each(VALUE key, VALUE value, VALUE arg);
+static int Message_rfh2_deep_frozen(VALUE value, int depth);
+
+static void Message_rfh2_put_element(struct Message_rfh2_writer* pw, VALUE name, VALUE value)
+{
+    char   number[32];
+    int    number_len;
+    const char* p_dt = 0;
+
+    if (pw->depth > RFH2_MAX_DEPTH)
+    {
+        rb_raise(rb_eArgError, ":xml supplied in rf_header_2 to WMQ::Message#headers is nested too deeply");
+    }
+
+    if (TYPE(name) == T_SYMBOL)
+    {
+        name = rb_sym2str(name);
+    }
+    StringValue(name);
+
+    switch (TYPE(value))
+    {
+    case T_ARRAY:                                     /* Repeat element for every value */
+    {
+        long i;
+        pw->depth++;
+        for (i = 0; i < RARRAY_LEN(value); i++)
+        {
+            Message_rfh2_put_element(pw, name, RARRAY_AREF(value, i));
+        }
+        pw->depth--;
+        return;
+    }
+
+    case T_NIL:
+        WMQ_RFH2_PUT(pw, "<");
+        Message_rfh2_put(pw, RSTRING_PTR(name), RSTRING_LEN(name));
+        WMQ_RFH2_PUT(pw, " xsi:nil=\"true\"/>");
+        return;
+
+    case T_HASH:                                      /* Group */
+        WMQ_RFH2_PUT(pw, "<");
+        Message_rfh2_put(pw, RSTRING_PTR(name), RSTRING_LEN(name));
+        WMQ_RFH2_PUT(pw, ">");
+        pw->depth++;
+        rb_hash_foreach(value, Message_rfh2_put_each, (VALUE)pw);
+        pw->depth--;
+        break;
+
+    case T_TRUE:
+    case T_FALSE:
+        p_dt = "boolean";
+        number[0] = (value == Qtrue) ? '1' : '0';
+        number_len = 1;
+        break;
+
+    case T_FIXNUM:
+    case T_BIGNUM:
+    {
+        LONG_LONG number_value = NUM2LL(value);
+        p_dt = (number_value >= -2147483647LL - 1 && number_value <= 2147483647LL) ? "i4" : "i8";
+        number_len = snprintf(number, sizeof(number), "%lld", (long long)number_value);
+        break;
+    }
+
+    case T_FLOAT:
+        p_dt = "r8";
+        number_len = Message_rfh2_format_float(RFLOAT_VALUE(value), number, sizeof(number));
+        break;
+
+    default:
+        if (TYPE(value) == T_SYMBOL)
+        {
+            value = rb_sym2str(value);
+        }
+        StringValue(value);
+        WMQ_RFH2_PUT(pw, "<");
+        Message_rfh2_put(pw, RSTRING_PTR(name), RSTRING_LEN(name));
+        WMQ_RFH2_PUT(pw, ">");
+        Message_rfh2_put_escaped(pw, RSTRING_PTR(value), RSTRING_LEN(value));
+        break;
+    }
+
+    if (p_dt)                                         /* Typed value: <name dt="i4">123</name> */
+    {
+        WMQ_RFH2_PUT(pw, "<");
+        Message_rfh2_put(pw, RSTRING_PTR(name), RSTRING_LEN(name));
+        WMQ_RFH2_PUT(pw, " dt=\"");
+        Message_rfh2_put(pw, p_dt, strlen(p_dt));
+        WMQ_RFH2_PUT(pw, "\">");
+        Message_rfh2_put(pw, number, number_len);
+    }
+
+    WMQ_RFH2_PUT(pw, "</");
+    Message_rfh2_put(pw, RSTRING_PTR(name), RSTRING_LEN(name));
+    WMQ_RFH2_PUT(pw, ">");
+}
+
+static int Message_rfh2_put_each(VALUE key, VALUE value, VALUE arg)
+{
+    Message_rfh2_put_element((struct Message_rfh2_writer*)arg, key, value);
+    return ST_CONTINUE;
+}
+
+struct Message_rfh2_frozen_arg
+{
+    int depth;                                        /* Nesting of Hashes and Arrays */
+    int frozen;
+};
+
+static int Message_rfh2_deep_frozen_each(VALUE key, VALUE value, VALUE arg)
+{
+    struct Message_rfh2_frozen_arg* pf = (struct Message_rfh2_frozen_arg*)arg;
+
+    pf->frozen = Message_rfh2_deep_frozen(value, pf->depth);
+    return pf->frozen ? ST_CONTINUE : ST_STOP;
+}
+
+/*
+ * Whether the value, and every value within it, is frozen
+ *
+ * Values nested deeper than a folder may be are not considered frozen,
+ * leaving the serializer to reject them
+ */
+static int Message_rfh2_deep_frozen(VALUE value, int depth)
+{
+    struct Message_rfh2_frozen_arg arg;
+    long i;
+
+    if (!OBJ_FROZEN(value) || depth > RFH2_MAX_DEPTH)
+    {
+        return 0;
+    }
+    arg.depth  = depth + 1;
+    arg.frozen = 1;
+    switch (TYPE(value))
+    {
+        case T_HASH:
+            rb_hash_foreach(value, Message_rfh2_deep_frozen_each, (VALUE)&arg);
+            break;
+        case T_ARRAY:
+            for (i = 0; i < RARRAY_LEN(value) && arg.frozen; i++)
+            {
+                arg.frozen = Message_rfh2_deep_frozen(RARRAY_AREF(value, i), arg.depth);
+            }
+            break;
+    }
+    return arg.frozen;
+}
+
+/*
+ * Deeply frozen folder Hashes are treated as constant: They are serialized once into
+ * a String that is cached on the header Hash and only copied on subsequent puts.
+ *
+ * Returns the serialized folder, or nil if the folder cannot be cached
+ */
+static VALUE Message_rfh2_cached_folder(VALUE header, VALUE name, VALUE folder)
+{
+    struct Message_rfh2_writer writer = {0, 0, 0, 0};
+    VALUE  cache;
+    VALUE  cached;
+    VALUE  str;
+
+    if (OBJ_FROZEN(header) || !Message_rfh2_deep_frozen(folder, 0))  /* Values changed in place would not be seen */
+    {
+        return Qnil;
+    }
+
+    cache = rb_ivar_get(header, ID_rfh2_cache);
+    if (NIL_P(cache))
+    {
+        cache = rb_hash_new();
+        rb_ivar_set(header, ID_rfh2_cache, cache);
+    }
+    cached = rb_hash_lookup(cache, name);
+    if (!NIL_P(cached) && RARRAY_AREF(cached, 0) == folder)
+    {
+        return RARRAY_AREF(cached, 1);
+    }
+
+    Message_rfh2_put_element(&writer, name, folder);  /* Measure */
+    str = rb_str_new(0, writer.length);
+    writer.p_out  = (PMQBYTE)RSTRING_PTR(str);
+    writer.limit  = writer.length;
+    writer.length = 0;
+    Message_rfh2_put_element(&writer, name, folder);
+    rb_str_resize(str, writer.length);
+    rb_obj_freeze(str);
+    rb_hash_aset(cache, name, rb_assoc_new(folder, str));
+    return str;
+}
+
+#define WMQ_RFH2_PADDED(len) ((len) + (((len) % 4) ? 4 - ((len) % 4) : 0))
+
+struct Message_size_rf_header_2_arg {
+    VALUE    header;                                  /* Header Hash, holds the serialized frozen folders */
+    MQLONG   size;                                    /* Total size of the folders so far */
+};
+
+static int Message_size_rf_header_2_each_folder(VALUE name, VALUE folder, VALUE arg)
+{
+    struct Message_size_rf_header_2_arg* psarg = (struct Message_size_rf_header_2_arg*)arg;
+    VALUE  cached;
+    MQLONG length;
+
+    if (TYPE(folder) != T_HASH)
+    {
+        rb_raise(rb_eArgError, "Each folder in :xml supplied in rf_header_2 to WMQ::Message#headers must be a Hash");
+    }
+
+    cached = Message_rfh2_cached_folder(psarg->header, name, folder);
+    if (NIL_P(cached))
+    {
+        struct Message_rfh2_writer writer = {0, 0, 0, 0};
+        Message_rfh2_put_element(&writer, name, folder);
+        length = writer.length;
+    }
+    else
+    {
+        length = RSTRING_LEN(cached);
+    }
+    psarg->size += sizeof(MQLONG) + WMQ_RFH2_PADDED(length);
+    return ST_CONTINUE;
+}
+
+/*
+ * Returns the size of the RFH2 Header, including the padded NameValueData
+ *
+ * Frozen folders are serialized and cached here, if not already cached
+ */
+MQLONG Message_size_rf_header_2 (VALUE hash)
+{
+    VALUE  xml  = rb_hash_aref(hash, ID2SYM(ID_xml));
+    MQLONG size = sizeof(MQRFH2);
+
+    if (NIL_P(xml))
+    {
+        return size;
+    }
+
+    if (TYPE(xml) == T_ARRAY)
+    {
+        long i;
+        for (i = 0; i < RARRAY_LEN(xml); i++)
+        {
+            VALUE str = RARRAY_AREF(xml, i);
+            size += sizeof(MQLONG) + WMQ_RFH2_PADDED(RSTRING_LEN(StringValue(str)));
+        }
+    }
+    else if (TYPE(xml) == T_STRING)
+    {
+        size += sizeof(MQLONG) + WMQ_RFH2_PADDED(RSTRING_LEN(xml));
+    }
+    else if (TYPE(xml) == T_HASH)
+    {
+        struct Message_size_rf_header_2_arg size_arg;
+        size_arg.header = hash;
+        size_arg.size   = 0;
+        rb_hash_foreach(xml, Message_size_rf_header_2_each_folder, (VALUE)&size_arg);
+        size += size_arg.size;
+    }
+    else
+    {
+        rb_raise(rb_eArgError, ":xml supplied in rf_header_2 to WMQ::Message#headers must be a String, an Array or a Hash");
+    }
+    return size;
+}
+
+struct Message_build_rf_header_2_folder_arg {
+    struct Message_build_header_arg* parg;
+    VALUE    header;                                  /* Header Hash, holds the serialized frozen folders */
+};
+
+/*
+ * Encode a folder from a Hash, directly into the message buffer
+ */
+static int Message_build_rf_header_2_each_folder(VALUE name, VALUE folder, VALUE arg)
+{
+    struct Message_build_rf_header_2_folder_arg* pfarg = (struct Message_build_rf_header_2_folder_arg*)arg;
+    struct Message_build_header_arg* parg = pfarg->parg;
+    struct Message_rfh2_writer writer = {0, 0, 0, 0};
+    VALUE   cached;
+    MQLONG  length;
+    MQLONG  pad;
+    PMQBYTE p_data;
+
+    if (TYPE(folder) != T_HASH)
+    {
+        rb_raise(rb_eArgError, "Each folder in :xml supplied in rf_header_2 to WMQ::Message#headers must be a Hash");
+    }
+
+    cached = Message_rfh2_cached_folder(pfarg->header, name, folder);
+    if (!NIL_P(cached))
+    {
+        if(parg->trace_level>3)
+            printf ("WMQ::Message#build_rf_header_2 Using cached folder\n");
+
+        Message_build_rf_header_2_each(cached, parg);
+        return ST_CONTINUE;
+    }
+
+    /* Buffer was sized by Message_size_rf_header_2, so write directly into the remaining space */
+    p_data = Message_autogrow_data_buffer(parg, sizeof(MQLONG));
+    writer.p_out  = p_data + sizeof(MQLONG);
+    writer.limit  = *(parg->p_buffer_size) - *(parg->p_data_offset) - sizeof(MQLONG) - parg->data_length;
+    Message_rfh2_put_element(&writer, name, folder);
+
+    length = writer.length;
+    pad    = (length % 4) ? 4 - (length % 4) : 0;
+    if (length + pad > writer.limit)
+    {
+        rb_raise(rb_eArgError, ":xml supplied in rf_header_2 to WMQ::Message#headers was modified while building the header");
+    }
+    memset(writer.p_out + length, ' ', pad);
+    length += pad;
+    memcpy(p_data, (void*) &length, sizeof(length));  /* Start with MQLONG length indicator */
+    *(parg->p_data_offset) += sizeof(length) + length;
+
+    return ST_CONTINUE;
+}
+
 /*
  * RFH2 Header can contain multiple XML-like strings
  *   Message consists of:
@@ -605,10 +1599,34 @@ static VALUE Message_build_rf_header_2_each(VALUE element, struct Message_build_
  *    xml:  ['<hello>to the world</hello>', '<another>xml like string</another>'],
  *  }
  *
+ *  Or a Hash of folders, each of which is a Hash of properties
+ *  E.g.
+ *
+ *  {
+ *    header_type: :rf_header_2,
+ *    xml:  {
+ *      mcd: {Msd: 'jms_text'.freeze}.freeze,
+ *      usr: {OrderId: 1234, Price: 12.5, Express: true, Note: nil, Item: {Sku: ['A1', 'B2']}}
+ *    }
+ *  }
+ *
+ *  Property values are encoded according to their type:
+ *    Integer:       dt="i4", or dt="i8" when outside the 32 bit range
+ *    Float:         dt="r8"
+ *    true or false: dt="boolean"
+ *    nil:           xsi:nil="true"
+ *    Hash:          Nested group
+ *    Array:         The property is repeated for every element
+ *    otherwise:     String, with '&', '<' and '>' replaced by entities
+ *
+ *  Folder Hashes that are deeply frozen, i.e. every Hash, Array and String
+ *  within them is also frozen, such as the mcd folder above, are only
+ *  serialized on the first put and the result is cached on the header Hash.
+ *  The header Hash itself must therefore not be frozen for caching to apply.
  */
 void Message_build_rf_header_2(VALUE hash, struct Message_build_header_arg* parg)
 {
-    static  MQRFH2 MQRFH2_DEF = {MQRFH2_DEFAULT};
+    static const MQRFH2 MQRFH2_DEF = {MQRFH2_DEFAULT};
     MQLONG  rfh2_offset = *(parg->p_data_offset);
     PMQBYTE p_data;
     VALUE   xml = rb_hash_aref(hash, ID2SYM(ID_xml));
@@ -636,13 +1654,20 @@ void Message_build_rf_header_2(VALUE hash, struct Message_build_header_arg* parg
         {
             rb_iterate (rb_each, xml, Message_build_rf_header_2_each, (VALUE)parg);
         }
-        else if(TYPE(xml) != T_STRING)
+        else if(TYPE(xml) == T_STRING)
         {
             Message_build_rf_header_2_each(xml, parg);
         }
+        else if(TYPE(xml) == T_HASH)
+        {
+            struct Message_build_rf_header_2_folder_arg folder_arg;
+            folder_arg.parg   = parg;
+            folder_arg.header = hash;
+            rb_hash_foreach(xml, Message_build_rf_header_2_each_folder, (VALUE)&folder_arg);
+        }
         else
         {
-            rb_raise(rb_eArgError, ":name_value supplied in rf_header_2 to WMQ::Message#headers must be a String or an Array");
+            rb_raise(rb_eArgError, ":xml supplied in rf_header_2 to WMQ::Message#headers must be a String, an Array or a Hash");
         }
     }
 
@@ -141,6 +141,17 @@ void Queue_manager_mq_load(PQUEUE_MANAGER pqm)
         MQ_FUNCTION(MQINQ,void(*)  (MQHCONN,MQHOBJ,MQLONG,PMQLONG,MQLONG,PMQLONG,MQLONG,PMQCHAR,PMQLONG,PMQLONG))
         MQ_FUNCTION(MQSET,void(*)  (MQHCONN,MQHOBJ,MQLONG,PMQLONG,MQLONG,PMQLONG,MQLONG,PMQCHAR,PMQLONG,PMQLONG))
 
+      #ifdef MQHM_UNUSABLE_HMSG
+        MQ_FUNCTION(MQCRTMH,void(*)(MQHCONN,PMQVOID,PMQHMSG,PMQLONG,PMQLONG))
+        MQ_FUNCTION(MQDLTMH,void(*)(MQHCONN,PMQHMSG,PMQVOID,PMQLONG,PMQLONG))
+        MQ_FUNCTION(MQINQMP,void(*)(MQHCONN,MQHMSG,PMQVOID,PMQVOID,PMQVOID,PMQLONG,MQLONG,PMQVOID,PMQLONG,PMQLONG,PMQLONG))
+        MQ_FUNCTION(MQSETMP,void(*)(MQHCONN,MQHMSG,PMQVOID,PMQVOID,PMQVOID,MQLONG,MQLONG,PMQVOID,PMQLONG,PMQLONG))
+      #endif
+      #ifdef MQCBT_MESSAGE_CONSUMER
+        MQ_FUNCTION(MQCB,void(*)   (MQHCONN,MQLONG,PMQVOID,MQHOBJ,PMQVOID,PMQVOID,PMQLONG,PMQLONG))
+        MQ_FUNCTION(MQCTL,void(*)  (MQHCONN,MQLONG,PMQVOID,PMQLONG,PMQLONG))
+      #endif
+
         MQ_FUNCTION(mqCreateBag,void(*)(MQLONG,PMQHBAG,PMQLONG,PMQLONG))
         MQ_FUNCTION(mqDeleteBag,void(*)(PMQHBAG,PMQLONG,PMQLONG))
         MQ_FUNCTION(mqClearBag,void(*)(MQHBAG,PMQLONG,PMQLONG))
@@ -183,6 +194,17 @@ void Queue_manager_mq_load(PQUEUE_MANAGER pqm)
     pqm->MQINQ   = &MQINQ;
     pqm->MQSET   = &MQSET;
 
+  #ifdef MQHM_UNUSABLE_HMSG
+    pqm->MQCRTMH = &MQCRTMH;
+    pqm->MQDLTMH = &MQDLTMH;
+    pqm->MQINQMP = &MQINQMP;
+    pqm->MQSETMP = &MQSETMP;
+  #endif
+  #ifdef MQCBT_MESSAGE_CONSUMER
+    pqm->MQCB    = &MQCB;
+    pqm->MQCTL   = &MQCTL;
+  #endif
+
     pqm->mqCreateBag      = &mqCreateBag;
     pqm->mqClearBag       = &mqClearBag;
     pqm->mqExecute        = &mqExecute;
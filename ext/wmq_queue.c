@@ -1,4 +1,27 @@
 #include "wmq.h"
+#include "wmq_convert.h"
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+  #include <ruby/fiber/scheduler.h>
+#endif
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL) && !defined(_WIN32)
+  #define WMQ_PREFETCH
+  #include <pthread.h>
+  #include <stddef.h>
+#endif
+
+/* Under a fiber scheduler, waiting gets poll MQ without blocking, sleeping in between */
+#define WMQ_SCHEDULER_POLL_MIN 10                     /* First poll interval in milliseconds */
+#define WMQ_SCHEDULER_POLL_MAX 100                    /* Longest poll interval in milliseconds */
+
+/* The prefetch thread waits for messages in intervals of at most this many milliseconds, to notice when it is stopped */
+#define WMQ_PREFETCH_WAIT_MAX 200
+
+/* Reason in the dead letter header of messages moved by get(backout_requeue: true) */
+#ifdef MQRC_BACKOUT_THRESHOLD_REACHED
+  #define WMQ_POISON_REASON MQRC_BACKOUT_THRESHOLD_REACHED
+#else
+  #define WMQ_POISON_REASON MQRC_BACKED_OUT
+#endif
 /* --------------------------------------------------
  * Initialize Ruby ID's for Queue Class
  *
@@ -28,12 +51,20 @@ static ID ID_mode;
 static ID ID_fail_if_quiescing;
 static ID ID_queue_manager;
 static ID ID_dynamic_q_name;
+static ID ID_selector;
 static ID ID_close_options;
 static ID ID_fail_if_exists;
 static ID ID_alternate_user_id;
 static ID ID_alternate_security_id;
 static ID ID_message;
 static ID ID_descriptor;
+static ID ID_properties;
+static ID ID_prefetch;
+static ID ID_commit_every;
+static ID ID_commit_interval_ms;
+static ID ID_commit;
+static ID ID_backout;
+static ID ID_backout_requeue;
 
 void Queue_id_init()
 {
@@ -63,9 +94,17 @@ void Queue_id_init()
 
     ID_message         = rb_intern("message");
     ID_descriptor      = rb_intern("descriptor");
+    ID_properties      = rb_intern("properties");
+    ID_prefetch        = rb_intern("prefetch");
+    ID_commit_every    = rb_intern("commit_every");
+    ID_commit_interval_ms = rb_intern("commit_interval_ms");
+    ID_commit          = rb_intern("commit");
+    ID_backout         = rb_intern("backout");
+    ID_backout_requeue = rb_intern("backout_requeue");
 
     ID_fail_if_quiescing     = rb_intern("fail_if_quiescing");
     ID_dynamic_q_name        = rb_intern("dynamic_q_name");
+    ID_selector              = rb_intern("selector");
     ID_close_options         = rb_intern("close_options");
     ID_fail_if_exists        = rb_intern("fail_if_exists");
     ID_alternate_security_id = rb_intern("alternate_security_id");
@@ -86,15 +125,99 @@ void Queue_id_init()
     MQLONG   exception_on_error;      /* Non-Zero means throw exception*/
     MQLONG   fail_if_exists;          /* Non-Zero means open dynamic_q_name directly */
     MQLONG   trace_level;             /* Trace level. 0==None, 1==Info 2==Debug ..*/
+    MQLONG   release_gvl;             /* Non-Zero means call MQ without the GVL */
     MQCHAR   q_name[MQ_Q_NAME_LENGTH+1]; /* queue name plus null character */
     PMQBYTE  p_buffer;                /* message buffer                */
     MQLONG   buffer_size;             /* Allocated size of buffer      */
+    struct Message_build_stats build_stats; /* Counters for messages built by put */
+    long     get_buffer_resizes;      /* Buffer grown for a truncated get */
+    long     get_generation;          /* Incremented by every get, see WMQ::MessageProperties */
+    long     commits;                 /* Units of work committed by each(commit_every:) */
+    long     committed_messages;      /* Messages in those units of work */
+    long     max_commit_size;         /* Most messages in one of them  */
+    long     backouts;                /* Units of work backed out by each(commit_every:) */
+    long     poison_messages;         /* Messages moved by get(backout_requeue: true) */
+    MQLONG   poison_moved;            /* Non-Zero when the last get moved the message instead */
+    MQLONG   backout_inquired;        /* Non-Zero once the attributes below were inquired */
+    MQLONG   backout_threshold;       /* BOTHRESH of the queue, 0 when not set */
+    MQCHAR48 backout_q_name;          /* BOQNAME of the queue          */
+    MQCHAR48 dead_letter_q_name;      /* DEADQ of the queue manager    */
+    long     connection_id;           /* Queue manager connection the queue was opened on */
+    rb_pid_t pid;                     /* Process that opened the queue */
+    MQLONG   syncpoint;               /* Non-Zero when the last get or put was under syncpoint */
+    MQLONG   browse_positioned;       /* Non-Zero when browse_msg_id holds the browse cursor */
+    MQBYTE24 browse_msg_id;           /* Message id of the last message browsed */
+  #ifdef MQHM_UNUSABLE_HMSG
+    MQHMSG   get_hmsg;                /* Message handle re-used by get(properties: true) */
+  #endif
 
     void(*MQCLOSE)(MQHCONN,PMQHOBJ,MQLONG,PMQLONG,PMQLONG);
     void(*MQGET)  (MQHCONN,MQHOBJ,PMQVOID,PMQVOID,MQLONG,PMQVOID,PMQLONG,PMQLONG,PMQLONG);
     void(*MQPUT)  (MQHCONN,MQHOBJ,PMQVOID,PMQVOID,MQLONG,PMQVOID,PMQLONG,PMQLONG);
+  #ifdef MQHM_UNUSABLE_HMSG
+    void(*MQCRTMH)(MQHCONN,PMQVOID,PMQHMSG,PMQLONG,PMQLONG);
+    void(*MQDLTMH)(MQHCONN,PMQHMSG,PMQVOID,PMQLONG,PMQLONG);
+    void(*MQINQMP)(MQHCONN,MQHMSG,PMQVOID,PMQVOID,PMQVOID,PMQLONG,MQLONG,PMQVOID,PMQLONG,PMQLONG,PMQLONG);
+    void(*MQSETMP)(MQHCONN,MQHMSG,PMQVOID,PMQVOID,PMQVOID,MQLONG,MQLONG,PMQVOID,PMQLONG,PMQLONG);
+  #endif
  };
 
+static VALUE MessageProperties_new(VALUE queue, PQUEUE pq);
+
+/* MQGET and MQPUT, made without the GVL with :release_gvl or :share_handle */
+struct Queue_mq_arg {
+    PQUEUE   pq;
+    PMQMD    pmd;
+    PMQVOID  p_options;
+    MQLONG   length;
+    PMQVOID  p_buffer;
+    PMQLONG  p_messlen;
+};
+
+static void* Queue_mqget(void* p)
+{
+    struct Queue_mq_arg* parg = (struct Queue_mq_arg*)p;
+    PQUEUE pq = parg->pq;
+    pq->MQGET(pq->hcon, pq->hobj, parg->pmd, parg->p_options, parg->length, parg->p_buffer,
+              parg->p_messlen, &pq->comp_code, &pq->reason_code);
+    return 0;
+}
+
+static void* Queue_mqput(void* p)
+{
+    struct Queue_mq_arg* parg = (struct Queue_mq_arg*)p;
+    PQUEUE pq = parg->pq;
+    pq->MQPUT(pq->hcon, pq->hobj, parg->pmd, parg->p_options, parg->length, parg->p_buffer,
+              &pq->comp_code, &pq->reason_code);
+    return 0;
+}
+
+static VALUE Queue_get_once(VALUE self, VALUE hash);
+static VALUE Queue_put_once(VALUE self, VALUE hash);
+static VALUE Queue_call(VALUE self, VALUE hash, VALUE(*fn)(VALUE, VALUE));
+
+#ifdef MQHM_UNUSABLE_HMSG
+/*
+ * Delete the message handle used by get(properties: true), ignoring errors
+ */
+static void Queue_delete_get_hmsg(PQUEUE pq)
+{
+    MQDMHO dmho = {MQDMHO_DEFAULT};
+    MQLONG comp_code;
+    MQLONG reason_code;
+
+    if (pq->get_hmsg != MQHM_NONE)
+    {
+        if (pq->hcon)
+        {
+            pq->MQDLTMH(pq->hcon, &pq->get_hmsg, &dmho, &comp_code, &reason_code);
+        }
+        pq->get_hmsg = MQHM_NONE;
+    }
+    pq->get_generation++;                             /* Properties of the last message are no longer available */
+}
+#endif
+
 /* --------------------------------------------------
  * C Structure to store MQ data types and other
  *   C internal values
@@ -104,9 +227,12 @@ void QUEUE_free(void* p)
     PQUEUE pq = (PQUEUE)p;
     if(pq->trace_level) printf("WMQ::Queue Freeing QUEUE structure\n");
 
-    if (pq->hobj)  /* Valid Q handle means MQCLOSE was not called */
+    if (pq->hobj && pq->pid == getpid())  /* Valid Q handle means MQCLOSE was not called */
     {
         printf("WMQ::Queue#close was not called. Automatically calling close()\n");
+  #ifdef MQHM_UNUSABLE_HMSG
+        Queue_delete_get_hmsg(pq);
+  #endif
         pq->MQCLOSE(pq->hcon, &pq->hobj, pq->close_options, &pq->comp_code, &pq->reason_code);
     }
     free(pq->p_buffer);
@@ -115,7 +241,7 @@ void QUEUE_free(void* p)
 
 VALUE QUEUE_alloc(VALUE klass)
 {
-    static MQOD default_MQOD = {MQOD_DEFAULT};
+    static const MQOD default_MQOD = {MQOD_DEFAULT};
     PQUEUE pq = ALLOC(QUEUE);
 
     pq->hobj = 0;
@@ -127,14 +253,47 @@ VALUE QUEUE_alloc(VALUE klass)
     pq->close_options = MQCO_NONE;
     pq->exception_on_error = 1;
     pq->trace_level = 0;
+    pq->release_gvl = 0;
     pq->fail_if_exists = 1;
     memset(&pq->q_name, 0, sizeof(pq->q_name));
     pq->buffer_size = 16384;
     pq->p_buffer = ALLOC_N(unsigned char, pq->buffer_size);
+    memset(&pq->build_stats, 0, sizeof(pq->build_stats));
+    pq->get_buffer_resizes = 0;
+    pq->get_generation = 0;
+    pq->commits = 0;
+    pq->committed_messages = 0;
+    pq->max_commit_size = 0;
+    pq->backouts = 0;
+    pq->poison_messages = 0;
+    pq->poison_moved = 0;
+    pq->backout_inquired = 0;
+    pq->backout_threshold = 0;
+    pq->connection_id = 0;
+    pq->pid = getpid();
+    pq->syncpoint = 0;
+    pq->browse_positioned = 0;
+  #ifdef MQHM_UNUSABLE_HMSG
+    pq->get_hmsg = MQHM_NONE;
+  #endif
 
     return Data_Wrap_Struct(klass, 0, QUEUE_free, pq);
 }
 
+/*
+ * Forget the queue handles without calling MQ, since the connection they were
+ * opened on is gone, or belongs to the parent process
+ */
+static void Queue_discard(PQUEUE pq)
+{
+    pq->hcon = 0;
+    pq->hobj = 0;
+  #ifdef MQHM_UNUSABLE_HMSG
+    pq->get_hmsg = MQHM_NONE;
+    pq->get_generation++;                             /* Invalidate WMQ::MessageProperties */
+  #endif
+}
+
 static MQLONG Queue_extract_open_options(VALUE hash, VALUE name)
 {
     VALUE          val;
@@ -289,6 +448,17 @@ VALUE Queue_initialize(VALUE self, VALUE hash)
     val = rb_hash_aref(hash, ID2SYM(ID_dynamic_q_name));   /* :dynamic_q_name */
     rb_iv_set(self, "@dynamic_q_name", val);
 
+    val = rb_hash_aref(hash, ID2SYM(ID_selector));         /* :selector */
+    if (!NIL_P(val))
+    {
+  #ifdef MQOD_VERSION_4
+        val = rb_str_new_frozen(StringValue(val));
+  #else
+        rb_raise(rb_eNotImpError, ":selector requires WebSphere MQ V7 or later");
+  #endif
+    }
+    rb_iv_set(self, "@selector", val);
+
     WMQ_HASH2MQBYTES(hash,alternate_security_id,         pq->od.AlternateSecurityId)
     WMQ_HASH2MQLONG(hash,close_options,                 pq->close_options)
     WMQ_HASH2BOOL(hash,fail_if_exists,                pq->fail_if_exists)
@@ -406,22 +576,40 @@ VALUE Queue_open(VALUE self)
         if(pq->trace_level>1) printf("WMQ::Queue#open() Using dynamic queue name:%s\n", RSTRING_PTR(dynamic_q_name));
     }
 
+  #ifdef MQOD_VERSION_4
+    val = rb_iv_get(self,"@selector");                /* Queue manager only returns matching messages */
+    if (!NIL_P(val))
+    {
+        od.Version                  = MQOD_VERSION_4;
+        od.SelectionString.VSPtr    = RSTRING_PTR(val);
+        od.SelectionString.VSLength = (MQLONG)RSTRING_LEN(val);
+        if(pq->trace_level>1) printf("WMQ::Queue#open() Using selector:%s\n", RSTRING_PTR(val));
+    }
+  #endif
+
     queue_manager = rb_iv_get(self,"@queue_manager");
     if (NIL_P(queue_manager))
     {
         rb_raise(rb_eRuntimeError, "Fatal: Queue Manager object not found in Queue instance");
     }
     Data_Get_Struct(queue_manager, QUEUE_MANAGER, pqm);
+    pq->release_gvl = pqm->release_gvl;
     pq->MQCLOSE= pqm->MQCLOSE;
     pq->MQGET  = pqm->MQGET;
     pq->MQPUT  = pqm->MQPUT;
+  #ifdef MQHM_UNUSABLE_HMSG
+    pq->MQCRTMH= pqm->MQCRTMH;
+    pq->MQDLTMH= pqm->MQDLTMH;
+    pq->MQINQMP= pqm->MQINQMP;
+    pq->MQSETMP= pqm->MQSETMP;
+  #endif
 
     pq->hcon = pqm->hcon;                             /* Store Queue Manager handle for subsequent calls */
 
     if(pq->trace_level)
         printf ("WMQ::Queue#open() Opening Queue:%s, Queue Manager Handle:%ld\n", RSTRING_PTR(name), (long)pq->hcon);
 
-    if(pq->hobj)                                      /* Close queue if already open, ignore errors */
+    if(pq->hobj && pq->pid == getpid())               /* Close queue if already open, ignore errors */
     {
         if(pq->trace_level)
             printf ("WMQ::Queue#open() Queue:%s Already open, closing it!\n", RSTRING_PTR(name));
@@ -480,6 +668,10 @@ VALUE Queue_open(VALUE self)
 
         WMQ_MQCHARS2STR(od.ObjectName, val)
         rb_iv_set(self, "@name", val);                /* Store actual queue name E.g. Dynamic Queue */
+        pq->connection_id = pqm->connection_id;
+        pq->pid = getpid();
+        pq->browse_positioned = 0;
+        pq->backout_inquired = 0;                     /* Inquired again on first use */
 
         if(pq->trace_level>1) printf("WMQ::Queue#open() Actual Queue Name opened:%s\n", RSTRING_PTR(val));
     }
@@ -519,8 +711,17 @@ VALUE Queue_close(VALUE self)
         return Qtrue;
     }
 
+    if (pq->pid != getpid())                          /* Opened by the parent process, do not call MQCLOSE */
+    {
+        Queue_discard(pq);
+        return Qtrue;
+    }
+
     if(pq->trace_level) printf ("WMQ::Queue#close() Queue Handle:%ld, Queue Manager Handle:%ld\n", (long)pq->hobj, (long)pq->hcon);
 
+  #ifdef MQHM_UNUSABLE_HMSG
+    Queue_delete_get_hmsg(pq);
+  #endif
     pq->MQCLOSE(pq->hcon, &pq->hobj, pq->close_options, &pq->comp_code, &pq->reason_code);
 
     pq->hcon = 0; /* Every time the queue is opened, the qmgr handle must be fetched again! */
@@ -545,6 +746,171 @@ VALUE Queue_close(VALUE self)
     return Qtrue;
 }
 
+/*
+ * After a reconnect, open the queue again on the new connection
+ *
+ * The original open options are used. A dynamic queue is re-created with the
+ * name it had before, and a browse cursor is moved back to the last message browsed.
+ * If that message is no longer on the queue, browsing continues from the first message.
+ */
+static void Queue_reopen(VALUE self, PQUEUE pq)
+{
+    VALUE  dynamic_q_name = rb_iv_get(self, "@dynamic_q_name");
+    MQLONG exception_on_error = pq->exception_on_error;
+    MQLONG fail_if_exists = pq->fail_if_exists;
+    MQLONG browse_positioned = pq->browse_positioned;
+    VALUE  opened;
+
+    if(pq->trace_level) printf("WMQ::Queue#reopen() Re-opening queue on new connection\n");
+
+    Queue_discard(pq);                                /* Handles died with the old connection */
+
+    if (!NIL_P(dynamic_q_name))
+    {
+        rb_iv_set(self, "@dynamic_q_name", rb_iv_get(self, "@name"));
+        pq->fail_if_exists = 0;                       /* Permanent dynamic queues still exist */
+    }
+    pq->exception_on_error = 0;
+    opened = Queue_open(self);
+    pq->exception_on_error = exception_on_error;
+    pq->fail_if_exists = fail_if_exists;
+    rb_iv_set(self, "@dynamic_q_name", dynamic_q_name);
+
+    if (opened == Qtrue && browse_positioned)
+    {
+        MQMD   md  = {MQMD_DEFAULT};
+        MQGMO  gmo = {MQGMO_DEFAULT};
+        MQLONG messlen;
+
+        md.Version       = MQMD_CURRENT_VERSION;
+        gmo.Version      = MQGMO_CURRENT_VERSION;
+        gmo.Options      = MQGMO_BROWSE_FIRST | MQGMO_ACCEPT_TRUNCATED_MSG | MQGMO_NO_WAIT;
+        gmo.MatchOptions = MQMO_MATCH_MSG_ID;
+        memcpy(md.MsgId, pq->browse_msg_id, sizeof(MQBYTE24));
+
+        pq->MQGET(pq->hcon, pq->hobj, &md, &gmo, 0, 0, &messlen, &pq->comp_code, &pq->reason_code);
+        if(pq->trace_level) printf("WMQ::Queue#reopen() Restoring browse cursor ended with reason:%s\n", wmq_reason(pq->reason_code));
+
+        pq->browse_positioned = pq->comp_code != MQCC_FAILED;
+        if (pq->browse_positioned)
+        {
+            memcpy(pq->browse_msg_id, md.MsgId, sizeof(MQBYTE24));
+        }
+    }
+}
+
+struct Queue_call_arg {
+    VALUE   self;
+    VALUE   hash;
+    VALUE (*fn)(VALUE, VALUE);
+};
+
+static VALUE Queue_call_body(VALUE arg)
+{
+    struct Queue_call_arg* parg = (struct Queue_call_arg*)arg;
+    return parg->fn(parg->self, parg->hash);
+}
+
+/*
+ * Make the get or put, and when the queue manager was created with :reconnect,
+ * reconnect and re-open the queue when the connection is broken.
+ * The call is then made again, unless it was under syncpoint,
+ * since the queue manager has already backed out the unit of work.
+ */
+static VALUE Queue_call(VALUE self, VALUE hash, VALUE(*fn)(VALUE, VALUE))
+{
+    struct Queue_call_arg arg;
+    VALUE  queue_manager;
+    VALUE  result;
+    VALUE  error;
+    VALUE  errinfo = rb_errinfo();            /* $! of the caller, E.g. in a rescue clause */
+    MQLONG attempt;
+    MQLONG comp_code;
+    MQLONG reason_code;
+    long   connection_id;
+    int    state;
+    PQUEUE_MANAGER pqm;
+    PQUEUE pq;
+    Data_Get_Struct(self, QUEUE, pq);
+
+    queue_manager = rb_iv_get(self,"@queue_manager");
+    if (NIL_P(queue_manager))
+    {
+        return fn(self, hash);
+    }
+    Data_Get_Struct(queue_manager, QUEUE_MANAGER, pqm);
+
+    QueueManager_after_fork(queue_manager);
+    if (pq->hcon && (pq->connection_id != pqm->connection_id || pq->pid != getpid()))
+    {
+        if (pqm->hcon)                                /* Reconnected since the queue was opened */
+        {
+            Queue_reopen(self, pq);
+        }
+        else
+        {
+            Queue_discard(pq);
+        }
+    }
+
+    if (!pqm->reconnect_attempts)
+    {
+        return fn(self, hash);
+    }
+
+    arg.self = self;
+    arg.hash = hash;
+    arg.fn   = fn;
+    for (attempt = 0; ; attempt++)
+    {
+        if (pq->hcon && pq->connection_id != pqm->connection_id)  /* Reconnected since the queue was opened */
+        {
+            Queue_reopen(self, pq);
+        }
+        connection_id   = pqm->connection_id;
+        pq->comp_code   = 0;
+        pq->reason_code = 0;
+        pq->syncpoint   = 0;
+
+        result = rb_protect(Queue_call_body, (VALUE)&arg, &state);
+        error  = Qnil;
+        if (state && RB_TYPE_P(rb_errinfo(), T_OBJECT))  /* Raised, rather than thrown */
+        {
+            error = rb_errinfo();                     /* Not left in $! while reconnecting, or after a retry */
+            rb_set_errinfo(errinfo);
+        }
+
+        if (!QueueManager_connection_error(pq->reason_code))
+        {
+            break;
+        }
+
+        if(pq->trace_level) printf("WMQ::Queue Connection lost with reason:%s, reconnecting\n", wmq_reason(pq->reason_code));
+        comp_code   = pq->comp_code;
+        reason_code = pq->reason_code;
+        if (!QueueManager_reconnect(queue_manager, connection_id) || pq->syncpoint || attempt >= pqm->reconnect_attempts)
+        {
+            if (pqm->hcon)
+            {
+                Queue_reopen(self, pq);               /* Ready for the unit of work to be retried */
+            }
+            pq->comp_code   = comp_code;              /* Report why the call failed */
+            pq->reason_code = reason_code;
+            break;
+        }
+    }
+
+    if (!NIL_P(error))
+    {
+        rb_exc_raise(error);
+    }
+    if (state)
+    {
+        rb_jump_tag(state);
+    }
+    return result;
+}
+
 /*
  * call-seq:
  *   get(...)
@@ -559,7 +925,9 @@ VALUE Queue_close(VALUE self)
  *   sync:              false,                         # MQGMO_SYNCPOINT
  *   wait:              0,                             # MQGMO_WAIT, duration in ms
  *   match:             WMQ::MQMO_NONE,                # MQMO_*
- *   convert:           false,                         # MQGMO_CONVERT
+ *   convert:           false,                         # MQGMO_CONVERT, or a CCSID
+ *   properties:        false,                         # MQGMO_PROPERTIES_IN_HANDLE
+ *   backout_requeue:   false,                         # BOTHRESH, BOQNAME
  *   fail_if_quiescing: true                           # MQOO_FAIL_IF_QUIESCING
  *   options:           WMQ::MQGMO_FAIL_IF_QUIESCING   # MQGMO_*
  *   )
@@ -579,6 +947,10 @@ VALUE Queue_close(VALUE self)
  *     on the queue
  *   * Note: Under the covers the put option MQGMO_WAIT is automatically set when :wait
  *     is supplied
+ *   * When called from a non-blocking Fiber with a Fiber scheduler, such as the
+ *     async gem, the queue is polled without blocking, sleeping through the scheduler
+ *     between polls (10ms, doubling up to 100ms), so that other fibers keep running.
+ *     To wait on many queues at once, consider WMQ::AsyncConsumer instead.
  *      Default: Wait forever
  *
  * * :match [Integer]
@@ -601,6 +973,40 @@ VALUE Queue_close(VALUE self)
  *     to ASCII before passing the message data to the application.
  *      Default: false
  *
+ * * :convert [Integer]
+ *   * Coded Character Set Id to convert string messages to locally, instead of
+ *     using MQGMO_CONVERT. Avoids the conversion cost on the queue manager, and
+ *     MQRC_CONVERTED_MSG_TOO_BIG when the converted message would not fit.
+ *   * The MQCHAR fields in any headers are converted to the local code page, and
+ *     data with a format of WMQ::MQFMT_STRING is converted to the supplied CCSID,
+ *     the :coded_char_set_id describing the data is updated to match.
+ *   * Supported values: 37, 500, 1047 (EBCDIC), 819 (ISO-8859-1), 1208 (UTF-8)
+ *     Messages in any other CCSID are returned unconverted.
+ *   * E.g. convert: 1208
+ *
+ * * :properties [true|false]
+ *   * When true, message properties are returned in message.properties as a
+ *     WMQ::MessageProperties, instead of in an MQRFH2 header.
+ *     Each property is only retrieved from MQ the first time it is read.
+ *   * The message handle is re-used by every get with :properties, so the properties
+ *     must be read, or message.properties.to_h called, before the next get on this queue.
+ *   * Requires WebSphere MQ V7 or later
+ *      Default: false
+ *
+ * * :backout_requeue [true|false]
+ *   * When true, and the get is under syncpoint (:sync), a message that has already
+ *     been backed out as many times as the backout threshold (BOTHRESH) of the queue
+ *     is not returned. Instead it is put to the backout requeue queue (BOQNAME) of
+ *     the queue, or if there is none, or that put fails, to the dead-letter queue of
+ *     the queue manager with a dead letter header. The next message is then returned.
+ *   * The move is made under the same unit of work as the get, so it is committed or
+ *     backed out with the rest of the unit of work.
+ *   * BOTHRESH and BOQNAME are inquired the first time they are needed after the
+ *     queue is opened. When the queue has no backout threshold, or its attributes
+ *     cannot be inquired, messages are always returned.
+ *   * See :poison_messages in Queue#stats
+ *      Default: false, except in Queue#each with :sync or :commit_every
+ *
  * * :fail_if_quiescing [true|false]
  *   * Determines whether the WMQ::Queue#get call will fail if the queue manager is
  *     in the process of being quiesced.
@@ -659,12 +1065,188 @@ VALUE Queue_close(VALUE self)
  *   end
  */
 VALUE Queue_get(VALUE self, VALUE hash)
+{
+    VALUE  result;
+    PQUEUE pq;
+    Data_Get_Struct(self, QUEUE, pq);
+
+    do                                                /* Messages moved by :backout_requeue are not returned */
+    {
+        pq->poison_moved = 0;
+        result = Queue_call(self, hash, Queue_get_once);
+    }
+    while (pq->poison_moved);
+
+    return result;
+}
+
+/*
+ * Inquire the backout threshold and backout requeue queue of the queue, and the
+ * dead-letter queue of the queue manager, once for each time the queue is opened
+ */
+static void Queue_inquire_backout(VALUE self, PQUEUE pq)
+{
+    MQOD   od = {MQOD_DEFAULT};
+    MQHOBJ hobj;
+    MQLONG selectors[2];
+    MQLONG comp_code;
+    MQLONG reason_code;
+    VALUE  name;
+    PQUEUE_MANAGER pqm;
+
+    Data_Get_Struct(rb_iv_get(self,"@queue_manager"), QUEUE_MANAGER, pqm);
+
+    pq->backout_inquired  = 1;
+    pq->backout_threshold = 0;
+    memset(pq->backout_q_name, ' ', MQ_Q_NAME_LENGTH);
+    memset(pq->dead_letter_q_name, ' ', MQ_Q_NAME_LENGTH);
+
+    name = Queue_name(self);
+    strncpy(od.ObjectName, RSTRING_PTR(name), (size_t)MQ_Q_NAME_LENGTH);
+    pqm->MQOPEN(pq->hcon, &od, MQOO_INQUIRE | MQOO_FAIL_IF_QUIESCING, &hobj, &comp_code, &reason_code);
+    if (comp_code != MQCC_FAILED)
+    {
+        selectors[0] = MQIA_BACKOUT_THRESHOLD;
+        selectors[1] = MQCA_BACKOUT_REQ_Q_NAME;
+        pqm->MQINQ(pq->hcon, hobj, 2, selectors, 1, &pq->backout_threshold,
+                   MQ_Q_NAME_LENGTH, pq->backout_q_name, &comp_code, &reason_code);
+        if (comp_code == MQCC_FAILED)
+        {
+            pq->backout_threshold = 0;
+        }
+        if(pq->trace_level) printf("WMQ::Queue#get() MQINQ of BOTHRESH:%ld, BOQNAME:%.48s ended with reason:%s\n",
+                                   (long)pq->backout_threshold, pq->backout_q_name, wmq_reason(reason_code));
+        pqm->MQCLOSE(pq->hcon, &hobj, MQCO_NONE, &comp_code, &reason_code);
+    }
+    else
+    {
+        if(pq->trace_level) printf("WMQ::Queue#get() MQOPEN to inquire BOTHRESH ended with reason:%s\n", wmq_reason(reason_code));
+    }
+
+    if (pq->backout_threshold > 0)
+    {
+        memset(&od.ObjectName, 0, sizeof(od.ObjectName));
+        od.ObjectType = MQOT_Q_MGR;
+        pqm->MQOPEN(pq->hcon, &od, MQOO_INQUIRE | MQOO_FAIL_IF_QUIESCING, &hobj, &comp_code, &reason_code);
+        if (comp_code != MQCC_FAILED)
+        {
+            selectors[0] = MQCA_DEAD_LETTER_Q_NAME;
+            pqm->MQINQ(pq->hcon, hobj, 1, selectors, 0, 0,
+                       MQ_Q_NAME_LENGTH, pq->dead_letter_q_name, &comp_code, &reason_code);
+            if (comp_code == MQCC_FAILED)
+            {
+                memset(pq->dead_letter_q_name, ' ', MQ_Q_NAME_LENGTH);
+            }
+            if(pq->trace_level) printf("WMQ::Queue#get() MQINQ of DEADQ:%.48s ended with reason:%s\n",
+                                       pq->dead_letter_q_name, wmq_reason(reason_code));
+            pqm->MQCLOSE(pq->hcon, &hobj, MQCO_NONE, &comp_code, &reason_code);
+        }
+    }
+}
+
+/*
+ * Move a message that reached the backout threshold to the backout requeue queue,
+ * or failing that to the dead-letter queue, under the unit of work it was read in.
+ * Returns Non-Zero when the message was moved
+ */
+static int Queue_move_poison(VALUE self, PQUEUE pq, PMQMD pmd, MQLONG messlen, MQLONG properties)
+{
+    MQOD    od  = {MQOD_DEFAULT};
+    MQPMO   pmo = {MQPMO_DEFAULT};
+    MQDLH   dlh = {MQDLH_DEFAULT};
+    MQMD    md;
+    MQLONG  comp_code;
+    MQLONG  reason_code;
+    PMQBYTE p_buffer;
+    VALUE   name;
+    PQUEUE_MANAGER pqm;
+
+    Data_Get_Struct(rb_iv_get(self,"@queue_manager"), QUEUE_MANAGER, pqm);
+
+    if (messlen > pq->buffer_size)                    /* Truncated by MQGMO_ACCEPT_TRUNCATED_MSG */
+    {
+        return 0;
+    }
+
+    pmo.Options = MQPMO_SYNCPOINT | MQPMO_FAIL_IF_QUIESCING;
+    if (pq->open_options & MQOO_SAVE_ALL_CONTEXT)     /* Keep the original context */
+    {
+        pmo.Options |= MQPMO_PASS_ALL_CONTEXT;
+        pmo.Context  = pq->hobj;
+    }
+  #ifdef MQHM_UNUSABLE_HMSG
+    if (properties)                                   /* Keep the properties retrieved into the handle */
+    {
+        pmo.Version           = MQPMO_VERSION_3;
+        pmo.OriginalMsgHandle = pq->get_hmsg;
+    }
+  #endif
+
+    if (pq->backout_q_name[0] != ' ' && pq->backout_q_name[0] != 0)
+    {
+        memcpy(od.ObjectName, pq->backout_q_name, MQ_Q_NAME_LENGTH);
+        memcpy(&md, pmd, sizeof(MQMD));
+        pqm->MQPUT1(pq->hcon, &od, &md, &pmo, messlen, pq->p_buffer, &comp_code, &reason_code);
+        if(pq->trace_level) printf("WMQ::Queue#get() MQPUT1 to backout requeue queue:%.48s ended with reason:%s\n",
+                                   pq->backout_q_name, wmq_reason(reason_code));
+        if (comp_code != MQCC_FAILED)
+        {
+            pq->poison_messages++;
+            return 1;
+        }
+    }
+
+    if (pq->dead_letter_q_name[0] == ' ' || pq->dead_letter_q_name[0] == 0)
+    {
+        return 0;
+    }
+
+    name = Queue_name(self);
+    memcpy(dlh.DestQName, RSTRING_PTR(name), RSTRING_LEN(name) < MQ_Q_NAME_LENGTH ? (size_t)RSTRING_LEN(name) : (size_t)MQ_Q_NAME_LENGTH);
+    dlh.Reason         = WMQ_POISON_REASON;
+    dlh.Encoding       = pmd->Encoding;
+    dlh.CodedCharSetId = pmd->CodedCharSetId;
+    memcpy(dlh.Format, pmd->Format, MQ_FORMAT_LENGTH);
+
+    memcpy(&md, pmd, sizeof(MQMD));
+    md.Encoding       = MQENC_NATIVE;
+    md.CodedCharSetId = MQCCSI_Q_MGR;
+    memcpy(md.Format, MQFMT_DEAD_LETTER_HEADER, MQ_FORMAT_LENGTH);
+
+    p_buffer = ALLOC_N(MQBYTE, sizeof(MQDLH) + messlen);
+    memcpy(p_buffer, &dlh, sizeof(MQDLH));
+    memcpy(p_buffer + sizeof(MQDLH), pq->p_buffer, messlen);
+
+    memcpy(od.ObjectName, pq->dead_letter_q_name, MQ_Q_NAME_LENGTH);
+    pqm->MQPUT1(pq->hcon, &od, &md, &pmo, (MQLONG)sizeof(MQDLH) + messlen, p_buffer, &comp_code, &reason_code);
+    free(p_buffer);
+    if(pq->trace_level) printf("WMQ::Queue#get() MQPUT1 to dead-letter queue:%.48s ended with reason:%s\n",
+                               pq->dead_letter_q_name, wmq_reason(reason_code));
+    if (comp_code == MQCC_FAILED)
+    {
+        return 0;
+    }
+    pq->poison_messages++;
+    return 1;
+}
+
+static VALUE Queue_get_once(VALUE self, VALUE hash)
 {
     VALUE    val;
     VALUE    message;
     PQUEUE   pq;
     MQLONG   flag;
     MQLONG   messlen;                /* message length received       */
+    MQLONG   convert_ccsid = 0;      /* :convert to CCSID, 0 for none  */
+    MQLONG   properties = 0;         /* :properties                   */
+    MQLONG   backout_requeue = 0;    /* :backout_requeue              */
+    struct Queue_mq_arg mq_arg;
+  #ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+    VALUE    scheduler = Qnil;       /* Fiber scheduler to wait with  */
+    MQLONG   remaining = 0;          /* Wait remaining in milliseconds */
+    MQLONG   poll = WMQ_SCHEDULER_POLL_MIN;
+    MQMD     md_in;                  /* Descriptor to retry with      */
+  #endif
 
     MQMD     md = {MQMD_DEFAULT};    /* Message Descriptor            */
     MQGMO   gmo = {MQGMO_DEFAULT};   /* get message options           */
@@ -705,10 +1287,63 @@ VALUE Queue_get(VALUE self, VALUE hash)
     {
         gmo.Options |= MQGMO_FAIL_IF_QUIESCING;
     }
+    pq->syncpoint = (gmo.Options & (MQGMO_SYNCPOINT | MQGMO_SYNCPOINT_IF_PERSISTENT)) != 0;
+
+    IF_TRUE(backout_requeue, 0)                       /* :backout_requeue defaults to false */
+    {
+        backout_requeue = (gmo.Options & MQGMO_SYNCPOINT) && !(gmo.Options & (MQGMO_BROWSE_FIRST | MQGMO_BROWSE_NEXT));
+    }
+
+    val = rb_hash_aref(hash, ID2SYM(ID_convert));    /* :convert */
+    if (FIXNUM_P(val))                                /* Convert locally to the supplied CCSID */
+    {
+        convert_ccsid = NUM2LONG(val);
+        if (!wmq_convert_supported(convert_ccsid))
+        {
+            rb_raise(rb_eArgError, ":convert CCSID %ld is not supported. Supported values are 37, 500, 1047, 819 and 1208", (long)convert_ccsid);
+        }
+    }
+    else
+    {
+        IF_TRUE(convert, 0)                           /* :convert defaults to false */
+        {
+            gmo.Options |= MQGMO_CONVERT;
+        }
+    }
 
-    IF_TRUE(convert, 0)                               /* :convert defaults to false */
+    IF_TRUE(properties, 0)                            /* :properties defaults to false */
     {
-        gmo.Options |= MQGMO_CONVERT;
+  #ifdef MQHM_UNUSABLE_HMSG
+        if (pq->get_hmsg == MQHM_NONE)                /* Create message handle on first use */
+        {
+            MQCMHO cmho = {MQCMHO_DEFAULT};
+
+            pq->MQCRTMH(pq->hcon, &cmho, &pq->get_hmsg, &pq->comp_code, &pq->reason_code);
+            if(pq->trace_level) printf("WMQ::Queue#get() MQCRTMH ended with reason:%s\n", wmq_reason(pq->reason_code));
+
+            if (pq->comp_code == MQCC_FAILED)
+            {
+                pq->get_hmsg = MQHM_NONE;
+                if (pq->exception_on_error)
+                {
+                    VALUE name = Queue_name(self);
+
+                    rb_raise(wmq_exception,
+                             "WMQ::Queue#get(). Error creating message handle for Queue:%s, reason:%s",
+                             RSTRING_PTR(name),
+                             wmq_reason(pq->reason_code));
+                }
+                return Qfalse;
+            }
+        }
+        properties = 1;
+        pq->get_generation++;                         /* Properties of the previous message are replaced */
+        gmo.Version   = MQGMO_VERSION_4;
+        gmo.MsgHandle = pq->get_hmsg;
+        gmo.Options  |= MQGMO_PROPERTIES_IN_HANDLE;
+  #else
+        rb_raise(rb_eNotImpError, ":properties requires WebSphere MQ V7 or later");
+  #endif
     }
 
     val = rb_hash_aref(hash, ID2SYM(ID_wait));       /* :wait */
@@ -729,49 +1364,114 @@ VALUE Queue_get(VALUE self, VALUE hash)
      md.CodedCharSetId = MQCCSI_Q_MGR;
     */
 
+  #ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
     /*
-     * Auto-Grow buffer size
-     *
-     * Note: If msg size is 70,000, we grow to 70,000, but then another program gets that
-     *       message. The next message could be say 80,000 bytes in size, we need to
-     *       grow the buffer again.
+     * A long MQGMO_WAIT would block every other fiber on this thread,
+     * so poll MQ without waiting and let the scheduler run other fibers in between
      */
-    do
-    {
-        pq->MQGET(
-              pq->hcon,            /* connection handle                 */
-              pq->hobj,            /* object handle                     */
-              &md,                 /* message descriptor                */
-              &gmo,                /* get message options               */
-              pq->buffer_size,     /* message buffer size               */
-              pq->p_buffer,        /* message buffer                    */
-              &messlen,            /* message length                    */
-              &pq->comp_code,      /* completion code                   */
-              &pq->reason_code);   /* reason code                       */
-
-        /* report reason, if any     */
-        if (pq->reason_code != MQRC_NONE)
-        {
-            if(pq->trace_level>1) printf("WMQ::Queue#get() Growing buffer size from %ld to %ld\n", (long)pq->buffer_size, (long)messlen);
-            /* TODO: Add support for autogrow buffer here */
-            if (pq->reason_code == MQRC_TRUNCATED_MSG_FAILED)
-            {
-                if(pq->trace_level>2)
-                    printf ("WMQ::Queue#reallocate Resizing buffer from %ld to %ld bytes\n", (long)pq->buffer_size, (long)messlen);
+    if ((gmo.Options & MQGMO_WAIT) && gmo.WaitInterval != 0)
+    {
+        scheduler = rb_fiber_scheduler_current();
+        if (!NIL_P(scheduler))
+        {
+            if(pq->trace_level>1) printf("WMQ::Queue#get() Waiting with the fiber scheduler for %ld ms\n", (long)gmo.WaitInterval);
+            remaining = gmo.WaitInterval;
+            gmo.WaitInterval = 0;
+            memcpy(&md_in, &md, sizeof(MQMD));
+        }
+    }
 
-                free(pq->p_buffer);
-                pq->buffer_size = messlen;
-                pq->p_buffer = ALLOC_N(unsigned char, messlen);
+    for (;;)
+    {
+  #endif
+
+        /*
+         * Auto-Grow buffer size
+         *
+         * Note: If msg size is 70,000, we grow to 70,000, but then another program gets that
+         *       message. The next message could be say 80,000 bytes in size, we need to
+         *       grow the buffer again.
+         */
+        do
+        {
+            mq_arg.pq        = pq;
+            mq_arg.pmd       = &md;                   /* message descriptor                */
+            mq_arg.p_options = &gmo;                  /* get message options               */
+            mq_arg.length    = pq->buffer_size;       /* message buffer size               */
+            mq_arg.p_buffer  = pq->p_buffer;          /* message buffer                    */
+            mq_arg.p_messlen = &messlen;              /* message length                    */
+            WMQ_CALL_WITHOUT_GVL(pq->release_gvl, Queue_mqget, &mq_arg)
+
+            /* report reason, if any     */
+            if (pq->reason_code != MQRC_NONE)
+            {
+                if(pq->trace_level>1) printf("WMQ::Queue#get() Growing buffer size from %ld to %ld\n", (long)pq->buffer_size, (long)messlen);
+                /* TODO: Add support for autogrow buffer here */
+                if (pq->reason_code == MQRC_TRUNCATED_MSG_FAILED)
+                {
+                    if(pq->trace_level>2)
+                        printf ("WMQ::Queue#reallocate Resizing buffer from %ld to %ld bytes\n", (long)pq->buffer_size, (long)messlen);
+
+                    free(pq->p_buffer);
+                    pq->buffer_size = messlen;
+                    pq->p_buffer = ALLOC_N(unsigned char, messlen);
+                    pq->get_buffer_resizes++;
+                }
             }
         }
+        while (pq->reason_code == MQRC_TRUNCATED_MSG_FAILED);
+
+  #ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+        if (NIL_P(scheduler) || pq->reason_code != MQRC_NO_MSG_AVAILABLE || remaining == 0)
+        {
+            break;
+        }
+        if (remaining != MQWI_UNLIMITED && poll > remaining)
+        {
+            poll = remaining;
+        }
+        rb_fiber_scheduler_kernel_sleep(scheduler, rb_float_new(poll / 1000.0));
+        if (remaining != MQWI_UNLIMITED)
+        {
+            remaining -= poll;
+        }
+        if (poll < WMQ_SCHEDULER_POLL_MAX)
+        {
+            poll *= 2;
+            if (poll > WMQ_SCHEDULER_POLL_MAX) poll = WMQ_SCHEDULER_POLL_MAX;
+        }
+        memcpy(&md, &md_in, sizeof(MQMD));
     }
-    while (pq->reason_code == MQRC_TRUNCATED_MSG_FAILED);
+  #endif
 
     if(pq->trace_level) printf("WMQ::Queue#get() MQGET ended with reason:%s\n", wmq_reason(pq->reason_code));
 
     if (pq->comp_code != MQCC_FAILED)
     {
-        Message_deblock(message, &md, pq->p_buffer, messlen, pq->trace_level);  /* Extract MQMD and any other known MQ headers */
+        if (backout_requeue && md.BackoutCount > 0)
+        {
+            if (!pq->backout_inquired)
+            {
+                Queue_inquire_backout(self, pq);
+            }
+            if (pq->backout_threshold > 0 && md.BackoutCount >= pq->backout_threshold &&
+                Queue_move_poison(self, pq, &md, messlen, properties))
+            {
+                pq->poison_moved = 1;                 /* Queue#get gets the next message */
+                return Qtrue;
+            }
+        }
+        if (gmo.Options & (MQGMO_BROWSE_FIRST | MQGMO_BROWSE_NEXT))  /* Restored by reconnect */
+        {
+            memcpy(pq->browse_msg_id, md.MsgId, sizeof(MQBYTE24));
+            pq->browse_positioned = 1;
+        }
+        if (messlen > pq->buffer_size)                /* Truncated by MQGMO_ACCEPT_TRUNCATED_MSG */
+        {
+            messlen = pq->buffer_size;
+        }
+        Message_deblock(message, &md, pq->p_buffer, messlen, convert_ccsid, pq->trace_level);  /* Extract MQMD and any other known MQ headers */
+        rb_iv_set(message, "@properties", properties ? MessageProperties_new(self, pq) : Qnil);
         return Qtrue;
     }
     else
@@ -794,22 +1494,233 @@ VALUE Queue_get(VALUE self, VALUE hash)
     }
 }
 
+#ifdef MQHM_UNUSABLE_HMSG
 /*
- * call-seq:
- *   put(...)
- *
- * Put a message to the WebSphere MQ queue
+ * Delete a message handle created for a put, ignoring errors
+ */
+static void Queue_delete_hmsg(PQUEUE pq, PMQHMSG phmsg)
+{
+    MQDMHO dmho = {MQDMHO_DEFAULT};
+    MQLONG comp_code;
+    MQLONG reason_code;
+
+    if (*phmsg != MQHM_NONE)
+    {
+        pq->MQDLTMH(pq->hcon, phmsg, &dmho, &comp_code, &reason_code);
+        *phmsg = MQHM_NONE;
+    }
+}
+
+struct Queue_put_property_arg {
+    PQUEUE pq;
+    MQHMSG hmsg;
+};
+
+static int Queue_put_property(VALUE key, VALUE value, VALUE arg)
+{
+    struct Queue_put_property_arg* parg = (struct Queue_put_property_arg*)arg;
+    PQUEUE    pq      = parg->pq;
+    MQSMPO    smpo    = {MQSMPO_DEFAULT};
+    MQPD      pd      = {MQPD_DEFAULT};
+    MQCHARV   name    = {MQCHARV_DEFAULT};
+    MQLONG    type;
+    MQLONG    length  = 0;
+    PMQVOID   p_value = 0;
+    MQBOOL    boolean;
+    MQINT64   integer;
+    MQFLOAT64 real;
+
+    if (SYMBOL_P(key))
+    {
+        key = rb_sym2str(key);
+    }
+    key = StringValue(key);
+    name.VSPtr    = RSTRING_PTR(key);
+    name.VSLength = (MQLONG)RSTRING_LEN(key);
+
+    switch (TYPE(value))
+    {
+        case T_NIL:
+            type    = MQTYPE_NULL;
+            break;
+        case T_TRUE:
+        case T_FALSE:
+            boolean = (value == Qtrue);
+            type    = MQTYPE_BOOLEAN;
+            p_value = &boolean;
+            length  = sizeof(boolean);
+            break;
+        case T_FIXNUM:
+        case T_BIGNUM:
+            integer = NUM2LL(value);
+            type    = MQTYPE_INT64;
+            p_value = &integer;
+            length  = sizeof(integer);
+            break;
+        case T_FLOAT:
+            real    = NUM2DBL(value);
+            type    = MQTYPE_FLOAT64;
+            p_value = &real;
+            length  = sizeof(real);
+            break;
+        case T_SYMBOL:
+            value   = rb_sym2str(value);
+            /* Fall through */
+        case T_STRING:
+            type    = MQTYPE_STRING;
+            p_value = RSTRING_PTR(value);
+            length  = (MQLONG)RSTRING_LEN(value);
+            break;
+        default:
+            rb_raise(rb_eTypeError, "WMQ::Queue#put Unsupported type %s for message property %s",
+                     rb_obj_classname(value), RSTRING_PTR(key));
+    }
+
+    pq->MQSETMP(pq->hcon, parg->hmsg, &smpo, &name, &pd, type, length, p_value, &pq->comp_code, &pq->reason_code);
+
+    if(pq->trace_level>1) printf("WMQ::Queue#put() MQSETMP %s ended with reason:%s\n", RSTRING_PTR(key), wmq_reason(pq->reason_code));
+
+    return (pq->comp_code == MQCC_FAILED) ? ST_STOP : ST_CONTINUE;
+}
+
+static VALUE Queue_put_property_each(VALUE arg)
+{
+    VALUE* args = (VALUE*)arg;
+    rb_hash_foreach(args[0], Queue_put_property, args[1]);
+    return Qnil;
+}
+#endif
+
+/*
+ * Set the message properties from :properties, or the properties of :message,
+ * on a new message handle in ppmo->OriginalMsgHandle
  *
- * Parameters:
- * * A Hash consisting of one or more of the named parameters
- * * Summary of parameters and their WebSphere MQ equivalents
- *  queue.put(                                          # WebSphere MQ Equivalents:
- *    message:           my_message,                    # n/a : Instance of Message
- *    data:              'Hello World',                 # n/a : Data to send
+ * Returns 0 when MQ failed, with the reason in pq->reason_code
+ */
+static int Queue_put_properties(PQUEUE pq, VALUE hash, PMQPMO ppmo)
+{
+    VALUE properties = rb_hash_aref(hash, ID2SYM(ID_properties));
+
+    if (NIL_P(properties))
+    {
+        VALUE message = rb_hash_aref(hash, ID2SYM(ID_message));
+        if (!NIL_P(message))
+        {
+            properties = rb_funcall(message, ID_properties, 0);
+        }
+    }
+    if (NIL_P(properties))
+    {
+        return 1;
+    }
+
+  #ifdef MQHM_UNUSABLE_HMSG
+    if (rb_obj_is_kind_of(properties, wmq_message_properties))
+    {
+        properties = MessageProperties_to_h(properties);
+    }
+    Check_Type(properties, T_HASH);
+    if (RHASH_SIZE(properties) == 0)
+    {
+        return 1;
+    }
+
+    {
+        MQCMHO cmho = {MQCMHO_DEFAULT};
+        struct Queue_put_property_arg arg;
+        VALUE  args[2];
+        int    state = 0;
+
+        arg.pq   = pq;
+        arg.hmsg = MQHM_NONE;
+        pq->MQCRTMH(pq->hcon, &cmho, &arg.hmsg, &pq->comp_code, &pq->reason_code);
+        if(pq->trace_level) printf("WMQ::Queue#put() MQCRTMH ended with reason:%s\n", wmq_reason(pq->reason_code));
+        if (pq->comp_code == MQCC_FAILED)
+        {
+            return 0;
+        }
+
+        args[0] = properties;
+        args[1] = (VALUE)&arg;
+        rb_protect(Queue_put_property_each, (VALUE)args, &state);
+        if (state || pq->comp_code == MQCC_FAILED)
+        {
+            Queue_delete_hmsg(pq, &arg.hmsg);
+            if (state)
+            {
+                rb_jump_tag(state);
+            }
+            return 0;
+        }
+
+        ppmo->Version           = MQPMO_VERSION_3;
+        ppmo->OriginalMsgHandle = arg.hmsg;
+    }
+    return 1;
+  #else
+    rb_raise(rb_eNotImpError, ":properties requires WebSphere MQ V7 or later");
+    return 0;
+  #endif
+}
+
+/*
+ * Set the message properties for QueueManager#put, as for Queue#put, on a new
+ * message handle in ppmo->OriginalMsgHandle
+ *
+ * The handle must be deleted with Queue_manager_delete_hmsg after MQPUT1
+ * Returns 0 when MQ failed, with the reason in pqm->reason_code
+ */
+int Queue_manager_put_properties(PQUEUE_MANAGER pqm, VALUE hash, PMQPMO ppmo)
+{
+    QUEUE  q;
+    int    result;
+
+    memset(&q, 0, sizeof(q));
+    q.hcon        = pqm->hcon;
+    q.trace_level = pqm->trace_level;
+  #ifdef MQHM_UNUSABLE_HMSG
+    q.MQCRTMH     = pqm->MQCRTMH;
+    q.MQDLTMH     = pqm->MQDLTMH;
+    q.MQSETMP     = pqm->MQSETMP;
+  #endif
+    result = Queue_put_properties(&q, hash, ppmo);
+    pqm->comp_code   = q.comp_code;
+    pqm->reason_code = q.reason_code;
+    return result;
+}
+
+void Queue_manager_delete_hmsg(PQUEUE_MANAGER pqm, PMQPMO ppmo)
+{
+  #ifdef MQHM_UNUSABLE_HMSG
+    MQDMHO dmho = {MQDMHO_DEFAULT};
+    MQLONG comp_code;
+    MQLONG reason_code;
+
+    if (ppmo->Version >= MQPMO_VERSION_3 && ppmo->OriginalMsgHandle != MQHM_NONE)
+    {
+        pqm->MQDLTMH(pqm->hcon, &ppmo->OriginalMsgHandle, &dmho, &comp_code, &reason_code);
+        ppmo->OriginalMsgHandle = MQHM_NONE;
+    }
+  #endif
+}
+
+/*
+ * call-seq:
+ *   put(...)
+ *
+ * Put a message to the WebSphere MQ queue
+ *
+ * Parameters:
+ * * A Hash consisting of one or more of the named parameters
+ * * Summary of parameters and their WebSphere MQ equivalents
+ *  queue.put(                                          # WebSphere MQ Equivalents:
+ *    message:           my_message,                    # n/a : Instance of Message
+ *    data:              'Hello World',                 # n/a : Data to send
  *    sync:              false,                         # MQGMO_SYNCPOINT
  *    new_id:            true,                          # MQPMO_NEW_MSG_ID & MQPMO_NEW_CORREL_ID
  *    new_msg_id:        true,                          # MQPMO_NEW_MSG_ID
  *    new_correl_id:     true,                          # MQPMO_NEW_CORREL_ID
+ *    properties:        {'Name' => 'Value'},           # MQSETMP
  *    fail_if_quiescing: true,                          # MQOO_FAIL_IF_QUIESCING
  *    options:           WMQ::MQPMO_FAIL_IF_QUIESCING   # MQPMO_*
  *  )
@@ -852,6 +1763,14 @@ VALUE Queue_get(VALUE self, VALUE hash)
  *   * Generate a new correlation id for this message
  *      Default: false
  *
+ * * :properties => Hash
+ *   * Message properties to set on the message, by name. Values can be
+ *     String, Symbol, Integer, Float, true, false or nil
+ *   * Takes precedence over the properties in :message, which can also be the
+ *     WMQ::MessageProperties of a received message
+ *   * Requires WebSphere MQ V7 or later
+ *      Default: message.properties
+ *
  * * :fail_if_quiescing => true or false
  *   * Determines whether the WMQ::Queue#put call will fail if the queue manager is
  *     in the process of being quiesced.
@@ -923,12 +1842,18 @@ VALUE Queue_get(VALUE self, VALUE hash)
  *   end
  */
 VALUE Queue_put(VALUE self, VALUE hash)
+{
+    return Queue_call(self, hash, Queue_put_once);
+}
+
+static VALUE Queue_put_once(VALUE self, VALUE hash)
 {
     MQPMO    pmo = {MQPMO_DEFAULT};  /* put message options           */
     MQMD     md = {MQMD_DEFAULT};    /* Message Descriptor            */
     PQUEUE   pq;
     MQLONG   BufferLength = 0;       /* Length of the message in Buffer */
     PMQVOID  pBuffer = 0;            /* Message data                  */
+    struct Queue_mq_arg mq_arg;
 
     md.Version = MQMD_CURRENT_VERSION;   /* Allow Group Options       */
 
@@ -943,22 +1868,27 @@ VALUE Queue_put(VALUE self, VALUE hash)
     }
 
     Queue_extract_put_message_options(hash, &pmo);
+    pq->syncpoint = (pmo.Options & MQPMO_SYNCPOINT) != 0;
     Message_build(&pq->p_buffer,  &pq->buffer_size, pq->trace_level,
-                  hash, &pBuffer, &BufferLength,    &md);
+                  hash, &pBuffer, &BufferLength,    &md, &pq->build_stats);
 
     if(pq->trace_level) printf("WMQ::Queue#put() Queue Handle:%ld, Queue Manager Handle:%ld\n", (long)pq->hobj, (long)pq->hcon);
 
-    pq->MQPUT(
-          pq->hcon,            /* connection handle               */
-          pq->hobj,            /* object handle                   */
-          &md,                 /* message descriptor              */
-          &pmo,                /* put message options             */
-          BufferLength,        /* message length                  */
-          pBuffer,             /* message buffer                  */
-          &pq->comp_code,      /* completion code                 */
-          &pq->reason_code);   /* reason code                     */
-
-    if(pq->trace_level) printf("WMQ::Queue#put() MQPUT ended with reason:%s\n", wmq_reason(pq->reason_code));
+    if (Queue_put_properties(pq, hash, &pmo))
+    {
+        mq_arg.pq        = pq;
+        mq_arg.pmd       = &md;                       /* message descriptor              */
+        mq_arg.p_options = &pmo;                      /* put message options             */
+        mq_arg.length    = BufferLength;              /* message length                  */
+        mq_arg.p_buffer  = pBuffer;                   /* message buffer                  */
+        mq_arg.p_messlen = 0;
+        WMQ_CALL_WITHOUT_GVL(pq->release_gvl, Queue_mqput, &mq_arg)
+
+        if(pq->trace_level) printf("WMQ::Queue#put() MQPUT ended with reason:%s\n", wmq_reason(pq->reason_code));
+    }
+  #ifdef MQHM_UNUSABLE_HMSG
+    Queue_delete_hmsg(pq, &pmo.OriginalMsgHandle);
+  #endif
 
     if (pq->reason_code != MQRC_NONE)
     {
@@ -986,6 +1916,56 @@ VALUE Queue_put(VALUE self, VALUE hash)
     return Qtrue;
 }
 
+/*
+ * Returns a Hash of counters for this queue => Hash
+ *
+ * * :buffer_size
+ *   * Current size of the message buffer, which is re-used by every put and get
+ * * :builds
+ *   * Number of messages put with headers
+ * * :buffer_resizes
+ *   * Number of times the buffer was grown before building a message with headers.
+ *     The size of the headers and data is calculated first, so the buffer is grown once
+ *     to the exact size required
+ * * :build_reallocations
+ *   * Number of times the buffer was grown while building a message. Should always be 0
+ * * :get_buffer_resizes
+ *   * Number of times the buffer was grown to receive a message that did not fit
+ * * :commits, :committed_messages, :max_commit_size
+ *   * Number of units of work committed by Queue#each with :commit_every or
+ *     :commit_interval_ms, the total number of messages in them, and the most
+ *     messages in any one of them
+ * * :backouts
+ *   * Number of those units of work backed out, since the block raised an exception
+ * * :poison_messages
+ *   * Number of messages moved to the backout requeue or dead-letter queue by
+ *     Queue#get or Queue#each with :backout_requeue
+ *
+ * Example:
+ *   queue.stats
+ *   # => {buffer_size: 16384, builds: 10, buffer_resizes: 0, build_reallocations: 0, get_buffer_resizes: 0,
+ *   #     commits: 0, committed_messages: 0, max_commit_size: 0, backouts: 0, poison_messages: 0}
+ */
+VALUE Queue_stats(VALUE self)
+{
+    PQUEUE pq;
+    VALUE  hash = rb_hash_new();
+
+    Data_Get_Struct(self, QUEUE, pq);
+
+    rb_hash_aset(hash, ID2SYM(rb_intern("buffer_size")),         LONG2NUM(pq->buffer_size));
+    rb_hash_aset(hash, ID2SYM(rb_intern("builds")),              LONG2NUM(pq->build_stats.builds));
+    rb_hash_aset(hash, ID2SYM(rb_intern("buffer_resizes")),      LONG2NUM(pq->build_stats.buffer_resizes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("build_reallocations")), LONG2NUM(pq->build_stats.build_reallocations));
+    rb_hash_aset(hash, ID2SYM(rb_intern("get_buffer_resizes")),  LONG2NUM(pq->get_buffer_resizes));
+    rb_hash_aset(hash, ID2SYM(rb_intern("commits")),             LONG2NUM(pq->commits));
+    rb_hash_aset(hash, ID2SYM(rb_intern("committed_messages")),  LONG2NUM(pq->committed_messages));
+    rb_hash_aset(hash, ID2SYM(rb_intern("max_commit_size")),     LONG2NUM(pq->max_commit_size));
+    rb_hash_aset(hash, ID2SYM(rb_intern("backouts")),            LONG2NUM(pq->backouts));
+    rb_hash_aset(hash, ID2SYM(rb_intern("poison_messages")),     LONG2NUM(pq->poison_messages));
+    return hash;
+}
+
 /*
  * Returns the queue name => String
  */
@@ -1037,6 +2017,7 @@ static VALUE Queue_singleton_open_ensure(VALUE queue)
  *    open_options:          WMQ::MQOO_BIND_ON_OPEN | ...   # MQOO_*
  *    close_options:         WMQ::MQCO_DELETE_PURGE         # MQCO_*
  *    dynamic_q_name:        'Name of Dynamic Queue'        # MQOD.DynamicQName
+ *    selector:              "Region = 'EU'",               # MQOD.SelectionString
  *    alternate_user_id:     'userid',                      # MQOD.AlternateUserId
  *    alternate_security_id: ''                             # MQOD.AlternateSecurityId
  *  )
@@ -1159,6 +2140,13 @@ static VALUE Queue_singleton_open_ensure(VALUE queue)
  *     * In this way it is not necessary to create the queues before running the program.
  *      Default: true
  *
+ * * :selector [String]
+ *   * Message selector, so that the queue manager only returns messages whose
+ *     properties match. Applies to every get, each and browse on the opened queue.
+ *   * E.g. "Region = 'EU' AND Priority > 5"
+ *   * Requires WebSphere MQ V7 or later
+ *   * See WebSphere MQ Application Programming Reference: MQOD.SelectionString
+ *
  * * :alternate_user_id [String]
  *   * Sets the alternate userid to use when messages are put to the queue
  *   * Note: It is not necessary to supply WMQ::MQOO_ALTERNATE_USER_AUTHORITY
@@ -1214,9 +2202,817 @@ VALUE Queue_singleton_open(int argc, VALUE *argv, VALUE self)
     return queue;
 }
 
+#ifdef WMQ_PREFETCH
+/* --------------------------------------------------
+ * Queue#each(prefetch: n)
+ *
+ * A native thread, with its own connection and queue
+ * handle, gets messages ahead of the Ruby thread into
+ * a bounded ring buffer, so that MQ round trips overlap
+ * with processing by the Ruby block.
+ *
+ * Destructive gets are made under syncpoint on the
+ * prefetch connection. A message is consumed once it has
+ * been passed to the block, and the unit of work is only
+ * committed once every message in it has been consumed.
+ * Messages still in the ring buffer when each stops are
+ * backed out, and therefore remain on the queue.
+ * --------------------------------------------------*/
+ typedef struct tagPREFETCH_MESSAGE PREFETCH_MESSAGE;
+ typedef PREFETCH_MESSAGE MQPOINTER PPREFETCH_MESSAGE;
+
+ struct tagPREFETCH_MESSAGE {
+    MQMD     md;                      /* Message descriptor            */
+    MQLONG   length;                  /* Length of data                */
+    MQBYTE   data[1];                 /* Message data, headers included */
+ };
+
+ typedef struct tagPREFETCH PREFETCH;
+ typedef PREFETCH MQPOINTER PPREFETCH;
+
+ struct tagPREFETCH {
+    PQUEUE_MANAGER pqm;               /* MQ library and connection options */
+    MQCHAR   q_mgr_name[MQ_Q_MGR_NAME_LENGTH+1];
+    MQOD     od;                      /* Queue to open                 */
+    char*    selector;                /* Copy of the selection string  */
+    MQLONG   open_options;            /* MQOPEN options                */
+    MQMD     md;                      /* Descriptor to match against   */
+    MQGMO    gmo;                     /* Get message options, without the wait */
+    MQLONG   wait;                    /* :wait in milli-seconds, 0 for none */
+    MQLONG   browse;                  /* Non-Zero to browse instead of get under syncpoint */
+    MQLONG   buffer_size;             /* Initial size of the get buffer */
+    MQLONG   trace_level;             /* Trace level. 0==None, 1==Info 2==Debug ..*/
+    PPREFETCH_MESSAGE* ring;          /* Bounded ring buffer of messages not yet consumed */
+    long     capacity;                /* Size of the ring buffer, and of a unit of work */
+    long     head;                    /* Next message to consume       */
+    long     count;                   /* Messages in the ring buffer   */
+    MQBYTE24* msg_ids;                /* Message ids in the current unit of work */
+    long     fetched;                 /* Messages in the current unit of work */
+    long     consumed;                /* ... of which have been passed to the block */
+    PPREFETCH_MESSAGE current;        /* Message being processed by the block */
+    int      done;                    /* Thread has finished, no more messages will be added */
+    int      stopping;                /* Ruby has stopped consuming    */
+    int      interrupted;             /* Ruby thread was interrupted while waiting */
+    MQLONG   comp_code;               /* Result of the last MQ call by the thread */
+    MQLONG   reason_code;
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  not_empty;        /* Signalled by the thread       */
+    pthread_cond_t  not_full;         /* Signalled by Ruby             */
+ };
+
+/*
+ * Called on the prefetch thread once every message fetched under syncpoint
+ * has been consumed, or when stopping.
+ * Commits the consumed messages and backs out the rest.
+ *
+ * MQ can only back out a whole unit of work, so when only some of the messages were
+ * consumed, all of them are backed out and the consumed ones removed again by message id.
+ * Between the two, another consumer of the queue can get a consumed message again.
+ */
+static void Queue_prefetch_complete(PPREFETCH pf, MQHCONN hcon, MQHOBJ hobj, long consumed, PMQLONG pcomp_code, PMQLONG preason_code)
+{
+    PQUEUE_MANAGER pqm = pf->pqm;
+    long   i;
+
+    if (consumed == pf->fetched)
+    {
+        pqm->MQCMIT(hcon, pcomp_code, preason_code);
+        if(pf->trace_level>1) printf("WMQ::Queue#each() Prefetch MQCMIT of %ld messages ended with reason:%s\n", consumed, wmq_reason(*preason_code));
+    }
+    else
+    {
+        pqm->MQBACK(hcon, pcomp_code, preason_code);
+        if(pf->trace_level>1) printf("WMQ::Queue#each() Prefetch MQBACK of %ld messages ended with reason:%s\n", pf->fetched, wmq_reason(*preason_code));
+
+        for (i = 0; i < consumed && *pcomp_code != MQCC_FAILED; i++)
+        {
+            MQMD   md  = {MQMD_DEFAULT};
+            MQGMO  gmo = {MQGMO_DEFAULT};
+            MQLONG messlen;
+            MQLONG comp_code;
+            MQLONG reason_code;
+
+            md.Version       = MQMD_CURRENT_VERSION;
+            gmo.Version      = MQGMO_CURRENT_VERSION;
+            gmo.Options      = MQGMO_NO_SYNCPOINT | MQGMO_ACCEPT_TRUNCATED_MSG;
+            gmo.MatchOptions = MQMO_MATCH_MSG_ID;
+            memcpy(md.MsgId, pf->msg_ids[i], sizeof(MQBYTE24));
+            pqm->MQGET(hcon, hobj, &md, &gmo, 0, 0, &messlen, &comp_code, &reason_code);
+        }
+    }
+
+    pthread_mutex_lock(&pf->mutex);
+    pf->fetched  = 0;
+    pf->consumed = 0;
+    pthread_mutex_unlock(&pf->mutex);
+}
+
+/*
+ * Runs on the prefetch thread, without the GVL. Must not call Ruby.
+ */
+static void* Queue_prefetch_thread(void* p)
+{
+    PPREFETCH      pf  = (PPREFETCH)p;
+    PQUEUE_MANAGER pqm = pf->pqm;
+    MQCNO    cno;
+    MQHCONN  hcon = 0;
+    MQHOBJ   hobj = 0;
+    MQLONG   comp_code;
+    MQLONG   reason_code;
+    MQLONG   cleanup_comp_code;
+    MQLONG   cleanup_reason_code;
+    MQLONG   remaining   = pf->wait;
+    MQLONG   buffer_size = pf->buffer_size;
+    PMQBYTE  p_buffer    = (PMQBYTE)malloc((size_t)buffer_size);
+    MQLONG   messlen;
+    MQMD     md;
+    MQGMO    gmo;
+    long     consumed;
+    int      stopping;
+    PPREFETCH_MESSAGE node;
+
+    memcpy(&cno, &pqm->connect_options, sizeof(MQCNO));
+    pqm->MQCONNX(pf->q_mgr_name, &cno, &hcon, &comp_code, &reason_code);
+    if(pf->trace_level) printf("WMQ::Queue#each() Prefetch MQCONNX completed with reason:%s, Handle:%ld\n", wmq_reason(reason_code), (long)hcon);
+    if (comp_code == MQCC_FAILED)
+    {
+        hcon = 0;
+    }
+    else
+    {
+        pqm->MQOPEN(hcon, &pf->od, pf->open_options, &hobj, &comp_code, &reason_code);
+        if(pf->trace_level) printf("WMQ::Queue#each() Prefetch MQOPEN completed with reason:%s, Handle:%ld\n", wmq_reason(reason_code), (long)hobj);
+        if (comp_code == MQCC_FAILED) hobj = 0;
+    }
+    if (!p_buffer)
+    {
+        comp_code   = MQCC_FAILED;
+        reason_code = MQRC_STORAGE_NOT_AVAILABLE;
+    }
+
+    while (comp_code != MQCC_FAILED)
+    {
+        /* Wait for space in the ring buffer, and for a full unit of work to be consumed */
+        pthread_mutex_lock(&pf->mutex);
+        while (!pf->stopping &&
+               (pf->count == pf->capacity || (pf->fetched == pf->capacity && pf->consumed < pf->fetched)))
+        {
+            pthread_cond_wait(&pf->not_full, &pf->mutex);
+        }
+        stopping = pf->stopping;
+        consumed = pf->consumed;
+        pthread_mutex_unlock(&pf->mutex);
+        if (stopping)
+        {
+            break;
+        }
+        if (pf->fetched == pf->capacity)
+        {
+            Queue_prefetch_complete(pf, hcon, hobj, consumed, &comp_code, &reason_code);
+            if (comp_code == MQCC_FAILED) break;
+        }
+
+        memcpy(&md, &pf->md, sizeof(MQMD));
+        memcpy(&gmo, &pf->gmo, sizeof(MQGMO));
+        if (remaining && !pf->fetched)                /* Only wait once the unit of work is committed */
+        {
+            gmo.Options     |= MQGMO_WAIT;
+            gmo.WaitInterval = (remaining == MQWI_UNLIMITED || remaining > WMQ_PREFETCH_WAIT_MAX) ? WMQ_PREFETCH_WAIT_MAX : remaining;
+        }
+
+        do
+        {
+            pqm->MQGET(hcon, hobj, &md, &gmo, buffer_size, p_buffer, &messlen, &comp_code, &reason_code);
+            if (reason_code == MQRC_TRUNCATED_MSG_FAILED)
+            {
+                free(p_buffer);
+                buffer_size = messlen;
+                p_buffer    = (PMQBYTE)malloc((size_t)buffer_size);
+                if (!p_buffer)
+                {
+                    comp_code   = MQCC_FAILED;
+                    reason_code = MQRC_STORAGE_NOT_AVAILABLE;
+                }
+            }
+        }
+        while (reason_code == MQRC_TRUNCATED_MSG_FAILED);
+
+        if(pf->trace_level>1) printf("WMQ::Queue#each() Prefetch MQGET ended with reason:%s\n", wmq_reason(reason_code));
+
+        if (reason_code == MQRC_NO_MSG_AVAILABLE)
+        {
+            if (pf->fetched)                          /* Commit before waiting for more messages */
+            {
+                pthread_mutex_lock(&pf->mutex);
+                while (!pf->stopping && pf->consumed < pf->fetched)
+                {
+                    pthread_cond_wait(&pf->not_full, &pf->mutex);
+                }
+                consumed = pf->consumed;
+                pthread_mutex_unlock(&pf->mutex);
+                Queue_prefetch_complete(pf, hcon, hobj, consumed, &comp_code, &reason_code);
+                if (comp_code == MQCC_FAILED) break;
+                continue;
+            }
+            if (remaining != MQWI_UNLIMITED)
+            {
+                remaining -= (gmo.Options & MQGMO_WAIT) ? gmo.WaitInterval : remaining;
+                if (remaining <= 0)
+                {
+                    comp_code   = MQCC_FAILED;
+                    reason_code = MQRC_NO_MSG_AVAILABLE;
+                    break;
+                }
+            }
+            comp_code = MQCC_OK;
+            continue;
+        }
+        if (comp_code == MQCC_FAILED)
+        {
+            break;
+        }
+
+        if (messlen > buffer_size)                    /* Truncated by MQGMO_ACCEPT_TRUNCATED_MSG */
+        {
+            messlen = buffer_size;
+        }
+        node = (PPREFETCH_MESSAGE)malloc(offsetof(PREFETCH_MESSAGE, data) + (size_t)messlen);
+        if (!node)
+        {
+            comp_code   = MQCC_FAILED;
+            reason_code = MQRC_STORAGE_NOT_AVAILABLE;
+            break;
+        }
+        memcpy(&node->md, &md, sizeof(MQMD));
+        memcpy(node->data, p_buffer, (size_t)messlen);
+        node->length = messlen;
+
+        if (pf->browse)
+        {
+            pf->gmo.Options = (pf->gmo.Options & ~MQGMO_BROWSE_FIRST) | MQGMO_BROWSE_NEXT;
+        }
+        else
+        {
+            memcpy(pf->msg_ids[pf->fetched], md.MsgId, sizeof(MQBYTE24));
+        }
+
+        pthread_mutex_lock(&pf->mutex);
+        pf->ring[(pf->head + pf->count) % pf->capacity] = node;
+        pf->count++;
+        if (!pf->browse) pf->fetched++;
+        pthread_cond_signal(&pf->not_empty);
+        pthread_mutex_unlock(&pf->mutex);
+
+        remaining = pf->wait;                         /* Wait afresh for every message, as Queue#get does */
+    }
+
+    if (hobj)
+    {
+        if (pf->fetched)
+        {
+            pthread_mutex_lock(&pf->mutex);
+            consumed = pf->consumed;
+            pthread_mutex_unlock(&pf->mutex);
+            Queue_prefetch_complete(pf, hcon, hobj, consumed, &cleanup_comp_code, &cleanup_reason_code);
+        }
+        pqm->MQCLOSE(hcon, &hobj, MQCO_NONE, &cleanup_comp_code, &cleanup_reason_code);
+    }
+    if (hcon)
+    {
+        pqm->MQDISC(&hcon, &cleanup_comp_code, &cleanup_reason_code);
+    }
+    free(p_buffer);
+
+    pthread_mutex_lock(&pf->mutex);
+    pf->comp_code   = comp_code;
+    pf->reason_code = reason_code;
+    pf->done        = 1;
+    pthread_cond_broadcast(&pf->not_empty);
+    pthread_mutex_unlock(&pf->mutex);
+    return 0;
+}
+
+static void* Queue_prefetch_wait(void* p)
+{
+    PPREFETCH pf = (PPREFETCH)p;
+
+    pthread_mutex_lock(&pf->mutex);
+    while (!pf->count && !pf->done && !pf->interrupted)
+    {
+        pthread_cond_wait(&pf->not_empty, &pf->mutex);
+    }
+    pf->interrupted = 0;
+    pthread_mutex_unlock(&pf->mutex);
+    return 0;
+}
+
+static void Queue_prefetch_interrupt(void* p)
+{
+    PPREFETCH pf = (PPREFETCH)p;
+
+    pthread_mutex_lock(&pf->mutex);
+    pf->interrupted = 1;
+    pthread_cond_broadcast(&pf->not_empty);
+    pthread_mutex_unlock(&pf->mutex);
+}
+
+/*
+ * Returns the next message, waiting without the GVL for the thread to fetch one,
+ * or 0 once the thread has finished and all of its messages have been consumed.
+ * The message remains valid until the next call.
+ */
+static PPREFETCH_MESSAGE Queue_prefetch_shift(PPREFETCH pf)
+{
+    int done;
+
+    free(pf->current);
+    pf->current = 0;
+    for (;;)
+    {
+        pthread_mutex_lock(&pf->mutex);
+        if (pf->count)
+        {
+            pf->current = pf->ring[pf->head];
+            pf->head = (pf->head + 1) % pf->capacity;
+            pf->count--;
+            if (!pf->browse) pf->consumed++;
+            pthread_cond_signal(&pf->not_full);
+        }
+        done = pf->done;
+        pthread_mutex_unlock(&pf->mutex);
+
+        if (pf->current || done)
+        {
+            return pf->current;
+        }
+        rb_thread_call_without_gvl(Queue_prefetch_wait, pf, Queue_prefetch_interrupt, pf);
+        rb_thread_check_ints();
+    }
+}
+
+static void* Queue_prefetch_join(void* p)
+{
+    PPREFETCH pf = (PPREFETCH)p;
+    pthread_join(pf->thread, 0);
+    return 0;
+}
+
+struct Queue_each_prefetch_arg {
+    VALUE     self;
+    VALUE     proc;
+    VALUE     message;
+    MQLONG    convert_ccsid;
+    PPREFETCH pf;
+};
+
+static VALUE Queue_each_prefetch_body(VALUE arg)
+{
+    struct Queue_each_prefetch_arg* parg = (struct Queue_each_prefetch_arg*)arg;
+    PPREFETCH_MESSAGE node;
+    VALUE  result = Qfalse;
+    PQUEUE pq;
+    Data_Get_Struct(parg->self, QUEUE, pq);
+
+    while ((node = Queue_prefetch_shift(parg->pf)))
+    {
+        result = Qtrue;
+        Message_deblock(parg->message, &node->md, node->data, node->length, parg->convert_ccsid, pq->trace_level);
+        rb_iv_set(parg->message, "@properties", Qnil);
+
+        /* Call code block passing in message */
+        rb_funcall(parg->proc, ID_call, 1, parg->message);
+    }
+
+    pq->comp_code   = parg->pf->comp_code;
+    pq->reason_code = parg->pf->reason_code;
+    if (pq->comp_code == MQCC_FAILED)
+    {
+        Message_clear(parg->message);
+        if (pq->exception_on_error && (pq->reason_code != MQRC_NO_MSG_AVAILABLE))
+        {
+            VALUE name = Queue_name(parg->self);
+
+            rb_raise(wmq_exception,
+                     "WMQ::Queue#each(). Error prefetching messages from Queue:%s, reason:%s",
+                     RSTRING_PTR(name),
+                     wmq_reason(pq->reason_code));
+        }
+    }
+    return result;
+}
+
+/*
+ * Stop the prefetch thread, waiting for it to back out any messages not consumed
+ */
+static VALUE Queue_each_prefetch_ensure(VALUE arg)
+{
+    struct Queue_each_prefetch_arg* parg = (struct Queue_each_prefetch_arg*)arg;
+    PPREFETCH pf = parg->pf;
+
+    pthread_mutex_lock(&pf->mutex);
+    pf->stopping = 1;
+    pthread_cond_broadcast(&pf->not_full);
+    pthread_mutex_unlock(&pf->mutex);
+
+    /* Not interruptible, the thread notices within WMQ_PREFETCH_WAIT_MAX */
+    rb_thread_call_without_gvl(Queue_prefetch_join, pf, 0, 0);
+
+    free(pf->current);
+    while (pf->count)
+    {
+        free(pf->ring[pf->head]);
+        pf->head = (pf->head + 1) % pf->capacity;
+        pf->count--;
+    }
+    pthread_mutex_destroy(&pf->mutex);
+    pthread_cond_destroy(&pf->not_empty);
+    pthread_cond_destroy(&pf->not_full);
+    free(pf->ring);
+    free(pf->msg_ids);
+    free(pf->selector);
+    free(pf);
+    return Qnil;
+}
+#endif
+
+/*
+ * Queue#each with :prefetch
+ */
+static VALUE Queue_each_prefetch(VALUE self, VALUE hash, VALUE proc, long capacity)
+{
+  #ifdef WMQ_PREFETCH
+    struct Queue_each_prefetch_arg arg;
+    VALUE          val;
+    VALUE          q_mgr_name;
+    VALUE          q_name;
+    VALUE          selector;
+    MQLONG         flag;
+    MQLONG         wait = 0;
+    MQLONG         browse;
+    MQMD           md  = {MQMD_DEFAULT};
+    MQGMO          gmo = {MQGMO_DEFAULT};
+    MQOD           od  = {MQOD_DEFAULT};
+    PQUEUE_MANAGER pqm;
+    PPREFETCH      pf;
+    PQUEUE         pq;
+    Data_Get_Struct(self, QUEUE, pq);
+
+    if (capacity < 1)
+    {
+        rb_raise(rb_eArgError, ":prefetch must be at least 1");
+    }
+    IF_TRUE(sync, 0)                                  /* Gets are committed on the prefetch connection */
+    {
+        rb_raise(rb_eArgError, ":sync cannot be used with :prefetch");
+    }
+    IF_TRUE(properties, 0)                            /* Message handles belong to the prefetch connection */
+    {
+        rb_raise(rb_eArgError, ":properties cannot be used with :prefetch");
+    }
+
+    /* Automatically open the queue if not already open, to resolve the queue name */
+    if (!pq->hcon && (Queue_open(self) == Qfalse))
+    {
+        return Qfalse;
+    }
+    val = rb_iv_get(self,"@queue_manager");
+    Data_Get_Struct(val, QUEUE_MANAGER, pqm);
+    q_mgr_name = rb_iv_get(val,"@name");
+    q_mgr_name = StringValue(q_mgr_name);
+    q_name     = Queue_name(self);                    /* Actual name, E.g. of a dynamic queue */
+    selector   = rb_iv_get(self,"@selector");
+    browse     = (pq->open_options & MQOO_BROWSE) != 0;
+
+    arg.self    = self;
+    arg.proc    = proc;
+    arg.message = rb_hash_aref(hash, ID2SYM(ID_message));
+    arg.convert_ccsid = 0;
+
+    md.Version  = MQMD_CURRENT_VERSION;
+    gmo.Version = MQGMO_CURRENT_VERSION;
+    Message_build_mqmd(arg.message, &md);
+
+    WMQ_HASH2MQLONG(hash,options, gmo.Options)        /* :options */
+    gmo.Options &= ~(MQGMO_WAIT | MQGMO_BROWSE_NEXT);
+    gmo.Options |= browse ? MQGMO_BROWSE_FIRST : MQGMO_SYNCPOINT;
+
+    IF_TRUE(fail_if_quiescing, 1)                     /* :fail_if_quiescing defaults to true */
+    {
+        gmo.Options |= MQGMO_FAIL_IF_QUIESCING;
+    }
+
+    val = rb_hash_aref(hash, ID2SYM(ID_convert));    /* :convert */
+    if (FIXNUM_P(val))                                /* Convert locally to the supplied CCSID */
+    {
+        arg.convert_ccsid = NUM2LONG(val);
+        if (!wmq_convert_supported(arg.convert_ccsid))
+        {
+            rb_raise(rb_eArgError, ":convert CCSID %ld is not supported. Supported values are 37, 500, 1047, 819 and 1208", (long)arg.convert_ccsid);
+        }
+    }
+    else
+    {
+        IF_TRUE(convert, 0)                           /* :convert defaults to false */
+        {
+            gmo.Options |= MQGMO_CONVERT;
+        }
+    }
+
+    val = rb_hash_aref(hash, ID2SYM(ID_wait));       /* :wait */
+    if (!NIL_P(val))
+    {
+        wait = NUM2LONG(val);
+    }
+
+    WMQ_HASH2MQLONG(hash,match, gmo.MatchOptions)     /* :match */
+
+    pf = ALLOC(PREFETCH);
+    memset(pf, 0, sizeof(PREFETCH));
+    pf->pqm         = pqm;
+    pf->capacity    = capacity;
+    pf->browse      = browse;
+    pf->wait        = wait;
+    pf->buffer_size = pq->buffer_size > 0 ? pq->buffer_size : 1;
+    pf->trace_level = pq->trace_level;
+    pf->comp_code   = MQCC_OK;
+    pf->reason_code = MQRC_NONE;
+    pf->ring        = ALLOC_N(PPREFETCH_MESSAGE, capacity);
+    pf->msg_ids     = ALLOC_N(MQBYTE24, capacity);
+    memcpy(&pf->md, &md, sizeof(MQMD));
+    memcpy(&pf->gmo, &gmo, sizeof(MQGMO));
+    strncpy(pf->q_mgr_name, RSTRING_PTR(q_mgr_name), (size_t)MQ_Q_MGR_NAME_LENGTH);
+
+    memcpy(&pf->od, &od, sizeof(MQOD));
+    strncpy(pf->od.ObjectName, RSTRING_PTR(q_name), (size_t)MQ_Q_NAME_LENGTH);
+  #ifdef MQOD_VERSION_4
+    if (!NIL_P(selector))
+    {
+        pf->selector = ALLOC_N(char, RSTRING_LEN(selector) + 1);
+        memcpy(pf->selector, RSTRING_PTR(selector), (size_t)RSTRING_LEN(selector) + 1);
+        pf->od.Version                  = MQOD_VERSION_4;
+        pf->od.SelectionString.VSPtr    = pf->selector;
+        pf->od.SelectionString.VSLength = (MQLONG)RSTRING_LEN(selector);
+    }
+  #endif
+
+    /* Shared input, since this queue is usually already open for input */
+    pf->open_options = pq->open_options & ~(MQOO_INPUT_AS_Q_DEF | MQOO_INPUT_EXCLUSIVE | MQOO_OUTPUT);
+    if (!browse)
+    {
+        pf->open_options |= MQOO_INPUT_SHARED;
+    }
+
+    pthread_mutex_init(&pf->mutex, 0);
+    pthread_cond_init(&pf->not_empty, 0);
+    pthread_cond_init(&pf->not_full, 0);
+
+    if(pq->trace_level) printf("WMQ::Queue#each() Prefetching up to %ld messages from Queue:%s\n", capacity, RSTRING_PTR(q_name));
+
+    if (pthread_create(&pf->thread, 0, Queue_prefetch_thread, pf) != 0)
+    {
+        pthread_mutex_destroy(&pf->mutex);
+        pthread_cond_destroy(&pf->not_empty);
+        pthread_cond_destroy(&pf->not_full);
+        free(pf->ring);
+        free(pf->msg_ids);
+        free(pf->selector);
+        free(pf);
+        rb_sys_fail("WMQ::Queue#each prefetch thread");
+    }
+
+    arg.pf = pf;
+    return rb_ensure(Queue_each_prefetch_body, (VALUE)&arg, Queue_each_prefetch_ensure, (VALUE)&arg);
+  #else
+    rb_raise(rb_eNotImpError, ":prefetch requires POSIX threads");
+    return Qfalse;
+  #endif
+}
+
+/* Milli-seconds from an arbitrary starting point, for timing a unit of work */
+static long Queue_clock_ms(void)
+{
+  #ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000 + (long)(ts.tv_nsec / 1000000);
+  #else
+    return (long)time(0) * 1000;
+  #endif
+}
+
+struct Queue_each_batch_arg {
+    VALUE  self;
+    VALUE  hash;
+    VALUE  proc;
+    VALUE  queue_manager;
+    VALUE  wait;                      /* :wait supplied to each        */
+    long   commit_every;              /* Commit after this many messages, 0 for no limit */
+    long   commit_interval;           /* ... or once the oldest message was received this many milli-seconds ago */
+    long   batch;                     /* Messages received in the current unit of work */
+    long   batch_started;             /* When the first of them was received */
+};
+
+static void Queue_each_batch_commit(struct Queue_each_batch_arg* parg)
+{
+    long   batch = parg->batch;
+    PQUEUE pq;
+    Data_Get_Struct(parg->self, QUEUE, pq);
+
+    parg->batch = 0;
+    if(pq->trace_level>1) printf("WMQ::Queue#each() Committing %ld messages\n", batch);
+    rb_funcall(parg->queue_manager, ID_commit, 0);
+
+    pq->commits++;
+    pq->committed_messages += batch;
+    if (batch > pq->max_commit_size) pq->max_commit_size = batch;
+}
+
+static VALUE Queue_each_batch_backout(VALUE queue_manager)
+{
+    return rb_funcall(queue_manager, ID_backout, 0);
+}
+
+static VALUE Queue_each_batch_body(VALUE arg)
+{
+    struct Queue_each_batch_arg* parg = (struct Queue_each_batch_arg*)arg;
+    VALUE  message = rb_hash_aref(parg->hash, ID2SYM(ID_message));
+    VALUE  result  = Qfalse;
+    MQLONG wait    = NIL_P(parg->wait) ? 0 : NUM2LONG(parg->wait);
+    long   remaining;
+    long   poison_messages;
+    PQUEUE pq;
+    Data_Get_Struct(parg->self, QUEUE, pq);
+
+    for (;;)
+    {
+        /* Do not hold a unit of work open while waiting for messages beyond the interval */
+        if (parg->batch)
+        {
+            remaining = 0;
+            if (parg->commit_interval)
+            {
+                remaining = parg->commit_interval - (Queue_clock_ms() - parg->batch_started);
+                if (remaining < 0) remaining = 0;
+            }
+            if (wait != MQWI_UNLIMITED && wait < remaining) remaining = wait;
+            rb_hash_aset(parg->hash, ID2SYM(ID_wait), LONG2NUM(remaining));
+        }
+        else
+        {
+            rb_hash_aset(parg->hash, ID2SYM(ID_wait), parg->wait);
+        }
+
+        poison_messages = pq->poison_messages;
+        if (!Queue_get(parg->self, parg->hash))
+        {
+            /* Also commit poison messages moved while looking for a message */
+            if ((parg->batch || pq->poison_messages != poison_messages) && pq->reason_code == MQRC_NO_MSG_AVAILABLE)
+            {
+                Queue_each_batch_commit(parg);
+                continue;
+            }
+            break;
+        }
+        if (!parg->batch)
+        {
+            parg->batch_started = Queue_clock_ms();
+        }
+        result = Qtrue;
+        parg->batch++;                                /* Before the block, so that a break commits, and a raise backs out, this message too */
+
+        /* Call code block passing in message */
+        rb_funcall(parg->proc, ID_call, 1, message);
+
+        if ((parg->commit_every && parg->batch >= parg->commit_every) ||
+            (parg->commit_interval && Queue_clock_ms() - parg->batch_started >= parg->commit_interval))
+        {
+            Queue_each_batch_commit(parg);
+        }
+    }
+    return result;
+}
+
+/*
+ * Back out the whole unit of work when the block raises an exception
+ */
+static VALUE Queue_each_batch_rescue(VALUE arg, VALUE exception)
+{
+    struct Queue_each_batch_arg* parg = (struct Queue_each_batch_arg*)arg;
+    int    state;
+    PQUEUE pq;
+    Data_Get_Struct(parg->self, QUEUE, pq);
+
+    if (parg->batch)
+    {
+        if(pq->trace_level>1) printf("WMQ::Queue#each() Backing out %ld messages\n", parg->batch);
+        pq->backouts++;
+        parg->batch = 0;
+    }
+    rb_protect(Queue_each_batch_backout, parg->queue_manager, &state);  /* Report the original exception */
+    rb_exc_raise(exception);
+    return Qnil;
+}
+
+static VALUE Queue_each_batch_rescue_body(VALUE arg)
+{
+    return rb_rescue2(Queue_each_batch_body, arg, Queue_each_batch_rescue, arg, rb_eException, (VALUE)0);
+}
+
+/*
+ * Commit messages already processed when the block breaks out of each
+ */
+static VALUE Queue_each_batch_ensure(VALUE arg)
+{
+    struct Queue_each_batch_arg* parg = (struct Queue_each_batch_arg*)arg;
+
+    if (parg->batch)
+    {
+        Queue_each_batch_commit(parg);
+    }
+    return Qnil;
+}
+
+/*
+ * Queue#each with :commit_every or :commit_interval_ms
+ */
+static VALUE Queue_each_batch(VALUE self, VALUE hash, VALUE proc, VALUE commit_every, VALUE commit_interval)
+{
+    struct Queue_each_batch_arg arg;
+    PQUEUE pq;
+    Data_Get_Struct(self, QUEUE, pq);
+
+    if (pq->open_options & MQOO_BROWSE)
+    {
+        rb_raise(rb_eArgError, ":commit_every and :commit_interval_ms cannot be used when browsing");
+    }
+
+    arg.self            = self;
+    arg.hash            = rb_hash_dup(hash);
+    arg.proc            = proc;
+    arg.queue_manager   = rb_iv_get(self,"@queue_manager");
+    arg.wait            = rb_hash_aref(hash, ID2SYM(ID_wait));
+    arg.commit_every    = NIL_P(commit_every) ? 0 : NUM2LONG(commit_every);
+    arg.commit_interval = NIL_P(commit_interval) ? 0 : NUM2LONG(commit_interval);
+    arg.batch           = 0;
+    arg.batch_started   = 0;
+
+    if (arg.commit_every < 0 || arg.commit_interval < 0)
+    {
+        rb_raise(rb_eArgError, ":commit_every and :commit_interval_ms must not be negative");
+    }
+    rb_hash_aset(arg.hash, ID2SYM(ID_sync), Qtrue);
+
+    return rb_ensure(Queue_each_batch_rescue_body, (VALUE)&arg, Queue_each_batch_ensure, (VALUE)&arg);
+}
+
 /*
  * For each message found on the queue, the supplied block is executed
  *
+ * Parameters:
+ * * The same parameters as Queue#get, all of which are optional
+ *
+ * * :prefetch [Integer]
+ *   * Get up to this many messages ahead of the block, on a native thread with its
+ *     own connection to the queue manager, so that waiting for MQ overlaps with
+ *     processing in the block.
+ *   * Messages are retrieved under syncpoint on that connection, and committed in
+ *     units of work of at most :prefetch messages. As with Queue#each without :sync,
+ *     a message is removed from the queue once it has been passed to the block.
+ *     Messages fetched ahead, but not yet passed to the block when each stops,
+ *     are backed out and remain on the queue.
+ *   * When each stops part way through a unit of work, the whole unit of work is
+ *     backed out, and the messages already passed to the block are then removed
+ *     again by message id. Another application getting from the same queue can
+ *     receive those messages in between, so use a :prefetch of 1, or no :prefetch,
+ *     when messages must never be processed twice.
+ *   * The queue is opened again on the prefetch connection for shared input,
+ *     or for browse when this queue is open for browse. I.e. this queue must not
+ *     be open for exclusive input.
+ *   * Cannot be combined with :sync or :properties
+ *   * Not available on Windows
+ *
+ * * :commit_every [Integer]
+ * * :commit_interval_ms [Integer]
+ *   * Get the messages under syncpoint, and commit them on the queue manager
+ *     in batches instead of calling QueueManager#commit for every message.
+ *     The batch is committed once it holds :commit_every messages, or once
+ *     :commit_interval_ms milli-seconds have passed since its first message was
+ *     received, whichever comes first. It is also committed before waiting for
+ *     more messages, and when the block breaks out of each.
+ *   * When the block raises an exception, the whole batch is backed out,
+ *     I.e. the messages already processed in the batch are received again.
+ *   * Any puts under syncpoint in the block on the same queue manager are
+ *     committed or backed out with the batch.
+ *   * See Queue#stats for the number and size of the batches
+ *   * Cannot be combined with :prefetch, or used when browsing
+ *
+ * * :backout_requeue [true|false]
+ *   * See Queue#get. Defaults to true, so that with :sync or :commit_every a
+ *     message the block keeps failing on is moved to the backout requeue queue
+ *     once it reaches the backout threshold of the queue, instead of being passed
+ *     to the block again.
+ *
  * Note:
  * * If no messages are found on the queue during the supplied wait interval,
  *   then the supplied block will not be called at all
@@ -1238,6 +3034,16 @@ VALUE Queue_singleton_open(int argc, VALUE *argv, VALUE self)
  *     end
  *     puts 'Completed.'
  *   end
+ *
+ * Example, prefetching messages:
+ *   queue.each(prefetch: 50, wait: 5000) do |message|
+ *     puts "Data Received: #{message.data}"
+ *   end
+ *
+ * Example, committing up to 200 messages at a time:
+ *   queue.each(wait: 5000, commit_every: 200, commit_interval_ms: 50) do |message|
+ *     qmgr.put(q_name: 'TEST.REPLY', data: message.data, sync: true)
+ *   end
  */
 VALUE Queue_each(int argc, VALUE *argv, VALUE self)
 {
@@ -1245,7 +3051,7 @@ VALUE Queue_each(int argc, VALUE *argv, VALUE self)
     VALUE  match   = Qnil;
     VALUE  options = Qnil;
     VALUE  result  = Qfalse;
-    VALUE  proc, hash;
+    VALUE  proc, hash, prefetch, commit_every, commit_interval;
     MQLONG browse = 0;
 
     PQUEUE pq;
@@ -1276,6 +3082,27 @@ VALUE Queue_each(int argc, VALUE *argv, VALUE self)
         rb_hash_aset(hash, ID2SYM(ID_match), LONG2NUM(MQMO_NONE));
     }
 
+    if (NIL_P(rb_hash_aref(hash, ID2SYM(ID_backout_requeue))))
+    {
+        rb_hash_aset(hash, ID2SYM(ID_backout_requeue), Qtrue);
+    }
+
+    prefetch        = rb_hash_aref(hash, ID2SYM(ID_prefetch));
+    commit_every    = rb_hash_aref(hash, ID2SYM(ID_commit_every));
+    commit_interval = rb_hash_aref(hash, ID2SYM(ID_commit_interval_ms));
+    if (!NIL_P(commit_every) || !NIL_P(commit_interval))
+    {
+        if (!NIL_P(prefetch))
+        {
+            rb_raise(rb_eArgError, ":prefetch cannot be combined with :commit_every or :commit_interval_ms");
+        }
+        return Queue_each_batch(self, hash, proc, commit_every, commit_interval);
+    }
+    if (!NIL_P(prefetch))
+    {
+        return Queue_each_prefetch(self, hash, proc, NUM2LONG(prefetch));
+    }
+
     /* If queue is open for browse, set Borwse first indicator */
     if(pq->open_options & MQOO_BROWSE)
     {
@@ -1392,3 +3219,285 @@ VALUE Queue_open_q(VALUE self)
     return Qfalse;
 }
 
+/*
+ * Returns the object handle of an open queue, or 0 when the queue is not open
+ * using the connection handle hcon
+ */
+MQHOBJ Queue_hobj(VALUE self, MQHCONN hcon)
+{
+    PQUEUE pq;
+    Data_Get_Struct(self, QUEUE, pq);
+    if (pq->hobj && pq->hcon == hcon)
+    {
+        return pq->hobj;
+    }
+    return 0;
+}
+
+/*
+ * WMQ::MessageProperties
+ *
+ * Properties of a message received by WMQ::Queue#get(properties: true).
+ * Each property is only retrieved from the message handle (MQINQMP) the first
+ * time it is read, properties that are never read cost nothing.
+ *
+ * The message handle is re-used by the next get on the same queue, after which
+ * properties that have not been read are no longer available. Call #to_h to
+ * retain all of them.
+ */
+ typedef struct tagMESSAGE_PROPERTIES MESSAGE_PROPERTIES;
+ typedef MESSAGE_PROPERTIES MQPOINTER PMESSAGE_PROPERTIES;
+
+ struct tagMESSAGE_PROPERTIES {
+    VALUE    queue;                   /* WMQ::Queue holding the message handle */
+    long     generation;              /* Queue get_generation when the message was received */
+    VALUE    cache;                   /* Hash of properties read so far, nil when missing */
+    int      complete;                /* Non-Zero once cache holds every property */
+ };
+
+static void MESSAGE_PROPERTIES_mark(void* p)
+{
+    PMESSAGE_PROPERTIES pmp = (PMESSAGE_PROPERTIES)p;
+    rb_gc_mark(pmp->queue);
+    rb_gc_mark(pmp->cache);
+}
+
+static VALUE MessageProperties_new(VALUE queue, PQUEUE pq)
+{
+    PMESSAGE_PROPERTIES pmp = ALLOC(MESSAGE_PROPERTIES);
+
+    pmp->queue      = queue;
+    pmp->generation = pq->get_generation;
+    pmp->cache      = rb_hash_new();
+    pmp->complete   = 0;
+
+    return Data_Wrap_Struct(wmq_message_properties, MESSAGE_PROPERTIES_mark, free, pmp);
+}
+
+#ifdef MQHM_UNUSABLE_HMSG
+/*
+ * Returns the queue holding the message handle, if it still holds this message
+ */
+static PQUEUE MessageProperties_queue(PMESSAGE_PROPERTIES pmp)
+{
+    PQUEUE pq;
+    Data_Get_Struct(pmp->queue, QUEUE, pq);
+
+    if (pq->get_generation != pmp->generation)
+    {
+        rb_raise(wmq_exception,
+                 "WMQ::MessageProperties are no longer available after the next get, or close, on the queue. "
+                 "Call #to_h first to retain them");
+    }
+    return pq;
+}
+
+/*
+ * MQINQMP into buffer, growing it when the property value is larger
+ */
+static void MessageProperties_inquire(PQUEUE pq, PMQIMPO pimpo, PMQCHARV pname, PMQLONG p_type, VALUE buffer, PMQLONG p_length)
+{
+    MQPD pd = {MQPD_DEFAULT};
+
+    *p_type = MQTYPE_AS_SET;
+    pq->MQINQMP(pq->hcon, pq->get_hmsg, pimpo, pname, &pd, p_type,
+                (MQLONG)RSTRING_LEN(buffer), RSTRING_PTR(buffer), p_length, &pq->comp_code, &pq->reason_code);
+
+    if (pq->reason_code == MQRC_PROPERTY_VALUE_TOO_BIG)
+    {
+        if(pq->trace_level>1) printf("WMQ::MessageProperties Growing value buffer to %ld\n", (long)*p_length);
+        rb_str_resize(buffer, *p_length);
+
+        pimpo->Options = (pimpo->Options & ~(MQIMPO_INQ_FIRST | MQIMPO_INQ_NEXT)) | MQIMPO_INQ_PROP_UNDER_CURSOR;
+        *p_type = MQTYPE_AS_SET;
+        pq->MQINQMP(pq->hcon, pq->get_hmsg, pimpo, pname, &pd, p_type,
+                    (MQLONG)RSTRING_LEN(buffer), RSTRING_PTR(buffer), p_length, &pq->comp_code, &pq->reason_code);
+    }
+}
+
+/*
+ * Convert a property value to the equivalent Ruby type
+ */
+static VALUE MessageProperties_value(MQLONG type, const char* p_value, MQLONG length)
+{
+    switch (type)
+    {
+        case MQTYPE_BOOLEAN:
+        {
+            MQBOOL value;
+            memcpy(&value, p_value, sizeof(value));
+            return value ? Qtrue : Qfalse;
+        }
+        case MQTYPE_INT8:
+        {
+            MQINT8 value;
+            memcpy(&value, p_value, sizeof(value));
+            return INT2FIX(value);
+        }
+        case MQTYPE_INT16:
+        {
+            MQINT16 value;
+            memcpy(&value, p_value, sizeof(value));
+            return INT2FIX(value);
+        }
+        case MQTYPE_INT32:
+        {
+            MQINT32 value;
+            memcpy(&value, p_value, sizeof(value));
+            return LONG2NUM(value);
+        }
+        case MQTYPE_INT64:
+        {
+            MQINT64 value;
+            memcpy(&value, p_value, sizeof(value));
+            return LL2NUM(value);
+        }
+        case MQTYPE_FLOAT32:
+        {
+            MQFLOAT32 value;
+            memcpy(&value, p_value, sizeof(value));
+            return rb_float_new(value);
+        }
+        case MQTYPE_FLOAT64:
+        {
+            MQFLOAT64 value;
+            memcpy(&value, p_value, sizeof(value));
+            return rb_float_new(value);
+        }
+        case MQTYPE_NULL:
+            return Qnil;
+        default:                                      /* MQTYPE_STRING, MQTYPE_BYTE_STRING */
+            return rb_str_new(p_value, length);
+    }
+}
+
+static VALUE MessageProperties_error(PQUEUE pq, const char* method)
+{
+    if (pq->exception_on_error)
+    {
+        rb_raise(wmq_exception,
+                 "WMQ::MessageProperties#%s Error reading message properties, reason:%s",
+                 method,
+                 wmq_reason(pq->reason_code));
+    }
+    return Qnil;
+}
+#endif
+
+/*
+ * call-seq:
+ *   [](name)
+ *
+ * Returns the value of the named property, or nil if the message does not have it
+ *
+ * Example:
+ *   queue.get(message: message, properties: true)
+ *   message.properties['OrderId']
+ */
+VALUE MessageProperties_aref(VALUE self, VALUE name)
+{
+    PMESSAGE_PROPERTIES pmp;
+    VALUE               value;
+
+    Data_Get_Struct(self, MESSAGE_PROPERTIES, pmp);
+
+    if (SYMBOL_P(name))
+    {
+        name = rb_sym2str(name);
+    }
+    name = StringValue(name);
+
+    value = rb_hash_lookup2(pmp->cache, name, Qundef);
+    if (value != Qundef)
+    {
+        return value;
+    }
+    if (pmp->complete)
+    {
+        return Qnil;
+    }
+
+  #ifdef MQHM_UNUSABLE_HMSG
+    {
+        PQUEUE  pq         = MessageProperties_queue(pmp);
+        MQIMPO  impo       = {MQIMPO_DEFAULT};
+        MQCHARV property   = {MQCHARV_DEFAULT};
+        VALUE   buffer     = rb_str_new(0, 256);
+        MQLONG  type;
+        MQLONG  length     = 0;
+
+        impo.Options      = MQIMPO_INQ_FIRST | MQIMPO_CONVERT_VALUE;
+        property.VSPtr    = RSTRING_PTR(name);
+        property.VSLength = (MQLONG)RSTRING_LEN(name);
+
+        MessageProperties_inquire(pq, &impo, &property, &type, buffer, &length);
+
+        if (pq->reason_code == MQRC_PROPERTY_NOT_AVAILABLE)
+        {
+            value = Qnil;
+        }
+        else if (pq->comp_code == MQCC_FAILED)
+        {
+            return MessageProperties_error(pq, "[]");
+        }
+        else
+        {
+            value = MessageProperties_value(type, RSTRING_PTR(buffer), length);
+        }
+        rb_hash_aset(pmp->cache, name, value);
+    }
+  #endif
+    return value;
+}
+
+/*
+ * Returns all of the properties => Hash
+ *
+ * Unlike WMQ::MessageProperties#[], the Hash remains available after the next
+ * get on the queue
+ */
+VALUE MessageProperties_to_h(VALUE self)
+{
+    PMESSAGE_PROPERTIES pmp;
+    Data_Get_Struct(self, MESSAGE_PROPERTIES, pmp);
+
+  #ifdef MQHM_UNUSABLE_HMSG
+    if (!pmp->complete)
+    {
+        PQUEUE  pq         = MessageProperties_queue(pmp);
+        MQIMPO  impo       = {MQIMPO_DEFAULT};
+        MQCHARV property   = {MQCHARV_DEFAULT};
+        VALUE   buffer     = rb_str_new(0, 256);
+        VALUE   names      = rb_str_new(0, MQ_MAX_PROPERTY_NAME_LENGTH);
+        VALUE   all        = rb_hash_new();
+        MQLONG  type;
+        MQLONG  length     = 0;
+
+        property.VSPtr    = (MQPTR)"%";               /* Every property */
+        property.VSLength = 1;
+        impo.ReturnedName.VSPtr     = RSTRING_PTR(names);
+        impo.ReturnedName.VSBufSize = (MQLONG)RSTRING_LEN(names);
+
+        for (;;)
+        {
+            impo.Options = MQIMPO_INQ_NEXT | MQIMPO_CONVERT_VALUE;
+            MessageProperties_inquire(pq, &impo, &property, &type, buffer, &length);
+
+            if (pq->reason_code == MQRC_PROPERTY_NOT_AVAILABLE)
+            {
+                break;
+            }
+            if (pq->comp_code == MQCC_FAILED)
+            {
+                return MessageProperties_error(pq, "to_h");
+            }
+            rb_hash_aset(all,
+                         rb_str_new(impo.ReturnedName.VSPtr, impo.ReturnedName.VSLength),
+                         MessageProperties_value(type, RSTRING_PTR(buffer), length));
+        }
+        pmp->cache    = all;
+        pmp->complete = 1;
+    }
+  #endif
+    return rb_hash_dup(pmp->cache);
+}
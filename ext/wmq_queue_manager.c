@@ -1,5 +1,8 @@
 #include "wmq.h"
 
+#define WMQ_RECONNECT_ATTEMPTS 5                    /* reconnect: true */
+#define WMQ_RECONNECT_WAIT_MAX 10000                /* Milliseconds */
+
 static ID ID_open;
 static ID ID_call;
 static ID ID_new;
@@ -11,6 +14,14 @@ static ID ID_exception_on_error;
 static ID ID_descriptor;
 static ID ID_message;
 static ID ID_trace_level;
+static ID ID_share_handle;
+static ID ID_release_gvl;
+static ID ID_reconnect;
+static ID ID_reconnect_wait;
+static ID ID_reconnect_after_fork;
+static ID ID_alive_p;
+static ID ID_compare_by_identity;
+static ID ID_wmq_status;
 
 /* MQCD ID's */
 static ID ID_channel_name;
@@ -55,6 +66,14 @@ void QueueManager_id_init(void)
     ID_exception_on_error   = rb_intern("exception_on_error");
     ID_connect_options      = rb_intern("connect_options");
     ID_trace_level          = rb_intern("trace_level");
+    ID_share_handle         = rb_intern("share_handle");
+    ID_release_gvl          = rb_intern("release_gvl");
+    ID_reconnect            = rb_intern("reconnect");
+    ID_reconnect_wait       = rb_intern("reconnect_wait");
+    ID_reconnect_after_fork = rb_intern("reconnect_after_fork");
+    ID_alive_p              = rb_intern("alive?");
+    ID_compare_by_identity  = rb_intern("compare_by_identity");
+    ID_wmq_status           = rb_intern("wmq_thread_status"); /* No @, hidden from Ruby */
     ID_descriptor           = rb_intern("descriptor");
     ID_message              = rb_intern("message");
 
@@ -101,6 +120,15 @@ void QUEUE_MANAGER_free(void* p)
 
     if(pqm->trace_level>1) printf("WMQ::QueueManager Freeing QUEUE_MANAGER structure\n");
 
+    if (pqm->pid != getpid())                  /* Handles belong to the parent process, leave them alone */
+    {
+        pqm->hcon = 0;
+      #ifdef MQHB_UNUSABLE_HBAG
+        pqm->admin_bag = MQHB_UNUSABLE_HBAG;
+        pqm->reply_bag = MQHB_UNUSABLE_HBAG;
+      #endif
+    }
+
     if (pqm->hcon && !pqm->already_connected)  /* Valid MQ handle means MQDISC was not called */
     {
         printf("WMQ::QueueManager#free disconnect() was not called for Queue Manager instance!!\n");
@@ -132,12 +160,12 @@ void QUEUE_MANAGER_free(void* p)
 
 VALUE QUEUE_MANAGER_alloc(VALUE klass)
 {
-    static MQCNO default_MQCNO = {MQCNO_DEFAULT};       /* MQCONNX Connection Options    */
+    static const MQCNO default_MQCNO = {MQCNO_DEFAULT};       /* MQCONNX Connection Options    */
   #ifdef MQCNO_VERSION_2
-    static MQCD  default_MQCD  = {MQCD_CLIENT_CONN_DEFAULT}; /* Client Connection             */
+    static const MQCD  default_MQCD  = {MQCD_CLIENT_CONN_DEFAULT}; /* Client Connection             */
   #endif
   #ifdef MQCNO_VERSION_4
-    static MQSCO default_MQSCO = {MQSCO_DEFAULT};
+    static const MQSCO default_MQSCO = {MQSCO_DEFAULT};
   #endif
 
     PQUEUE_MANAGER pqm = ALLOC(QUEUE_MANAGER);
@@ -148,6 +176,15 @@ VALUE QUEUE_MANAGER_alloc(VALUE klass)
     pqm->exception_on_error = 1;
     pqm->already_connected = 0;
     pqm->trace_level = 0;
+    pqm->share_handle = 0;
+    pqm->release_gvl = 0;
+    pqm->inquire_hobj = MQHO_UNUSABLE_HOBJ;
+    pqm->reconnect_attempts = 0;
+    pqm->reconnect_wait = 100;
+    pqm->reconnecting = 0;
+    pqm->connection_id = 0;
+    pqm->pid = getpid();
+    pqm->reconnect_after_fork = 1;
     memcpy(&pqm->connect_options, &default_MQCNO, sizeof(MQCNO));
   #ifdef MQCNO_VERSION_2
     memcpy(&pqm->client_conn, &default_MQCD, sizeof(MQCD));
@@ -365,6 +402,31 @@ VALUE QueueManager_initialize(VALUE self, VALUE hash)
     WMQ_HASH2MQLONG(hash,connect_options,             pqm->connect_options.Options)
 #endif
 
+    WMQ_HASH2BOOL(hash,release_gvl,                   pqm->release_gvl)
+    val = rb_hash_aref(hash, ID2SYM(ID_share_handle));     /* :share_handle */
+    if (RTEST(val))
+    {
+#ifdef MQCNO_HANDLE_SHARE_BLOCK
+        pqm->share_handle = 1;
+        pqm->release_gvl  = 1;                        /* Otherwise a thread waiting for the shared connection holds up the one using it */
+        pqm->connect_options.Options |= MQCNO_HANDLE_SHARE_BLOCK;
+#else
+        rb_raise(rb_eNotImpError, ":share_handle is not supported by this version of WebSphere MQ");
+#endif
+    }
+
+    val = rb_hash_aref(hash, ID2SYM(ID_reconnect));        /* :reconnect */
+    if (val == Qtrue)
+    {
+        pqm->reconnect_attempts = WMQ_RECONNECT_ATTEMPTS;
+    }
+    else if (RTEST(val))
+    {
+        pqm->reconnect_attempts = NUM2LONG(val);
+    }
+    WMQ_HASH2MQLONG(hash,reconnect_wait,              pqm->reconnect_wait)
+    WMQ_HASH2BOOL(hash,reconnect_after_fork,          pqm->reconnect_after_fork)
+
   /* --------------------------------------------------
    * TODO:   MQAIR Structure - LDAP Security
    * --------------------------------------------------*/
@@ -372,6 +434,270 @@ VALUE QueueManager_initialize(VALUE self, VALUE hash)
     return Qnil;
 }
 
+static int QueueManager_thread_status_prune(VALUE thread, VALUE status, VALUE arg)
+{
+    return RTEST(rb_funcall(thread, ID_alive_p, 0)) ? ST_CONTINUE : ST_DELETE;
+}
+
+/*
+ * With :share_handle the completion and reason codes are held per thread,
+ * since another thread may have used the connection since.
+ * They are kept in a Hash keyed by thread, owned by the queue manager, so that
+ * they are released with it. Finished threads are removed whenever the Hash
+ * doubles in size.
+ */
+static void QueueManager_thread_status_set(VALUE self, MQLONG comp_code, MQLONG reason_code)
+{
+    VALUE thread = rb_thread_current();
+    VALUE status = rb_ivar_get(self, ID_wmq_status);
+    long  size;
+
+    if (NIL_P(status))
+    {
+        status = rb_hash_new();
+        rb_funcall(status, ID_compare_by_identity, 0);
+        rb_ivar_set(self, ID_wmq_status, status);
+    }
+    else if (rb_hash_lookup2(status, thread, Qundef) == Qundef)
+    {
+        size = (long)RHASH_SIZE(status);
+        if (size >= 16 && (size & (size - 1)) == 0)
+        {
+            rb_hash_foreach(status, QueueManager_thread_status_prune, 0);
+        }
+    }
+    rb_hash_aset(status, thread, rb_assoc_new(LONG2NUM(comp_code), LONG2NUM(reason_code)));
+}
+
+static void QueueManager_thread_status(VALUE self, PQUEUE_MANAGER pqm, PMQLONG p_comp_code, PMQLONG p_reason_code)
+{
+    *p_comp_code   = pqm->comp_code;
+    *p_reason_code = pqm->reason_code;
+
+    if (pqm->share_handle)
+    {
+        VALUE status = rb_ivar_get(self, ID_wmq_status);
+        if (!NIL_P(status))
+        {
+            status = rb_hash_lookup(status, rb_thread_current());
+            if (!NIL_P(status))
+            {
+                *p_comp_code   = NUM2LONG(RARRAY_AREF(status, 0));
+                *p_reason_code = NUM2LONG(RARRAY_AREF(status, 1));
+            }
+        }
+    }
+}
+
+/*
+ * With :share_handle, several threads can be in a call on the connection at once.
+ * Each call therefore runs against its own copy of the QUEUE_MANAGER, with its own
+ * message buffer, admin bags, comp_code and reason_code, released when the call completes.
+ */
+struct QueueManager_call_arg {
+    VALUE          self;
+    VALUE          hash;
+    PQUEUE_MANAGER pqm;                               /* State for this call             */
+    VALUE        (*body)(struct QueueManager_call_arg*);
+    QUEUE_MANAGER  call;                              /* Per call copy with :share_handle */
+};
+
+static VALUE QueueManager_call_body(VALUE arg)
+{
+    struct QueueManager_call_arg* parg = (struct QueueManager_call_arg*)arg;
+    return parg->body(parg);
+}
+
+static VALUE QueueManager_call_ensure(VALUE arg)
+{
+    struct QueueManager_call_arg* parg = (struct QueueManager_call_arg*)arg;
+    PQUEUE_MANAGER pqm = parg->pqm;
+    PQUEUE_MANAGER shared;
+    MQLONG         comp_code;
+    MQLONG         reason_code;
+
+    Data_Get_Struct(parg->self, QUEUE_MANAGER, shared);
+    shared->comp_code   = pqm->comp_code;
+    shared->reason_code = pqm->reason_code;
+    QueueManager_thread_status_set(parg->self, pqm->comp_code, pqm->reason_code);
+
+  #ifdef MQHB_UNUSABLE_HBAG
+    if (pqm->admin_bag != MQHB_UNUSABLE_HBAG)
+    {
+        pqm->mqDeleteBag(&pqm->admin_bag, &comp_code, &reason_code);
+    }
+    if (pqm->reply_bag != MQHB_UNUSABLE_HBAG)
+    {
+        pqm->mqDeleteBag(&pqm->reply_bag, &comp_code, &reason_code);
+    }
+  #endif
+    free(pqm->p_buffer);
+    return Qnil;
+}
+
+static VALUE QueueManager_call_once(VALUE self, VALUE hash, VALUE(*body)(struct QueueManager_call_arg*))
+{
+    struct QueueManager_call_arg arg;
+    PQUEUE_MANAGER pqm;
+    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+
+    arg.self = self;
+    arg.hash = hash;
+    arg.body = body;
+
+    if (!pqm->share_handle)
+    {
+        arg.pqm = pqm;
+        return body(&arg);
+    }
+
+    memcpy(&arg.call, pqm, sizeof(QUEUE_MANAGER));
+    arg.call.comp_code   = 0;
+    arg.call.reason_code = 0;
+    arg.call.p_buffer    = 0;
+    arg.call.buffer_size = 0;
+  #ifdef MQHB_UNUSABLE_HBAG
+    arg.call.admin_bag   = MQHB_UNUSABLE_HBAG;
+    arg.call.reply_bag   = MQHB_UNUSABLE_HBAG;
+  #endif
+    arg.pqm = &arg.call;
+
+    return rb_ensure(QueueManager_call_body, (VALUE)&arg, QueueManager_call_ensure, (VALUE)&arg);
+}
+
+struct QueueManager_reconnect_arg {
+    VALUE   self;
+    VALUE   hash;
+    VALUE (*body)(struct QueueManager_call_arg*);
+};
+
+static VALUE QueueManager_reconnect_body(VALUE arg)
+{
+    struct QueueManager_reconnect_arg* parg = (struct QueueManager_reconnect_arg*)arg;
+    return QueueManager_call_once(parg->self, parg->hash, parg->body);
+}
+
+/*
+ * Make the call, and with :reconnect, reconnect when the connection is broken.
+ * The call is then made again if retry is set, unless it was under syncpoint,
+ * since the queue manager has already backed out the unit of work.
+ */
+static VALUE QueueManager_call(VALUE self, VALUE hash, VALUE(*body)(struct QueueManager_call_arg*), int retry)
+{
+    struct QueueManager_reconnect_arg arg;
+    VALUE  result;
+    VALUE  error;
+    VALUE  errinfo = rb_errinfo();            /* $! of the caller, E.g. in a rescue clause */
+    MQLONG attempt;
+    MQLONG comp_code;
+    MQLONG reason_code;
+    long   connection_id;
+    int    state;
+    PQUEUE_MANAGER pqm;
+    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+
+    QueueManager_after_fork(self);
+    if (!pqm->reconnect_attempts)
+    {
+        return QueueManager_call_once(self, hash, body);
+    }
+
+    arg.self = self;
+    arg.hash = hash;
+    arg.body = body;
+    for (attempt = 0; ; attempt++)
+    {
+        connection_id = pqm->connection_id;
+        pqm->comp_code   = 0;
+        pqm->reason_code = 0;
+        if (pqm->share_handle) QueueManager_thread_status_set(self, 0, 0);
+
+        result = rb_protect(QueueManager_reconnect_body, (VALUE)&arg, &state);
+        error  = Qnil;
+        if (state && RB_TYPE_P(rb_errinfo(), T_OBJECT))  /* Raised, rather than thrown */
+        {
+            error = rb_errinfo();                     /* Not left in $! while reconnecting, or after a retry */
+            rb_set_errinfo(errinfo);
+        }
+
+        QueueManager_thread_status(self, pqm, &comp_code, &reason_code);
+        if (!QueueManager_connection_error(reason_code))
+        {
+            break;
+        }
+
+        if(pqm->trace_level) printf("WMQ::QueueManager Connection lost with reason:%s, reconnecting\n", wmq_reason(reason_code));
+        if (!QueueManager_reconnect(self, connection_id) || !retry || attempt >= pqm->reconnect_attempts)
+        {
+            pqm->comp_code   = comp_code;                 /* Report why the call failed */
+            pqm->reason_code = reason_code;
+            if (pqm->share_handle) QueueManager_thread_status_set(self, comp_code, reason_code);
+            break;
+        }
+    }
+
+    if (!NIL_P(error))
+    {
+        rb_exc_raise(error);
+    }
+    if (state)
+    {
+        rb_jump_tag(state);
+    }
+    return result;
+}
+
+/* MQ calls that can wait for the connection, made without the GVL when it is shared */
+struct QueueManager_mq_arg {
+    PQUEUE_MANAGER pqm;
+    PMQOD          pod;
+    PMQMD          pmd;
+    PMQPMO         ppmo;
+    MQLONG         length;
+    PMQVOID        p_buffer;
+};
+
+static void* QueueManager_mqput1(void* p)
+{
+    struct QueueManager_mq_arg* parg = (struct QueueManager_mq_arg*)p;
+    PQUEUE_MANAGER pqm = parg->pqm;
+    pqm->MQPUT1(pqm->hcon, parg->pod, parg->pmd, parg->ppmo, parg->length, parg->p_buffer, &pqm->comp_code, &pqm->reason_code);
+    return 0;
+}
+
+static void* QueueManager_mqcmit(void* p)
+{
+    PQUEUE_MANAGER pqm = (PQUEUE_MANAGER)p;
+    pqm->MQCMIT(pqm->hcon, &pqm->comp_code, &pqm->reason_code);
+    return 0;
+}
+
+static void* QueueManager_mqback(void* p)
+{
+    PQUEUE_MANAGER pqm = (PQUEUE_MANAGER)p;
+    pqm->MQBACK(pqm->hcon, &pqm->comp_code, &pqm->reason_code);
+    return 0;
+}
+
+/*
+ * Forget the connection without calling MQ, since its handles belong to the parent process
+ */
+static void QueueManager_discard(PQUEUE_MANAGER pqm)
+{
+    if(pqm->trace_level)
+        printf("WMQ::QueueManager Discarding connection inherited from process %ld\n", (long)pqm->pid);
+
+    pqm->hcon = 0;
+    pqm->already_connected = 0;
+    pqm->inquire_hobj = MQHO_UNUSABLE_HOBJ;
+  #ifdef MQHB_UNUSABLE_HBAG
+    pqm->admin_bag = MQHB_UNUSABLE_HBAG;               /* Not deleted, since they belong to the parent */
+    pqm->reply_bag = MQHB_UNUSABLE_HBAG;
+  #endif
+    pqm->connection_id++;                             /* Queues opened on it are opened again */
+    pqm->pid = getpid();
+}
+
 /*
  * Before working with any queues, it is necessary to connect
  * to the queue manager.
@@ -404,6 +730,10 @@ VALUE QueueManager_connect(VALUE self)
     if(pqm->trace_level)
         printf("WMQ::QueueManager#connect() Connect to Queue Manager:%s\n", RSTRING_PTR(name));
 
+    if (pqm->hcon && pqm->pid != getpid())            /* Connected in the parent process */
+    {
+        QueueManager_discard(pqm);
+    }
     if (pqm->hcon)                                    /* Disconnect from qmgr if already connected, ignore errors */
     {
         if(pqm->trace_level)
@@ -411,6 +741,7 @@ VALUE QueueManager_connect(VALUE self)
 
         pqm->MQDISC(&pqm->hcon, &pqm->comp_code, &pqm->reason_code);
     }
+    pqm->inquire_hobj = MQHO_UNUSABLE_HOBJ;          /* Object handles do not survive MQDISC */
 
     pqm->MQCONNX(
             RSTRING_PTR(name),       /* queue manager                  */
@@ -424,6 +755,8 @@ VALUE QueueManager_connect(VALUE self)
                wmq_reason(pqm->reason_code),
                (long)pqm->hcon);
 
+    if (pqm->share_handle) QueueManager_thread_status_set(self, pqm->comp_code, pqm->reason_code);
+
     if (pqm->comp_code == MQCC_FAILED)
     {
         pqm->hcon = 0;
@@ -444,10 +777,125 @@ VALUE QueueManager_connect(VALUE self)
         if(pqm->trace_level) printf("WMQ::QueueManager#connect() Already connected\n");
         pqm->already_connected = 1;
     }
+    pqm->connection_id++;
+    pqm->pid = getpid();
 
     return Qtrue;
 }
 
+/*
+ * When the connection was made in the parent of a forked process, discard it,
+ * and with :reconnect_after_fork connect again
+ *
+ * Returns 1 when the connection was inherited from the parent process
+ */
+int QueueManager_after_fork(VALUE self)
+{
+    PQUEUE_MANAGER pqm;
+    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+
+    if (!pqm->hcon || pqm->pid == getpid())
+    {
+        return 0;
+    }
+
+    QueueManager_discard(pqm);
+    if (pqm->reconnect_after_fork)
+    {
+        QueueManager_connect(self);
+    }
+    return 1;
+}
+
+static VALUE QueueManager_reconnect_attempts(VALUE self)
+{
+    VALUE  name;
+    MQLONG wait;
+    MQLONG attempt;
+    MQLONG comp_code;
+    MQLONG reason_code;
+
+    PQUEUE_MANAGER pqm;
+    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+
+    name = rb_iv_get(self,"@name");
+    name = StringValue(name);
+
+    wait = pqm->reconnect_wait;
+    for (attempt = 1; attempt <= pqm->reconnect_attempts; attempt++)
+    {
+        /* Wait between half and all of wait, so that clients do not all reconnect at once */
+        double delay = (wait / 2 + (wait - wait / 2) * rb_genrand_real()) / 1000.0;
+
+        if(pqm->trace_level)
+            printf("WMQ::QueueManager#reconnect() Attempt %ld of %ld to Queue Manager:%s in %.3f seconds\n",
+                   (long)attempt, (long)pqm->reconnect_attempts, RSTRING_PTR(name), delay);
+
+        rb_thread_wait_for(rb_time_interval(rb_float_new(delay)));
+
+        if (pqm->hcon)                                /* Release the broken connection, ignore errors */
+        {
+            pqm->MQDISC(&pqm->hcon, &comp_code, &reason_code);
+            pqm->hcon = 0;
+        }
+        pqm->inquire_hobj = MQHO_UNUSABLE_HOBJ;
+
+        pqm->MQCONNX(RSTRING_PTR(name), &pqm->connect_options, &pqm->hcon, &pqm->comp_code, &pqm->reason_code);
+
+        if(pqm->trace_level)
+            printf("WMQ::QueueManager#reconnect() MQCONNX completed with reason:%s, Handle:%ld\n",
+                   wmq_reason(pqm->reason_code),
+                   (long)pqm->hcon);
+
+        if (pqm->comp_code != MQCC_FAILED)
+        {
+            pqm->already_connected = (pqm->reason_code == MQRC_ALREADY_CONNECTED);
+            pqm->connection_id++;
+            pqm->pid = getpid();
+            return Qtrue;
+        }
+        pqm->hcon = 0;
+
+        wait *= 2;
+        if (wait > WMQ_RECONNECT_WAIT_MAX) wait = WMQ_RECONNECT_WAIT_MAX;
+    }
+    return Qfalse;
+}
+
+static VALUE QueueManager_reconnect_done(VALUE self)
+{
+    PQUEUE_MANAGER pqm;
+    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+    pqm->reconnecting = 0;
+    return Qnil;
+}
+
+/*
+ * Reconnect after the connection was broken, waiting longer between each attempt
+ *
+ * connection_id is the connection the caller found to be broken. If another
+ * caller has already reconnected since, the new connection is used as is.
+ *
+ * Returns 1 when connected, 0 when all attempts failed
+ */
+int QueueManager_reconnect(VALUE self, long connection_id)
+{
+    PQUEUE_MANAGER pqm;
+    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+
+    while (pqm->reconnecting)                         /* Another thread is reconnecting, wait for it */
+    {
+        rb_thread_wait_for(rb_time_interval(rb_float_new(pqm->reconnect_wait / 1000.0)));
+    }
+    if (pqm->connection_id != connection_id)
+    {
+        return pqm->hcon != 0;
+    }
+
+    pqm->reconnecting = 1;
+    return RTEST(rb_ensure(QueueManager_reconnect_attempts, self, QueueManager_reconnect_done, self));
+}
+
 /*
  * Disconnect from this QueueManager instance
  *
@@ -470,12 +918,22 @@ VALUE QueueManager_disconnect(VALUE self)
 
     if(pqm->trace_level) printf ("WMQ::QueueManager#disconnect() Queue Manager Handle:%ld\n", (long)pqm->hcon);
 
+    if (pqm->hcon && pqm->pid != getpid())            /* Connected in the parent process, do not call MQDISC */
+    {
+        QueueManager_discard(pqm);
+        pqm->comp_code = 0;
+        pqm->reason_code = 0;
+        return Qtrue;
+    }
+
     if (!pqm->already_connected)
     {
         pqm->MQDISC(&pqm->hcon, &pqm->comp_code, &pqm->reason_code);
 
         if(pqm->trace_level) printf("WMQ::QueueManager#disconnect() MQDISC completed with reason:%s\n", wmq_reason(pqm->reason_code));
 
+        if (pqm->share_handle) QueueManager_thread_status_set(self, pqm->comp_code, pqm->reason_code);
+
         if (pqm->comp_code != MQCC_OK)
         {
             if (pqm->exception_on_error)
@@ -501,6 +959,7 @@ VALUE QueueManager_disconnect(VALUE self)
     }
 
     pqm->hcon = 0;
+    pqm->inquire_hobj = MQHO_UNUSABLE_HOBJ;
 
     return Qtrue;
 }
@@ -524,14 +983,14 @@ VALUE QueueManager_disconnect(VALUE self)
  * * Except if exception_on_error:  false was supplied as a parameter
  *   to QueueManager.new
  */
-VALUE QueueManager_commit(VALUE self)
+static VALUE QueueManager_commit_body(struct QueueManager_call_arg* parg)
 {
-    PQUEUE_MANAGER pqm;
-    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+    VALUE          self = parg->self;
+    PQUEUE_MANAGER pqm  = parg->pqm;
 
     if(pqm->trace_level) printf ("WMQ::QueueManager#commit() Queue Manager Handle:%ld\n", (long)pqm->hcon);
 
-    pqm->MQCMIT(pqm->hcon, &pqm->comp_code, &pqm->reason_code);
+    WMQ_CALL_WITHOUT_GVL(pqm->release_gvl, QueueManager_mqcmit, pqm)
 
     if(pqm->trace_level) printf("WMQ::QueueManager#commit() MQCMIT completed with reason:%s\n", wmq_reason(pqm->reason_code));
 
@@ -553,6 +1012,11 @@ VALUE QueueManager_commit(VALUE self)
     return Qtrue;
 }
 
+VALUE QueueManager_commit(VALUE self)
+{
+    return QueueManager_call(self, Qnil, QueueManager_commit_body, 0);
+}
+
 /*
  * Backout the current unit of work for this QueueManager instance
  *
@@ -576,14 +1040,14 @@ VALUE QueueManager_commit(VALUE self)
  * * Except if exception_on_error:  false was supplied as a parameter
  *   to QueueManager.new
  */
-VALUE QueueManager_backout(VALUE self)
+static VALUE QueueManager_backout_body(struct QueueManager_call_arg* parg)
 {
-    PQUEUE_MANAGER pqm;
-    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+    VALUE          self = parg->self;
+    PQUEUE_MANAGER pqm  = parg->pqm;
 
     if(pqm->trace_level) printf ("WMQ::QueueManager#backout() Queue Manager Handle:%ld\n", (long)pqm->hcon);
 
-    pqm->MQBACK(pqm->hcon, &pqm->comp_code, &pqm->reason_code);
+    WMQ_CALL_WITHOUT_GVL(pqm->release_gvl, QueueManager_mqback, pqm)
 
     if(pqm->trace_level) printf("WMQ::QueueManager#backout() MQBACK completed with reason:%s\n", wmq_reason(pqm->reason_code));
 
@@ -605,6 +1069,11 @@ VALUE QueueManager_backout(VALUE self)
     return Qtrue;
 }
 
+VALUE QueueManager_backout(VALUE self)
+{
+    return QueueManager_call(self, Qnil, QueueManager_backout_body, 0);
+}
+
 /*
  * Advanced WebSphere MQ Use:
  *
@@ -626,10 +1095,10 @@ VALUE QueueManager_backout(VALUE self)
  * * Except if exception_on_error:  false was supplied as a parameter
  *   to QueueManager.new
  */
-VALUE QueueManager_begin(VALUE self)
+static VALUE QueueManager_begin_body(struct QueueManager_call_arg* parg)
 {
-    PQUEUE_MANAGER pqm;
-    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+    VALUE          self = parg->self;
+    PQUEUE_MANAGER pqm  = parg->pqm;
 
     if(pqm->trace_level) printf ("WMQ::QueueManager#begin() Queue Manager Handle:%ld\n", (long)pqm->hcon);
 
@@ -655,6 +1124,11 @@ VALUE QueueManager_begin(VALUE self)
     return Qtrue;
 }
 
+VALUE QueueManager_begin(VALUE self)
+{
+    return QueueManager_call(self, Qnil, QueueManager_begin_body, 0);
+}
+
 /*
  * call-seq:
  *   put(parameters)
@@ -675,6 +1149,7 @@ VALUE QueueManager_begin(VALUE self)
  *    new_id:            true,                          # MQPMO_NEW_MSG_ID & MQPMO_NEW_CORREL_ID
  *    new_msg_id:        true,                          # MQPMO_NEW_MSG_ID
  *    new_correl_id:     true,                          # MQPMO_NEW_CORREL_ID
+ *    properties:        {'Name' => 'Value'},           # MQSETMP
  *    fail_if_quiescing: true,                          # MQOO_FAIL_IF_QUIESCING
  *    options:           WMQ::MQPMO_FAIL_IF_QUIESCING   # MQPMO_*
  *   )
@@ -734,6 +1209,11 @@ VALUE QueueManager_begin(VALUE self)
  *   * Generate a new correlation id for this message
  *      Default: false
  *
+ * * :properties => Hash
+ *   * Message properties to set on the message, as for WMQ::Queue#put
+ *   * Requires WebSphere MQ V7 or later
+ *      Default: message.properties
+ *
  * * :fail_if_quiescing => true or false
  *   * Determines whether the WMQ::Queue#put call will fail if the queue manager is
  *     in the process of being quiesced.
@@ -782,8 +1262,10 @@ VALUE QueueManager_begin(VALUE self)
  * * Except if exception_on_error:  false was supplied as a parameter
  *   to QueueManager.new
  */
-VALUE QueueManager_put(VALUE self, VALUE hash)
+static VALUE QueueManager_put_body(struct QueueManager_call_arg* parg)
 {
+    VALUE    self = parg->self;
+    VALUE    hash = parg->hash;
     MQLONG   BufferLength;           /* Length of the message in Buffer */
     PMQVOID  pBuffer;                /* Message data                  */
     MQMD     md = {MQMD_DEFAULT};    /* Message Descriptor            */
@@ -794,9 +1276,9 @@ VALUE QueueManager_put(VALUE self, VALUE hash)
     size_t   size;
     size_t   length;
     VALUE    val;
+    struct QueueManager_mq_arg mq_arg;
 
-    PQUEUE_MANAGER pqm;
-    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+    PQUEUE_MANAGER pqm = parg->pqm;
 
     Check_Type(hash, T_HASH);
 
@@ -827,21 +1309,23 @@ VALUE QueueManager_put(VALUE self, VALUE hash)
 
     Queue_extract_put_message_options(hash, &pmo);
     Message_build(&pqm->p_buffer, &pqm->buffer_size, pqm->trace_level,
-                  hash, &pBuffer, &BufferLength,    &md);
+                  hash, &pBuffer, &BufferLength,    &md, 0);
 
     if(pqm->trace_level) printf("WMQ::QueueManager#put Queue Manager Handle:%ld\n", (long)pqm->hcon);
 
-    pqm->MQPUT1(
-           pqm->hcon,           /* connection handle               */
-           &od,                 /* object descriptor               */
-           &md,                 /* message descriptor              */
-           &pmo,                /* put message options             */
-           BufferLength,        /* message length                  */
-           pBuffer,             /* message buffer                  */
-           &pqm->comp_code,     /* completion code                 */
-           &pqm->reason_code);  /* reason code                     */
-
-    if(pqm->trace_level) printf("WMQ::QueueManager#put MQPUT1 ended with reason:%s\n", wmq_reason(pqm->reason_code));
+    if (Queue_manager_put_properties(pqm, hash, &pmo))
+    {
+        mq_arg.pqm      = pqm;
+        mq_arg.pod      = &od;                        /* object descriptor               */
+        mq_arg.pmd      = &md;                        /* message descriptor              */
+        mq_arg.ppmo     = &pmo;                       /* put message options             */
+        mq_arg.length   = BufferLength;               /* message length                  */
+        mq_arg.p_buffer = pBuffer;                    /* message buffer                  */
+        WMQ_CALL_WITHOUT_GVL(pqm->release_gvl, QueueManager_mqput1, &mq_arg)
+
+        if(pqm->trace_level) printf("WMQ::QueueManager#put MQPUT1 ended with reason:%s\n", wmq_reason(pqm->reason_code));
+    }
+    Queue_manager_delete_hmsg(pqm, &pmo);
 
     if (pqm->reason_code != MQRC_NONE)
     {
@@ -870,8 +1354,23 @@ VALUE QueueManager_put(VALUE self, VALUE hash)
     return Qtrue;
 }
 
+VALUE QueueManager_put(VALUE self, VALUE hash)
+{
+    MQPMO pmo = {MQPMO_DEFAULT};
+    PQUEUE_MANAGER pqm;
+    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+
+    Check_Type(hash, T_HASH);
+    if (pqm->reconnect_attempts)                      /* Retry unless in a unit of work */
+    {
+        Queue_extract_put_message_options(hash, &pmo);
+    }
+    return QueueManager_call(self, hash, QueueManager_put_body, !(pmo.Options & MQPMO_SYNCPOINT));
+}
+
 /*
  * Return the completion code for the last MQ operation
+ * With :share_handle, the last MQ operation by the current thread
  *
  * Returns => FixNum
  * * WMQ::MQCC_OK       0
@@ -882,9 +1381,11 @@ VALUE QueueManager_put(VALUE self, VALUE hash)
  */
 VALUE QueueManager_comp_code(VALUE self)
 {
+    MQLONG comp_code, reason_code;
     PQUEUE_MANAGER pqm;
     Data_Get_Struct(self, QUEUE_MANAGER, pqm);
-    return LONG2NUM(pqm->comp_code);
+    QueueManager_thread_status(self, pqm, &comp_code, &reason_code);
+    return LONG2NUM(comp_code);
 }
 
 /*
@@ -900,9 +1401,11 @@ VALUE QueueManager_comp_code(VALUE self)
  */
 VALUE QueueManager_reason_code(VALUE self)
 {
+    MQLONG comp_code, reason_code;
     PQUEUE_MANAGER pqm;
     Data_Get_Struct(self, QUEUE_MANAGER, pqm);
-    return LONG2NUM(pqm->reason_code);
+    QueueManager_thread_status(self, pqm, &comp_code, &reason_code);
+    return LONG2NUM(reason_code);
 }
 
 /*
@@ -918,9 +1421,11 @@ VALUE QueueManager_reason_code(VALUE self)
  */
 VALUE QueueManager_reason(VALUE self)
 {
+    MQLONG comp_code, reason_code;
     PQUEUE_MANAGER pqm;
     Data_Get_Struct(self, QUEUE_MANAGER, pqm);
-    return rb_str_new2(wmq_reason(pqm->reason_code));
+    QueueManager_thread_status(self, pqm, &comp_code, &reason_code);
+    return rb_str_new2(wmq_reason(reason_code));
 }
 
 /*
@@ -948,6 +1453,23 @@ VALUE QueueManager_exception_on_error(VALUE self)
     return Qfalse;
 }
 
+/* Whether reason_code means that the connection can no longer be used */
+int QueueManager_connection_error(MQLONG reason_code)
+{
+    switch (reason_code)
+    {
+        case MQRC_CONNECTION_BROKEN:
+        case MQRC_CONNECTION_QUIESCING:
+        case MQRC_CONNECTION_STOPPING:
+        case MQRC_HCONN_ERROR:
+        case MQRC_Q_MGR_NOT_AVAILABLE:
+        case MQRC_Q_MGR_QUIESCING:
+        case MQRC_Q_MGR_STOPPING:
+            return 1;
+    }
+    return 0;
+}
+
 /*
  * Returns whether this QueueManager instance is currently
  * connected to a WebSphere MQ queue manager
@@ -961,13 +1483,76 @@ VALUE QueueManager_connected_q(VALUE self)
 {
     PQUEUE_MANAGER pqm;
     Data_Get_Struct(self, QUEUE_MANAGER, pqm);
-    if (pqm->hcon)
+    if (pqm->hcon && pqm->pid == getpid())
     {
         return Qtrue;
     }
     return Qfalse;
 }
 
+/*
+ * Returns whether the connection to the queue manager is still usable
+ *
+ * Unlike connected?, which only checks for a connection handle, alive? makes
+ * an MQINQ call against the queue manager object to find out whether the
+ * connection has been broken or the queue manager is ending.
+ * The queue manager object is opened on the first call and kept open until disconnect.
+ *
+ * Returns:
+ * * true : The connection can be used
+ * * false: Not connected, or the connection is broken / quiescing.
+ *   Reconnect before using this QueueManager again
+ *
+ *   comp_code and reason_code are also updated.
+ *   Never raises an exception, regardless of exception_on_error
+ *
+ * Note:
+ * * Not for use by several threads at the same time, even with :share_handle
+ */
+VALUE QueueManager_alive_q(VALUE self)
+{
+    MQLONG selector = MQIA_COMMAND_LEVEL;
+    MQLONG command_level;
+
+    PQUEUE_MANAGER pqm;
+    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+
+    QueueManager_after_fork(self);
+    if (!pqm->hcon)
+    {
+        return Qfalse;
+    }
+
+    if (pqm->inquire_hobj == MQHO_UNUSABLE_HOBJ)      /* Lazy open queue manager object */
+    {
+        MQOD od = {MQOD_DEFAULT};
+        MQHOBJ hobj;
+
+        od.ObjectType = MQOT_Q_MGR;
+        pqm->MQOPEN(pqm->hcon, &od, MQOO_INQUIRE | MQOO_FAIL_IF_QUIESCING, &hobj, &pqm->comp_code, &pqm->reason_code);
+        if(pqm->trace_level) printf("WMQ::QueueManager#alive? MQOPEN ended with reason:%s\n", wmq_reason(pqm->reason_code));
+
+        if (pqm->comp_code == MQCC_FAILED)
+        {
+            return QueueManager_connection_error(pqm->reason_code) ? Qfalse : Qtrue;
+        }
+        pqm->inquire_hobj = hobj;
+    }
+
+    pqm->MQINQ(pqm->hcon, pqm->inquire_hobj, 1, &selector, 1, &command_level, 0, 0, &pqm->comp_code, &pqm->reason_code);
+    if(pqm->trace_level) printf("WMQ::QueueManager#alive? MQINQ ended with reason:%s\n", wmq_reason(pqm->reason_code));
+
+    if (pqm->reason_code == MQRC_HOBJ_ERROR)          /* Re-open on the next call */
+    {
+        pqm->inquire_hobj = MQHO_UNUSABLE_HOBJ;
+    }
+    if (pqm->comp_code == MQCC_FAILED && QueueManager_connection_error(pqm->reason_code))
+    {
+        return Qfalse;
+    }
+    return Qtrue;
+}
+
 /*
  * Returns the QueueManager name => String
  */
@@ -1073,6 +1658,11 @@ static VALUE QueueManager_singleton_connect_ensure(VALUE self)
  *   q_mgr_name:          'queue_manager name',
  *   exception_on_error:  true,                          # n/a
  *   connect_options:     WMQ::MQCNO_FASTBATH_BINDING    # MQCNO.Options
+ *   share_handle:        false,                         # MQCNO_HANDLE_SHARE_BLOCK
+ *   release_gvl:         false,                         # n/a
+ *   reconnect:           false,                         # n/a
+ *   reconnect_wait:      100,                           # n/a
+ *   reconnect_after_fork: true,                         # n/a
  *
  *   trace_level:         0,                             # n/a
  *
@@ -1139,6 +1729,52 @@ static VALUE QueueManager_singleton_connect_ensure(VALUE self)
  *   * Please see the WebSphere MQ MQCNO data type documentation for more details
  *      Default: WMQ::MQCNO_NONE
  *
+ * * :share_handle => true or false
+ *   * Allow several Ruby threads to use this connection at the same time
+ *     by connecting with WMQ::MQCNO_HANDLE_SHARE_BLOCK
+ *   * MQ calls on the connection are made without holding the GVL, see :release_gvl,
+ *     and the buffers, admin bags, comp_code and reason_code are kept per call / per thread
+ *   * The unit of work belongs to the connection, so begin, commit and backout
+ *     apply to the work of every thread using it
+ *   * Each thread should open its own WMQ::Queue
+ *      Default: false
+ *
+ * * :release_gvl => true or false
+ *   * Make MQ calls without holding the GVL, so that other Ruby threads run while
+ *     a thread waits in MQ. E.g. In a get with :wait, or a commit
+ *   * Only the thread making a call uses the connection, unlike :share_handle
+ *   * Always true with :share_handle
+ *      Default: false
+ *
+ * * :reconnect => true, false or FixNum
+ *   * Reconnect when a call fails because the connection was broken or the
+ *     queue manager is ending. E.g. MQRC_CONNECTION_BROKEN
+ *   * FixNum is the number of attempts to reconnect, true is 5 attempts
+ *   * Queues opened on this connection are opened again with the same options.
+ *     Dynamic queues are re-created with the same name, and a browse continues
+ *     after the last message browsed
+ *   * The failed call is then made again, except for calls under syncpoint
+ *     and commit, backout and begin. The queue manager has already backed out
+ *     the unit of work, so these calls fail as before and the unit of work
+ *     needs to be started again
+ *   * For client connections WMQ::MQCNO_RECONNECT can instead be supplied
+ *     in :connect_options, to have the MQ client reconnect itself
+ *      Default: false
+ *
+ * * :reconnect_wait => FixNum
+ *   * Milliseconds to wait before the first reconnect attempt. The wait is
+ *     doubled for each further attempt, up to 10 seconds, and a random part
+ *     is taken off so that many clients do not all reconnect at the same time
+ *      Default: 100
+ *
+ * * :reconnect_after_fork => true or false
+ *   * MQ handles can only be used by the process that created them. In a forked
+ *     child, E.g. a Unicorn or Puma worker, the connection inherited from the parent
+ *     is discarded without calling MQ, and with true a new connection is made
+ *     the first time it is used. Queues are opened again on their next get or put
+ *   * With false the child needs to call connect itself
+ *      Default: true
+ *
  * * :trace_level => FixNum
  *   * Turns on low-level tracing of the WebSphere MQ API calls to stdout.
  *     * 0: No tracing
@@ -1368,12 +2004,37 @@ static int QueueManager_execute_each (VALUE key, VALUE value, PQUEUE_MANAGER pqm
  *
  *   qmgr.inquire_channel_status(channel_name: '*').each {|item| p item }
  */
-VALUE QueueManager_execute(VALUE self, VALUE hash)
-{
 #ifdef MQHB_UNUSABLE_HBAG
-    VALUE          val;
+struct QueueManager_execute_arg {
     PQUEUE_MANAGER pqm;
-    Data_Get_Struct(self, QUEUE_MANAGER, pqm);
+    MQLONG         command;
+};
+
+static void* QueueManager_mqexecute(void* p)
+{
+    struct QueueManager_execute_arg* parg = (struct QueueManager_execute_arg*)p;
+    PQUEUE_MANAGER pqm = parg->pqm;
+
+    pqm->mqExecute(
+              pqm->hcon,                              /* MQ connection handle                 */
+              parg->command,                          /* Command to be executed               */
+              MQHB_NONE,                              /* No options bag                       */
+              pqm->admin_bag,                         /* Handle to bag containing commands    */
+              pqm->reply_bag,                         /* Handle to bag to receive the response*/
+              MQHO_NONE,                              /* Put msg on SYSTEM.ADMIN.COMMAND.QUEUE*/
+              MQHO_NONE,                              /* Create a dynamic q for the response  */
+              &pqm->comp_code,                        /* Completion code from the mqexecute   */
+              &pqm->reason_code);                     /* Reason code from mqexecute call      */
+    return 0;
+}
+
+static VALUE QueueManager_execute_body(struct QueueManager_call_arg* parg)
+{
+    VALUE          self = parg->self;
+    VALUE          hash = parg->hash;
+    VALUE          val;
+    PQUEUE_MANAGER pqm  = parg->pqm;
+    struct QueueManager_execute_arg execute_arg;
 
     Check_Type(hash, T_HASH);
 
@@ -1407,16 +2068,9 @@ VALUE QueueManager_execute(VALUE self, VALUE hash)
     rb_hash_foreach(hash, QueueManager_execute_each, (VALUE)pqm);
     if(pqm->trace_level) printf ("WMQ::QueueManager#execute() Queue Manager Handle:%ld\n", (long)pqm->hcon);
 
-    pqm->mqExecute(
-              pqm->hcon,                              /* MQ connection handle                 */
-              wmq_command_lookup(rb_to_id(val)),      /* Command to be executed               */
-              MQHB_NONE,                              /* No options bag                       */
-              pqm->admin_bag,                         /* Handle to bag containing commands    */
-              pqm->reply_bag,                         /* Handle to bag to receive the response*/
-              MQHO_NONE,                              /* Put msg on SYSTEM.ADMIN.COMMAND.QUEUE*/
-              MQHO_NONE,                              /* Create a dynamic q for the response  */
-              &pqm->comp_code,                        /* Completion code from the mqexecute   */
-              &pqm->reason_code);                     /* Reason code from mqexecute call      */
+    execute_arg.pqm     = pqm;
+    execute_arg.command = wmq_command_lookup(rb_to_id(val));
+    WMQ_CALL_WITHOUT_GVL(pqm->release_gvl, QueueManager_mqexecute, &execute_arg)
 
     if(pqm->trace_level) printf("WMQ::QueueManager#execute() completed with reason:%s\n", wmq_reason(pqm->reason_code));
 
@@ -1570,6 +2224,13 @@ VALUE QueueManager_execute(VALUE self, VALUE hash)
         return Qfalse;
     }
     return Qnil;
+}
+#endif
+
+VALUE QueueManager_execute(VALUE self, VALUE hash)
+{
+#ifdef MQHB_UNUSABLE_HBAG
+    return QueueManager_call(self, hash, QueueManager_execute_body, 1);
 #else
     rb_notimplement();
     return Qfalse;
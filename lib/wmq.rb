@@ -3,6 +3,15 @@ require 'wmq/constants'
 require 'wmq/constants_admin'
 require 'wmq/queue_manager'
 require 'wmq/message'
+require 'wmq/async_consumer'
+require 'wmq/connection_pool'
+require 'wmq/batching_producer'
+require 'wmq/retry_scheduler'
+require 'wmq/requester'
+require 'wmq/dynamic_queue_pool'
+require 'wmq/worker_threads'
+require 'wmq/server'
+require 'wmq/partitioned_dispatcher'
 
 # Load wmq using the auto-load library.
 #
@@ -0,0 +1,42 @@
+# AsyncConsumer ruby methods
+module WMQ
+  class AsyncConsumer
+    # Returns [message, queue] for the next message received from any of the
+    # registered queues, waiting up to timeout seconds for one to arrive
+    #
+    # Returns nil when:
+    # * No message arrives within timeout seconds
+    # * The consumer is stopped and all received messages have been returned
+    # * MQ reported a failure to the consumer and exception_on_error is false.
+    #   See #reason
+    #
+    # Waits using IO.select, so other threads, or fibers under a fiber
+    # scheduler, continue to run while waiting.
+    #
+    # Example:
+    #   message, queue = consumer.pop(5)
+    def pop(timeout = nil)
+      deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout if timeout
+      loop do
+        result = pop_nonblock
+        return result if result
+        return nil if !started? || (comp_code == WMQ::MQCC_FAILED)
+
+        remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC) if deadline
+        return nil if remaining && (remaining <= 0)
+        IO.select([to_io], nil, nil, remaining)
+      end
+    end
+
+    # Yields each message received, and the queue it was received from,
+    # until the consumer is stopped or no message arrives within timeout seconds
+    #
+    # Example:
+    #   consumer.each { |message, queue| p message.data }
+    def each(timeout = nil)
+      while (result = pop(timeout))
+        yield(*result)
+      end
+    end
+  end
+end
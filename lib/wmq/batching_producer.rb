@@ -0,0 +1,241 @@
+module WMQ
+  # Put messages under syncpoint in batches, committing once :batch_size
+  # messages or :linger_ms milli-seconds have accumulated
+  #
+  # Every persistent message put outside of syncpoint forces a write to the
+  # queue manager log. Putting messages from many calls to #put in one unit
+  # of work only forces the log once for the whole batch.
+  #
+  # * The messages are put by a background thread on its own connection, so
+  #   #put can be called from any thread.
+  # * #put returns a BatchingProducer::Promise, which completes once the
+  #   batch containing the message has been committed.
+  # * When a put fails, only the promise for that message fails. When the
+  #   commit fails, the whole batch is backed out and every promise in it fails.
+  #
+  # Example:
+  #   producer = WMQ::BatchingProducer.new(q_mgr_name: 'REID', q_name: 'TEST.QUEUE', batch_size: 100, linger_ms: 10)
+  #
+  #   promises = 1000.times.collect { |i| producer.put(data: "Message #{i}") }
+  #   promises.each(&:value)
+  #
+  #   producer.close
+  class BatchingProducer
+    # Completed once the batch containing the message is committed, or has failed
+    class Promise
+      def initialize
+        @mutex     = Mutex.new
+        @condition = ConditionVariable.new
+        @complete  = false
+        @error     = nil
+      end
+
+      # Whether the batch containing the message has been committed, or has failed
+      def complete?
+        @mutex.synchronize { @complete }
+      end
+
+      # Wait for the batch containing the message to be committed
+      #
+      # Returns true once committed, or false if not complete within timeout seconds
+      #
+      # Raises the exception that caused the put or commit to fail
+      def value(timeout = nil)
+        return false unless wait(timeout)
+        raise(@error) if @error
+        true
+      end
+
+      # Wait up to timeout seconds for the promise to complete, without raising
+      # Returns whether it is complete
+      def wait(timeout = nil)
+        deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout if timeout
+        @mutex.synchronize do
+          until @complete
+            remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC) if deadline
+            return false if remaining && (remaining <= 0)
+            @condition.wait(@mutex, remaining)
+          end
+          true
+        end
+      end
+
+      # Exception that caused the put or commit to fail, if any
+      def error
+        @mutex.synchronize { @error }
+      end
+
+      # :nodoc:
+      def complete(error = nil)
+        @mutex.synchronize do
+          @error    = error
+          @complete = true
+          @condition.broadcast
+        end
+      end
+    end
+
+    attr_reader :batch_size, :linger_ms
+
+    # Parameters:
+    # * :q_name       Queue to put messages to, unless :q_name is passed to #put
+    # * :batch_size   Commit once this many messages have been put. Default: 100
+    # * :linger_ms    Commit once the first message in the batch was put this many
+    #                 milli-seconds ago. Default: 10
+    # * :max_pending  Maximum number of messages waiting to be put, before #put
+    #                 waits for the background thread to catch up. Default: 10000
+    # * All other parameters are passed to WMQ::QueueManager.new
+    def initialize(params = {})
+      params       = params.dup
+      @q_name      = params.delete(:q_name)
+      @batch_size  = params.delete(:batch_size) || 100
+      @linger_ms   = params.delete(:linger_ms) || 10
+      @max_pending = params.delete(:max_pending) || 10_000
+      raise(ArgumentError, ':batch_size must be at least 1') if @batch_size < 1
+
+      @queue_manager = WMQ::QueueManager.new(params)
+      @pending       = []
+      @mutex         = Mutex.new
+      @condition     = ConditionVariable.new
+      @closed        = false
+      @flushing      = 0
+      @last_promise  = nil
+      @stats         = {batches: 0, messages: 0, max_batch_size: 0, failed_messages: 0, failed_batches: 0}
+      @thread        = Thread.new { run }
+    end
+
+    # Queue a message to be put in the next batch, and return its Promise
+    #
+    # Parameters are the same as for WMQ::Queue#put, plus:
+    # * :q_name  Queue to put the message to, instead of the one supplied to new
+    #
+    # The :message must not be modified until its promise completes
+    #
+    # Raises WMQ::WMQException when the producer is closed
+    def put(params)
+      params = params.dup
+      q_name = params.delete(:q_name) || @q_name
+      raise(ArgumentError, 'WMQ::BatchingProducer#put requires :q_name, since none was supplied to new') unless q_name
+
+      promise = Promise.new
+      @mutex.synchronize do
+        @condition.wait(@mutex) while !@closed && (@pending.size >= @max_pending)
+        raise(WMQ::WMQException, 'WMQ::BatchingProducer is closed') if @closed
+
+        @pending << [q_name, params, promise]
+        @last_promise = promise
+        @condition.broadcast
+      end
+      promise
+    end
+
+    # Commit the messages already put without waiting for :linger_ms, and wait
+    # for them to complete
+    def flush
+      promise = @mutex.synchronize do
+        @flushing += 1
+        @condition.broadcast
+        @last_promise
+      end
+      promise.wait if promise
+    ensure
+      @mutex.synchronize { @flushing -= 1 }
+    end
+
+    # Put and commit any messages already queued, then disconnect
+    def close
+      @mutex.synchronize do
+        @closed = true
+        @condition.broadcast
+      end
+      @thread.join
+      nil
+    end
+
+    # Returns a Hash of counters
+    # * :batches          Units of work committed
+    # * :messages         Messages in those units of work
+    # * :max_batch_size   Most messages in one of them
+    # * :failed_messages  Messages whose put or commit failed
+    # * :failed_batches   Units of work whose commit failed
+    def stats
+      @mutex.synchronize { @stats.dup }
+    end
+
+    private
+
+    def run
+      queues = {}
+      while (batch = next_batch)
+        put_batch(batch, queues)
+      end
+    ensure
+      queues.each_value { |queue| queue.close rescue nil }
+      @queue_manager.disconnect rescue nil if @queue_manager.connected?
+    end
+
+    # Wait for the first message, then linger for more until the batch is full
+    # Returns nil once closed and every message has been put
+    def next_batch
+      @mutex.synchronize do
+        @condition.wait(@mutex) while @pending.empty? && !@closed
+        return nil if @pending.empty?
+
+        deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + (@linger_ms / 1000.0)
+        while (@pending.size < @batch_size) && !@closed && (@flushing == 0)
+          remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC)
+          break if remaining <= 0
+          @condition.wait(@mutex, remaining)
+        end
+        batch = @pending.shift(@batch_size)
+        @condition.broadcast
+        batch
+      end
+    end
+
+    def put_batch(batch, queues)
+      @queue_manager.connect unless @queue_manager.connected?
+
+      committed = []
+      failed    = []
+      batch.each do |q_name, params, promise|
+        begin
+          queue = (queues[q_name] ||= @queue_manager.open_queue(q_name: q_name, mode: :output))
+          if queue.put(params.merge(sync: true))
+            committed << promise
+          else
+            failed << [promise, WMQ::WMQException.new("WMQ::BatchingProducer#put failed, reason: #{queue.reason}")]
+          end
+        rescue WMQ::WMQException, ArgumentError, TypeError => exc
+          failed << [promise, exc]
+        end
+      end
+      @queue_manager.commit unless committed.empty?
+
+      record(committed.size, failed.size, false)
+      committed.each(&:complete)
+      failed.each { |promise, error| promise.complete(error) }
+    rescue WMQ::WMQException => exc
+      # Connect or commit failed: back out the whole batch and reconnect for the next one
+      @queue_manager.backout rescue nil
+      queues.each_value { |queue| queue.close rescue nil }
+      queues.clear
+      @queue_manager.disconnect rescue nil
+
+      record(0, batch.size, true)
+      batch.each { |_, _, promise| promise.complete(exc) unless promise.complete? }
+    end
+
+    def record(messages, failed_messages, failed_batch)
+      @mutex.synchronize do
+        if messages > 0
+          @stats[:batches]        += 1
+          @stats[:messages]       += messages
+          @stats[:max_batch_size] = messages if messages > @stats[:max_batch_size]
+        end
+        @stats[:failed_messages] += failed_messages
+        @stats[:failed_batches]  += 1 if failed_batch
+      end
+    end
+  end
+end
@@ -0,0 +1,239 @@
+module WMQ
+  # Pool of connected QueueManager instances shared by the threads in a process
+  #
+  # Connecting to a queue manager (MQCONNX) is expensive, so rather than
+  # connecting for every request, check out an already connected
+  # QueueManager from the pool and return it when done.
+  #
+  # * A thread is handed the connection it used last when that connection is
+  #   available, so that its queues are already open.
+  # * Queues opened through #queue stay open on the connection across checkouts.
+  # * A connection is checked with QueueManager#alive? before being handed out,
+  #   at most once every :health_check_interval seconds, and reconnected
+  #   when broken.
+  # * Every :reconnect_interval seconds a background thread checks the idle
+  #   connections and reconnects any broken ones.
+  #
+  # Example:
+  #   pool = WMQ::ConnectionPool.new(size: 5, q_mgr_name: 'REID', connection_name: 'localhost(1414)')
+  #
+  #   pool.checkout do |qmgr|
+  #     pool.queue(q_name: 'TEST.QUEUE', mode: :output).put(data: 'Hello World')
+  #     qmgr.put(q_name: 'OTHER.QUEUE', data: 'Hello Again')
+  #   end
+  #
+  #   pool.close
+  class ConnectionPool
+    Entry = Struct.new(:queue_manager, :queues, :checked_at)
+
+    attr_reader :size, :timeout
+
+    # Parameters:
+    # * :size                  Maximum number of connections. Default: 5
+    # * :timeout               Seconds to wait for a connection when all
+    #                          of them are checked out. Default: 5
+    # * :health_check_interval Seconds between alive? checks on a connection
+    #                          before it is handed out. Default: 1
+    # * :reconnect_interval    Seconds between background checks of idle
+    #                          connections, nil for none. Default: 30
+    # * All other parameters are passed to WMQ::QueueManager.new
+    def initialize(params = {})
+      params                 = params.dup
+      @size                  = params.delete(:size) || 5
+      @timeout               = params.delete(:timeout) || 5
+      @health_check_interval = params.delete(:health_check_interval) || 1
+      @reconnect_interval    = params.key?(:reconnect_interval) ? params.delete(:reconnect_interval) : 30
+      @params                = params
+      @entries               = []
+      @available             = []
+      @mutex                 = Mutex.new
+      @condition             = ConditionVariable.new
+      @reconnect_condition   = ConditionVariable.new
+      @key                   = :"wmq_connection_pool_#{object_id}"
+      @closed                = false
+      @reconnector           = nil
+    end
+
+    # Check out a connected QueueManager, yield it, and return it to the pool
+    #
+    # Nested calls on the same thread yield the same QueueManager.
+    #
+    # If the block raises an exception, the current unit of work is backed out
+    # before the connection is returned to the pool, as for QueueManager.connect
+    #
+    # Raises WMQ::WMQException when no connection becomes available within :timeout seconds
+    def checkout
+      entry = Thread.current[@key]
+      return yield(entry.queue_manager) if entry
+
+      entry = acquire
+      begin
+        Thread.current[@key] = entry
+        yield(entry.queue_manager)
+      rescue Exception
+        entry.queue_manager.backout rescue nil
+        raise
+      ensure
+        Thread.current[@key] = nil
+        release(entry)
+      end
+    end
+
+    alias_method :with, :checkout
+
+    # Returns an open WMQ::Queue on the connection checked out by the current thread
+    #
+    # The queue is opened the first time it is requested with these parameters
+    # and stays open on that connection, for use by later checkouts.
+    #
+    # Parameters are the same as for WMQ::Queue.new, excluding :queue_manager
+    def queue(params)
+      entry = Thread.current[@key]
+      raise(WMQ::WMQException, 'WMQ::ConnectionPool#queue can only be called within #checkout') unless entry
+
+      entry.queues[params.dup.freeze] ||= begin
+        queue = WMQ::Queue.new(params.merge(queue_manager: entry.queue_manager))
+        queue.open
+        queue
+      end
+    end
+
+    # Number of connections currently in the pool
+    def connections
+      @mutex.synchronize { @entries.size }
+    end
+
+    # Number of connections in the pool that are not checked out
+    def available
+      @mutex.synchronize { @available.size }
+    end
+
+    # Close all queues and disconnect all connections that are not checked out
+    #
+    # Connections checked out at the time are disconnected when returned
+    def close
+      entries = @mutex.synchronize do
+        @closed = true
+        @condition.broadcast
+        @reconnect_condition.broadcast
+        @entries -= @available
+        @available.slice!(0..-1)
+      end
+      @reconnector.join if @reconnector && @reconnector != Thread.current
+      entries.each { |entry| disconnect(entry) }
+      nil
+    end
+
+    private
+
+    def acquire
+      affinity = Thread.current.thread_variable_get(@key)
+      deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + @timeout
+      entry    = @mutex.synchronize do
+        loop do
+          raise(WMQ::WMQException, 'WMQ::ConnectionPool is closed') if @closed
+
+          found = @available.delete(affinity) || @available.pop
+          break found if found
+
+          if @entries.size < @size
+            found = Entry.new(WMQ::QueueManager.new(@params), {}, nil)
+            @entries << found
+            break found
+          end
+
+          remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC)
+          raise(WMQ::WMQException, "WMQ::ConnectionPool#checkout timed out after #{@timeout} seconds waiting for a connection") if remaining <= 0
+          @condition.wait(@mutex, remaining)
+        end
+      end
+      start_reconnector
+
+      begin
+        verify(entry)
+      rescue Exception
+        @mutex.synchronize do
+          @entries.delete(entry)
+          @condition.signal
+        end
+        raise
+      end
+      Thread.current.thread_variable_set(@key, entry)
+      entry
+    end
+
+    def release(entry)
+      closed = @mutex.synchronize do
+        if @closed
+          @entries.delete(entry)
+        else
+          @available.push(entry)
+          @condition.signal
+        end
+        @closed
+      end
+      disconnect(entry) if closed
+    end
+
+    # Connect the entry, or reconnect it if the connection is broken
+    def verify(entry, force = false)
+      qmgr = entry.queue_manager
+      now  = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      return if qmgr.connected? && !force && entry.checked_at && (now - entry.checked_at < @health_check_interval)
+
+      unless qmgr.alive?
+        disconnect(entry)
+        qmgr.connect
+      end
+      entry.checked_at = now
+    end
+
+    def close_queues(entry)
+      entry.queues.each_value { |queue| queue.close rescue nil }
+      entry.queues.clear
+    end
+
+    def disconnect(entry)
+      close_queues(entry)
+      return unless entry.queue_manager.connected?
+
+      begin
+        entry.queue_manager.disconnect
+      rescue WMQ::WMQException
+        # Already broken
+      end
+    end
+
+    def start_reconnector
+      return if @reconnect_interval.nil? || @reconnector
+
+      @mutex.synchronize do
+        @reconnector ||= Thread.new { reconnect_idle }
+      end
+    end
+
+    # Reconnect idle connections that are broken, so that checkout does not have to
+    def reconnect_idle
+      loop do
+        idle = @mutex.synchronize do
+          @reconnect_condition.wait(@mutex, @reconnect_interval) unless @closed
+          return if @closed
+          @available.dup
+        end
+
+        # One at a time, so that the other idle connections can still be checked out
+        idle.each do |entry|
+          next unless @mutex.synchronize { @available.delete(entry) }
+
+          begin
+            verify(entry, true)
+          rescue WMQ::WMQException
+            # Connected again on checkout
+          ensure
+            release(entry)
+          end
+        end
+      end
+    end
+  end
+end
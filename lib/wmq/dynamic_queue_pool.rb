@@ -0,0 +1,169 @@
+module WMQ
+  # Pool of open temporary dynamic queues, created from a model queue
+  #
+  # Creating a temporary dynamic queue, and deleting it again when it is
+  # closed, is one of the more expensive queue manager operations. Rather than
+  # creating a reply queue for every request, check out an already open one
+  # from the pool and return it when done.
+  #
+  # * Queues are created on the connection of the supplied :queue_manager, and
+  #   are deleted by the queue manager when closed or when it disconnects.
+  # * When a queue is returned, any messages left on it are removed, so that
+  #   the next checkout starts with an empty queue.
+  # * A queue that fails to drain, or that is returned once :size queues are
+  #   already available, is closed, deleting it.
+  # * Replies put after their queue was drained, E.g. to a request that timed
+  #   out, can still arrive on the next checkout. Match replies on their
+  #   correl_id, and give requests an expiry.
+  #
+  # Example:
+  #   WMQ::QueueManager.connect(q_mgr_name: 'REID') do |qmgr|
+  #     pool = WMQ::DynamicQueuePool.new(queue_manager: qmgr, size: 5)
+  #
+  #     10.times do |i|
+  #       pool.checkout do |reply_queue|
+  #         message = WMQ::Message.new(data: "Request #{i}")
+  #         message.descriptor[:msg_type]   = WMQ::MQMT_REQUEST
+  #         message.descriptor[:reply_to_q] = reply_queue.name
+  #         qmgr.put(q_name: 'TEST.QUEUE', message: message)
+  #
+  #         message.descriptor[:correl_id] = message.descriptor[:msg_id]
+  #         puts message.data if reply_queue.get(message: message, wait: 5000, match: WMQ::MQMO_MATCH_CORREL_ID)
+  #       end
+  #     end
+  #
+  #     pool.close
+  #   end
+  class DynamicQueuePool
+    attr_reader :queue_manager, :size
+
+    # Parameters:
+    # * :queue_manager   Connected WMQ::QueueManager to create the queues on
+    # * :size            Maximum number of queues kept open while not checked out.
+    #                    Default: 10
+    # * :q_name          Model queue to create the queues from.
+    #                    Default: 'SYSTEM.DEFAULT.MODEL.QUEUE'
+    # * :dynamic_q_name  Name of the created queues. Default: 'POOL.*'
+    # * :mode            Mode to open the queues with. Default: :input
+    # * All other parameters are passed to WMQ::Queue.new
+    def initialize(params)
+      params         = params.dup
+      @queue_manager = params.delete(:queue_manager)
+      @size          = params.delete(:size) || 10
+      raise(ArgumentError, 'WMQ::DynamicQueuePool requires :queue_manager') unless @queue_manager
+
+      @params = {
+        q_name:         'SYSTEM.DEFAULT.MODEL.QUEUE',
+        dynamic_q_name: 'POOL.*',
+        mode:           :input
+      }.merge(params).merge(queue_manager: @queue_manager)
+
+      @available = []
+      @mutex     = Mutex.new
+      @closed    = false
+      @stats     = {created: 0, checkouts: 0, drained_messages: 0, discarded: 0}
+    end
+
+    # Check out an open, empty, temporary dynamic queue
+    #
+    # With a block, the queue is yielded and returned to the pool afterwards,
+    # and the result of the block is returned. Without a block the queue is
+    # returned, and must be passed to #checkin when done.
+    def checkout
+      queue = @mutex.synchronize do
+        raise(WMQ::WMQException, 'WMQ::DynamicQueuePool is closed') if @closed
+
+        @stats[:checkouts] += 1
+        @available.pop
+      end
+      queue ||= create
+      return queue unless block_given?
+
+      begin
+        yield(queue)
+      ensure
+        checkin(queue)
+      end
+    end
+
+    alias_method :with, :checkout
+
+    # Return a queue obtained from #checkout, removing any messages left on it
+    def checkin(queue)
+      drained = drain(queue)
+      kept    = drained && @mutex.synchronize do
+        @stats[:drained_messages] += drained
+        if !@closed && (@available.size < @size)
+          @available.push(queue)
+          true
+        end
+      end
+      discard(queue) unless kept
+      nil
+    end
+
+    # Create queues until :size of them are available, so that the first
+    # checkouts do not have to
+    def fill
+      count = @mutex.synchronize { @size - @available.size }
+      count.times { checkin(create) }
+      nil
+    end
+
+    # Number of open queues that are not checked out
+    def available
+      @mutex.synchronize { @available.size }
+    end
+
+    # Returns a Hash of counters
+    # * :created           Queues created
+    # * :checkouts         Calls to #checkout
+    # * :drained_messages  Messages removed from queues when they were returned
+    # * :discarded         Queues closed since they failed to drain, or the pool was full
+    def stats
+      @mutex.synchronize { @stats.dup }
+    end
+
+    # Close, and thereby delete, all queues that are not checked out
+    #
+    # Queues checked out at the time are closed when returned
+    def close
+      queues = @mutex.synchronize do
+        @closed = true
+        @available.slice!(0..-1)
+      end
+      queues.each { |queue| queue.close rescue nil }
+      nil
+    end
+
+    private
+
+    def create
+      queue = WMQ::Queue.new(@params)
+      queue.open
+      @mutex.synchronize { @stats[:created] += 1 }
+      queue
+    end
+
+    # Remove every message on the queue without waiting, and without growing
+    # the buffer for large ones
+    #
+    # Returns the number of messages removed, or nil when the queue is no longer usable
+    def drain(queue)
+      return nil unless queue.open?
+
+      message = WMQ::Message.new
+      options = WMQ::MQGMO_NO_SYNCPOINT | WMQ::MQGMO_ACCEPT_TRUNCATED_MSG
+      count   = 0
+      count  += 1 while queue.get(message: message, options: options, match: WMQ::MQMO_NONE)
+      count
+    rescue WMQ::WMQException
+      nil
+    end
+
+    def discard(queue)
+      @mutex.synchronize { @stats[:discarded] += 1 }
+      queue.close rescue nil
+    end
+  end
+end
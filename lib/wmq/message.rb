@@ -59,14 +59,22 @@ module WMQ
   #       header_type: :rf_header
   #        ....
   #   * Rules and Formatting V2 Header (RFH2)
-  #       ....
+  #       header_type: :rf_header_2
+  #       xml:         String, Array of Strings, or a Hash of folders, each a Hash of properties
+  #       Received headers also contain :folders for accessing the properties in each folder
+  #         message.headers.first[:folders][:usr]['OrderId']
+  #        ....
   #   * Dead Letter Header
   #   * CICS Header
   #   * IMS Header
   #   * Transmission Queue Header
   #   * ...
+  # * properties: Hash or WMQ::MessageProperties
+  #   * Message properties to set when the message is put
+  #   * Received messages only have properties when retrieved with get(properties: true)
+  #       message.properties['OrderId']
   class Message
-    attr_accessor :data, :descriptor, :headers
+    attr_accessor :data, :descriptor, :headers, :properties
   end
 
 end
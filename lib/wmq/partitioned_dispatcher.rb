@@ -0,0 +1,279 @@
+module WMQ
+  # Process messages in parallel, while processing the messages that share a
+  # key, E.g. the same group_id, in the order they are on the queue
+  #
+  # A dispatcher thread browses the queue and hands the msg_id of every message
+  # to one of :lanes worker threads, chosen by the key of the message. Each
+  # lane has its own connection, and gets, processes and commits its messages
+  # one at a time, in the order they were browsed. Messages with the same key
+  # therefore never overtake one another, while messages with different keys
+  # are processed in parallel.
+  #
+  # * Each lane holds at most :lane_size messages, after which the dispatcher
+  #   waits for it to catch up.
+  # * The handler runs under syncpoint on the connection of its lane. Puts made
+  #   with sync: true are committed together with the get of the message.
+  # * When the handler raises an exception the unit of work is backed out and
+  #   the message is processed again, holding up the messages after it in the
+  #   lane. Give the queue a backout threshold and backout requeue queue, so
+  #   that the message is moved there once it reaches the threshold.
+  # * Messages without a key are spread over the lanes in turn.
+  # * #stop lets every lane finish, and commit, the message it is processing.
+  #   Messages already dispatched to a lane remain on the queue.
+  #
+  # Example:
+  #   dispatcher = WMQ::PartitionedDispatcher.new(q_mgr_name: 'REID', q_name: 'TEST.QUEUE', key: :group_id, lanes: 8) do |message, qmgr|
+  #     process(message)
+  #   end
+  #
+  #   trap('TERM') { dispatcher.stop }
+  #   dispatcher.run
+  class PartitionedDispatcher
+    include WorkerThreads
+
+    # Messages dispatched to one worker thread, in order
+    class Lane
+      attr_reader :stats
+
+      def initialize(size)
+        @size      = size
+        @entries   = []
+        @mutex     = Mutex.new
+        @condition = ConditionVariable.new
+        @stats     = {messages: 0, errors: 0, skipped: 0, reconnects: 0}
+      end
+
+      # Add a msg_id, waiting up to wait seconds while the lane is full
+      # Returns false when the lane is still full
+      def push(msg_id, wait)
+        @mutex.synchronize do
+          @condition.wait(@mutex, wait) if @entries.size >= @size
+          return false if @entries.size >= @size
+
+          @entries << msg_id
+          @condition.broadcast
+          true
+        end
+      end
+
+      # Returns the msg_id being processed, waiting up to wait seconds for one
+      def first(wait)
+        @mutex.synchronize do
+          @condition.wait(@mutex, wait) if @entries.empty?
+          @entries.first
+        end
+      end
+
+      # Remove the msg_id returned by #first once it has been processed
+      def shift
+        @mutex.synchronize do
+          @condition.broadcast
+          @entries.shift
+        end
+      end
+
+      def depth
+        @mutex.synchronize { @entries.size }
+      end
+
+      def count(key)
+        @mutex.synchronize { @stats[key] += 1 }
+      end
+    end
+
+    attr_reader :q_name, :key
+
+    # Parameters:
+    # * :q_name              Queue to process the messages on
+    # * :key                 Messages with the same key are processed in order
+    #                        * :group_id, :correl_id, or any other field of the message descriptor
+    #                        * A String, the name of a message property. E.g. In an MQRFH2 usr folder
+    #                        * A Proc returning the key of the browsed message
+    #                        Default: :group_id
+    # * :lanes               Number of worker threads, each with its own connection. Default: 4
+    # * :lane_size           Messages dispatched to a lane ahead of it. Default: 100
+    # * :poll_ms             Longest time in milli-seconds a thread waits before
+    #                        checking whether it was stopped. Default: 1000
+    # * :retry_interval_ms   Wait before processing a message again after the handler failed.
+    #                        Default: 1000
+    # * :reconnect_interval  Seconds to wait before reconnecting after a connection failure.
+    #                        Default: 5
+    # * :get                 Additional parameters for Queue#get in the lanes. E.g. get: {convert: true}
+    # * All other parameters are passed to WMQ::QueueManager.new
+    #
+    # The block is called with every message and the WMQ::QueueManager of the lane
+    def initialize(params, &handler)
+      params              = params.dup
+      @q_name             = params.delete(:q_name)
+      @key                = params.delete(:key) || :group_id
+      @lane_count         = params.delete(:lanes) || 4
+      @lane_size          = params.delete(:lane_size) || 100
+      @poll_ms            = params.delete(:poll_ms) || 1000
+      @retry_interval_ms  = params.delete(:retry_interval_ms) || 1000
+      @reconnect_interval = params.delete(:reconnect_interval) || 5
+      @get_params         = params.delete(:get) || {}
+      @params             = params.merge(release_gvl: true)
+      raise(ArgumentError, 'WMQ::PartitionedDispatcher requires :q_name and a block to process the messages') unless @q_name && handler
+      raise(ArgumentError, ':lanes and :lane_size must be at least 1') if (@lane_count < 1) || (@lane_size < 1)
+
+      @handler    = handler
+      @lanes      = []
+      @threads    = []
+      @inflight   = {}
+      @next_lane  = 0
+      @mutex      = Mutex.new
+      @running    = false
+      @dispatched = 0
+      @reconnects = 0
+    end
+
+    # Returns a Hash of counters
+    # * :dispatched  Messages handed to a lane
+    # * :reconnects  Connection failures of the dispatcher
+    # * :lanes       Array with a Hash of counters for each lane
+    #   * :messages    Messages processed and committed
+    #   * :errors      Messages backed out since the handler raised an exception
+    #   * :skipped     Messages no longer on the queue when the lane got to them,
+    #                  E.g. Moved to the backout requeue queue
+    #   * :reconnects  Connection failures
+    #   * :depth       Messages waiting in the lane
+    def stats
+      lanes = @lanes.collect { |lane| lane.stats.merge(depth: lane.depth) }
+      @mutex.synchronize { {dispatched: @dispatched, reconnects: @reconnects, lanes: lanes} }
+    end
+
+    private
+
+    # The lane threads, and the dispatcher thread
+    def start_threads
+      @inflight = {}
+      @lanes    = @lane_count.times.collect { Lane.new(@lane_size) }
+      @lanes.collect { |lane| Thread.new { work(lane) } } << Thread.new { dispatch }
+    end
+
+    # Browse the queue, handing each message to its lane
+    #
+    # Once the end of the queue is reached, browse again from the first message,
+    # to find messages that were backed out or put ahead of the cursor due to
+    # their priority. Messages already dispatched are skipped.
+    def dispatch
+      properties = @key.is_a?(String)
+      options    = @key.is_a?(Proc) ? 0 : WMQ::MQGMO_ACCEPT_TRUNCATED_MSG   # Only the key is needed
+      while @running
+        begin
+          WMQ::QueueManager.connect(@params) do |qmgr|
+            qmgr.open_queue(q_name: @q_name, mode: :browse) do |queue|
+              message = WMQ::Message.new
+              browse  = WMQ::MQGMO_BROWSE_FIRST
+              while @running
+                if queue.get(message: message, options: options | browse, wait: @poll_ms, match: WMQ::MQMO_NONE, properties: properties)
+                  browse = WMQ::MQGMO_BROWSE_NEXT
+                  assign(message)
+                else
+                  browse = WMQ::MQGMO_BROWSE_FIRST
+                end
+              end
+            end
+          end
+        rescue WMQ::WMQException
+          @mutex.synchronize { @reconnects += 1 }
+          wait_to_reconnect
+        end
+      end
+    end
+
+    def assign(message)
+      msg_id = message.descriptor[:msg_id]
+      key    = key_of(message)
+      lane   = @mutex.synchronize do
+        return if @inflight.key?(msg_id)
+
+        @inflight[msg_id] = true
+        @dispatched      += 1
+        if key.nil? || (key.respond_to?(:empty?) && key.empty?)
+          @next_lane = (@next_lane + 1) % @lanes.size
+          @lanes[@next_lane]
+        else
+          @lanes[key.hash % @lanes.size]
+        end
+      end
+
+      # Wait for the lane to catch up
+      until lane.push(msg_id, @poll_ms / 1000.0)
+        next if @running
+
+        @mutex.synchronize do
+          @inflight.delete(msg_id)
+          @dispatched -= 1
+        end
+        return
+      end
+    end
+
+    def key_of(message)
+      case @key
+      when Proc
+        @key.call(message)
+      when String
+        message.properties && message.properties[@key]
+      else
+        message.descriptor[@key]
+      end
+    end
+
+    def work(lane)
+      while @running
+        begin
+          WMQ::QueueManager.connect(@params) do |qmgr|
+            qmgr.open_queue(q_name: @q_name, mode: :input_shared) do |queue|
+              while @running
+                msg_id = lane.first(@poll_ms / 1000.0)
+                next unless msg_id
+
+                # Kept first in the lane until processed, also across a reconnect
+                next unless process(lane, qmgr, queue, msg_id)
+
+                lane.shift
+                @mutex.synchronize { @inflight.delete(msg_id) }
+              end
+            end
+          end
+        rescue WMQ::WMQException
+          lane.count(:reconnects)
+          wait_to_reconnect
+        end
+      end
+    end
+
+    # Returns false when stopped before the message was processed
+    def process(lane, qmgr, queue, msg_id)
+      while @running
+        message = WMQ::Message.new(descriptor: {msg_id: msg_id})
+        params  = @get_params.merge(message: message, match: WMQ::MQMO_MATCH_MSG_ID, sync: true, backout_requeue: true)
+        unless queue.get(params)
+          lane.count(:skipped)
+          return true
+        end
+
+        begin
+          @handler.call(message, qmgr)
+          qmgr.commit
+          lane.count(:messages)
+          return true
+        rescue WMQ::WMQException
+          raise unless qmgr.alive?
+          lane_backout(lane, qmgr)
+        rescue StandardError
+          lane_backout(lane, qmgr)
+        end
+      end
+      false
+    end
+
+    def lane_backout(lane, qmgr)
+      qmgr.backout
+      lane.count(:errors)
+      sleep(@retry_interval_ms / 1000.0) if @running
+    end
+  end
+end
@@ -0,0 +1,238 @@
+require 'securerandom'
+
+module WMQ
+  # Send request messages and wait for their replies, over one long lived
+  # reply queue shared by every request
+  #
+  # Instead of opening a dynamic reply queue for every request, and holding a
+  # get with a correl_id match on it until the reply arrives, a single reader
+  # thread receives every reply and hands it to the request waiting for it,
+  # by the correl_id of the reply. Any number of threads, or fibers, can have
+  # requests in flight at once.
+  #
+  # * The request message is given a new msg_id, which the server is expected
+  #   to return as the correl_id of the reply. I.e. The default MQRO_COPY_MSG_ID_TO_CORREL_ID.
+  # * Replies that arrive after their request timed out are discarded. See #stats
+  # * Uses 2 connections, both with :share_handle: requests are put by the calling
+  #   threads on one, and replies are read on the other, since MQ would hold a
+  #   put on a shared connection until a get waiting on it completes.
+  #
+  # Example:
+  #   requester = WMQ::Requester.new(q_mgr_name: 'REID', q_name: 'TEST.QUEUE')
+  #
+  #   threads = 10.times.collect do |i|
+  #     Thread.new do
+  #       reply = requester.request(data: "Request #{i}", timeout: 5)
+  #       puts reply ? reply.data : 'Timed out'
+  #     end
+  #   end
+  #   threads.each(&:join)
+  #
+  #   requester.close
+  class Requester
+    # Reply to one request, see Requester#send_request
+    class Reply
+      attr_reader :msg_id
+
+      def initialize(requester, msg_id)
+        @requester = requester
+        @msg_id    = msg_id
+        @mutex     = Mutex.new
+        @condition = ConditionVariable.new
+        @message   = nil
+        @error     = nil
+      end
+
+      # Wait up to timeout seconds for the reply
+      #
+      # Returns the reply WMQ::Message, or nil when it did not arrive in time,
+      # in which case it is no longer waited for, and discarded should it arrive later
+      #
+      # Raises the exception that stopped the reader, E.g. The connection broke
+      def wait(timeout = nil)
+        deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout if timeout
+        @mutex.synchronize do
+          until @message || @error
+            remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC) if deadline
+            break if remaining && (remaining <= 0)
+            @condition.wait(@mutex, remaining)
+          end
+        end
+        raise(@error) if @error
+        @requester.send(:cancel, @msg_id) unless @message
+        @message
+      end
+
+      # :nodoc:
+      def complete(message, error = nil)
+        @mutex.synchronize do
+          @message = message
+          @error   = error
+          @condition.broadcast
+        end
+      end
+    end
+
+    # Milli-seconds the reader waits for a reply before checking whether it was closed
+    READ_WAIT_MS = 500
+
+    attr_reader :q_name, :timeout
+
+    # Parameters:
+    # * :q_name          Queue to put requests to, unless :q_name is passed to #request
+    # * :timeout         Seconds to wait for a reply, unless :timeout is passed to #request.
+    #                    Default: 30
+    # * :reply_q_name    Model queue to create the reply queue from.
+    #                    Default: 'SYSTEM.DEFAULT.MODEL.QUEUE'
+    # * :dynamic_q_name  Name of the reply queue. Default: 'REQUESTER.*'
+    # * All other parameters are passed to WMQ::QueueManager.new
+    def initialize(params = {})
+      params          = params.dup
+      @q_name         = params.delete(:q_name)
+      @timeout        = params.delete(:timeout) || 30
+      reply_q_name    = params.delete(:reply_q_name) || 'SYSTEM.DEFAULT.MODEL.QUEUE'
+      dynamic_q_name  = params.delete(:dynamic_q_name) || 'REQUESTER.*'
+      params          = params.merge(share_handle: true)
+
+      @pending   = {}
+      @mutex     = Mutex.new
+      @closed    = false
+      @error     = nil
+      @stats     = {requests: 0, replies: 0, timeouts: 0, discarded: 0}
+
+      @queue_manager = WMQ::QueueManager.new(params)
+      @queue_manager.connect
+      @reader_queue_manager = WMQ::QueueManager.new(params)
+      @reader_queue_manager.connect
+      @reply_queue = WMQ::Queue.new(queue_manager: @reader_queue_manager, q_name: reply_q_name, dynamic_q_name: dynamic_q_name, mode: :input)
+      @reply_queue.open                                 # Creates the dynamic queue, so that its name is known
+      @reader      = Thread.new { read }
+    rescue StandardError
+      @reply_queue.close if @reply_queue
+      @reader_queue_manager.disconnect if @reader_queue_manager && @reader_queue_manager.connected?
+      @queue_manager.disconnect if @queue_manager && @queue_manager.connected?
+      raise
+    end
+
+    # Name of the reply queue
+    def reply_q_name
+      @reply_queue.name
+    end
+
+    # Put a request and wait for its reply
+    #
+    # Parameters are the same as for WMQ::QueueManager#put, plus:
+    # * :q_name   Queue to put the request to, instead of the one supplied to new
+    # * :timeout  Seconds to wait for the reply, instead of the one supplied to new
+    #
+    # Returns the reply WMQ::Message, or nil when it did not arrive in time
+    def request(params)
+      timeout = params.key?(:timeout) ? params[:timeout] : @timeout
+      send_request(params).wait(timeout)
+    end
+
+    # Put a request, returning a Requester::Reply to wait for its reply with
+    #
+    # Parameters are the same as for #request, except that :timeout only sets
+    # the expiry of the request message
+    #
+    # Example:
+    #   replies = 100.times.collect { |i| requester.send_request(data: "Request #{i}") }
+    #   replies.each { |reply| p reply.wait(5) }
+    def send_request(params)
+      params  = params.dup
+      q_name  = params.delete(:q_name) || @q_name
+      timeout = params.key?(:timeout) ? params.delete(:timeout) : @timeout
+      raise(ArgumentError, 'WMQ::Requester#request requires :q_name, since none was supplied to new') unless q_name
+
+      message    = params.delete(:message) || WMQ::Message.new(data: params.delete(:data))
+      descriptor = message.descriptor
+      msg_id     = SecureRandom.hex(12)                 # No trailing nulls, which get would strip from the correl_id
+      descriptor[:msg_type]       = WMQ::MQMT_REQUEST
+      descriptor[:msg_id]         = msg_id
+      descriptor[:reply_to_q]     = @reply_queue.name
+      descriptor[:reply_to_q_mgr] = @reader_queue_manager.name
+      descriptor[:expiry]         = (timeout * 10).ceil if timeout && !descriptor[:expiry]
+
+      reply = Reply.new(self, msg_id)
+      @mutex.synchronize do
+        raise(@error || WMQ::WMQException.new('WMQ::Requester is closed')) if @closed
+        @pending[msg_id]  = reply
+        @stats[:requests] += 1
+      end
+      begin
+        @queue_manager.put(params.merge(q_name: q_name, message: message))
+      rescue StandardError
+        @mutex.synchronize { @pending.delete(msg_id) }
+        raise
+      end
+      reply
+    end
+
+    # Number of requests waiting for a reply
+    def pending
+      @mutex.synchronize { @pending.size }
+    end
+
+    # Returns a Hash of counters
+    # * :requests   Requests put
+    # * :replies    Replies handed to their request
+    # * :timeouts   Requests no longer waited for
+    # * :discarded  Replies that arrived after their request timed out, or that
+    #               did not match any request
+    def stats
+      @mutex.synchronize { @stats.dup }
+    end
+
+    # Stop the reader, close the reply queue and disconnect
+    #
+    # Requests still waiting raise WMQ::WMQException
+    def close
+      @mutex.synchronize { @closed = true }
+      @reader.join
+      fail_pending(WMQ::WMQException.new('WMQ::Requester is closed'))
+      @reply_queue.close
+      @reader_queue_manager.disconnect
+      @queue_manager.disconnect
+      nil
+    end
+
+    private
+
+    def read
+      message = WMQ::Message.new
+      until @mutex.synchronize { @closed }
+        # The descriptor still holds the ids of a discarded reply
+        next unless @reply_queue.get(message: message, wait: READ_WAIT_MS, match: WMQ::MQMO_NONE)
+
+        correl_id = message.descriptor[:correl_id]
+        reply     = @mutex.synchronize do
+          @pending.delete(correl_id).tap { |r| @stats[r ? :replies : :discarded] += 1 }
+        end
+        next unless reply
+
+        reply.complete(message)
+        message = WMQ::Message.new
+      end
+    rescue StandardError => exc
+      @mutex.synchronize do
+        @closed = true
+        @error  = exc
+      end
+      fail_pending(exc)
+    end
+
+    def cancel(msg_id)
+      @mutex.synchronize { @stats[:timeouts] += 1 if @pending.delete(msg_id) }
+    end
+
+    def fail_pending(exc)
+      replies = @mutex.synchronize do
+        pending  = @pending.values
+        @pending = {}
+        pending
+      end
+      replies.each { |reply| reply.complete(nil, exc) }
+    end
+  end
+end
@@ -0,0 +1,194 @@
+module WMQ
+  # Retry failed messages later, with an exponentially increasing delay,
+  # instead of backing them out and receiving them again straight away
+  #
+  # #retry puts the message to a retry queue with an MQRFH2 header holding the
+  # attempt number, the queue it came from, and the time before which it must
+  # not be retried. #run, usually in its own process or thread with its own
+  # connection, browses the retry queue and moves each message back to the
+  # queue it came from once it is due.
+  #
+  # The header is left on the message when it is moved back, so that the next
+  # #retry knows how many attempts have already been made. See RetryScheduler.attempts
+  #
+  # Example, in the consumer:
+  #   WMQ::QueueManager.connect(q_mgr_name: 'REID') do |qmgr|
+  #     retries = WMQ::RetryScheduler.new(queue_manager: qmgr, retry_q_name: 'TEST.RETRY', max_attempts: 5)
+  #     qmgr.open_queue(q_name: 'TEST.QUEUE', mode: :input) do |queue|
+  #       queue.each(sync: true) do |message|
+  #         begin
+  #           process(message)
+  #         rescue Timeout::Error
+  #           # Once max_attempts is reached, leave it to the backout threshold of the queue
+  #           unless retries.retry(message, q_name: 'TEST.QUEUE')
+  #             qmgr.backout
+  #             next
+  #           end
+  #         end
+  #         qmgr.commit
+  #       end
+  #     end
+  #   end
+  #
+  # Example, moving the messages back once due:
+  #   WMQ::QueueManager.connect(q_mgr_name: 'REID') do |qmgr|
+  #     WMQ::RetryScheduler.new(queue_manager: qmgr, retry_q_name: 'TEST.RETRY').run
+  #   end
+  class RetryScheduler
+    # Name of the MQRFH2 folder holding the retry details
+    FOLDER = :wmqretry
+
+    attr_reader :queue_manager, :retry_q_name, :delay_ms, :multiplier, :max_delay_ms, :max_attempts
+
+    # Returns the number of times the message has been retried so far
+    def self.attempts(message)
+      header = retry_header(message)
+      header ? header[:folders][FOLDER]['Attempt'].to_i : 0
+    end
+
+    # Returns the MQRFH2 header added by #retry, or nil
+    def self.retry_header(message)
+      (message.headers || []).find do |header|
+        (header[:header_type] == :rf_header_2) && header[:folders] && header[:folders].keys.include?(FOLDER)
+      end
+    end
+
+    # Parameters:
+    # * :queue_manager  Connected WMQ::QueueManager to put and get the messages with
+    # * :retry_q_name   Queue to hold the messages until they are due
+    # * :delay_ms       Delay before the first retry. Default: 1000
+    # * :multiplier     Each further retry is delayed this many times longer. Default: 2
+    # * :max_delay_ms   Longest delay. Default: 300000, 5 minutes
+    # * :max_attempts   #retry returns false once a message was retried this many times.
+    #                   Default: 10
+    def initialize(params)
+      @queue_manager = params[:queue_manager]
+      @retry_q_name  = params[:retry_q_name]
+      @delay_ms      = params[:delay_ms] || 1000
+      @multiplier    = params[:multiplier] || 2
+      @max_delay_ms  = params[:max_delay_ms] || 300_000
+      @max_attempts  = params[:max_attempts] || 10
+      raise(ArgumentError, 'WMQ::RetryScheduler requires :queue_manager and :retry_q_name') unless @queue_manager && @retry_q_name
+
+      @running = false
+      @queue   = nil
+    end
+
+    # Put the message to the retry queue, to be moved back to :q_name once due
+    #
+    # The put is made under syncpoint, so that it is committed together with the
+    # get of the message that failed. I.e. Call QueueManager#commit afterwards.
+    #
+    # Parameters:
+    # * message  WMQ::Message that failed
+    # * :q_name  Queue to move the message back to
+    #
+    # Returns:
+    # * true:  When the message was put to the retry queue
+    # * false: When the message has already been retried :max_attempts times
+    def retry(message, params)
+      q_name = params[:q_name]
+      raise(ArgumentError, 'WMQ::RetryScheduler#retry requires :q_name') unless q_name
+
+      attempt = self.class.attempts(message) + 1
+      return false if attempt > @max_attempts
+
+      header  = self.class.retry_header(message)
+      headers = (message.headers || []).reject { |h| h.equal?(header) }
+      headers << {
+        header_type: :rf_header_2,
+        xml:         {FOLDER => {'Attempt' => attempt, 'NotBefore' => now_ms + delay(attempt), 'QName' => q_name}}
+      }
+      retry_message = WMQ::Message.new(data: message.data, descriptor: message.descriptor.dup, headers: headers)
+      @queue_manager.put(q_name: @retry_q_name, message: retry_message, sync: true)
+    end
+
+    # Returns the delay in milli-seconds before the supplied attempt
+    def delay(attempt)
+      delay = @delay_ms * (@multiplier**(attempt - 1))
+      delay > @max_delay_ms ? @max_delay_ms : delay.to_i
+    end
+
+    # Browse the retry queue once, moving every message that is due back to
+    # the queue it came from, and commit
+    #
+    # Returns the number of messages moved
+    def move_due
+      scan.first
+    end
+
+    # Move messages back as they become due, until #stop is called
+    #
+    # Parameters:
+    # * :interval_ms  Longest time to wait between browsing the retry queue,
+    #                 for messages retried since. Default: 1000
+    def run(params = {})
+      interval_ms = params[:interval_ms] || 1000
+      @running    = true
+      while @running
+        _, due_in = scan
+        wait = due_in && (due_in < interval_ms) ? due_in : interval_ms
+        sleep(wait / 1000.0) if @running && wait > 0
+      end
+    ensure
+      close
+    end
+
+    # Make #run return after its current pass over the retry queue
+    def stop
+      @running = false
+    end
+
+    # Close the retry queue opened by #run or #move_due
+    def close
+      @queue.close if @queue && @queue.open?
+      @queue = nil
+    end
+
+    private
+
+    # Returns [number of messages moved, milli-seconds until the next message is due or nil]
+    def scan
+      @queue ||= @queue_manager.open_queue(q_name: @retry_q_name, open_options: WMQ::MQOO_BROWSE | WMQ::MQOO_INPUT_SHARED)
+      moved   = 0
+      next_at = nil
+      options = WMQ::MQGMO_BROWSE_FIRST
+      message = WMQ::Message.new
+      begin
+        # Not matching the ids of the previous message in the reused descriptor
+        while @queue.get(message: message, options: options, match: WMQ::MQMO_NONE)
+          options = WMQ::MQGMO_BROWSE_NEXT
+          header  = self.class.retry_header(message)
+          next unless header
+
+          retry_folder = header[:folders][FOLDER]
+          not_before   = retry_folder['NotBefore'].to_i
+          if not_before > now_ms
+            next_at = not_before if next_at.nil? || (not_before < next_at)
+            next
+          end
+
+          begin
+            # Returns false without :exception_on_error
+            next unless @queue.get(message: message, options: WMQ::MQGMO_MSG_UNDER_CURSOR, match: WMQ::MQMO_NONE, sync: true)
+          rescue WMQ::WMQException
+            # Another scheduler moved it since it was browsed
+            raise unless @queue.reason_code == WMQ::MQRC_NO_MSG_UNDER_CURSOR
+            next
+          end
+          @queue_manager.put(q_name: retry_folder['QName'], message: message, sync: true)
+          moved += 1
+        end
+        @queue_manager.commit if moved > 0
+      rescue StandardError
+        @queue_manager.backout rescue nil
+        raise
+      end
+      [moved, next_at && [next_at - now_ms, 0].max]
+    end
+
+    def now_ms
+      (Time.now.to_f * 1000).to_i
+    end
+  end
+end
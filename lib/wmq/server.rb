@@ -0,0 +1,180 @@
+module WMQ
+  # Process the messages on a queue with several worker threads
+  #
+  # Each worker has its own connection, with :release_gvl so that other
+  # threads run while it waits in MQGET, opens the queue for shared input, and
+  # receives the messages under syncpoint with Queue#each.
+  #
+  # * The value returned by the handler is sent back with
+  #   QueueManager#put_to_reply_q when the message is a request. When the reply
+  #   cannot be put, the request is put to the dead letter queue instead.
+  # * Replies, dead letters and any other puts made with sync: true are
+  #   committed together with the get of the message.
+  # * When the handler raises an exception the unit of work is backed out, and
+  #   the message is received again. Once it reaches the backout threshold of
+  #   the queue it is moved to its backout requeue queue. See Queue#get
+  # * #stop lets every worker finish, and commit, the message it is processing
+  #   before it disconnects.
+  # * When a connection fails the worker reconnects after :reconnect_interval seconds.
+  #
+  # Example:
+  #   server = WMQ::Server.new(q_mgr_name: 'REID', q_name: 'TEST.QUEUE', workers: 4) do |message, qmgr|
+  #     "Echo back: #{message.data}"
+  #   end
+  #
+  #   # Log the time taken to process every message
+  #   server.use do |message, qmgr, &chain|
+  #     start  = Time.now
+  #     result = chain.call
+  #     puts "Processed #{message.descriptor[:msg_id]} in #{Time.now - start} seconds"
+  #     result
+  #   end
+  #
+  #   trap('TERM') { server.stop }
+  #   server.run
+  class Server
+    include WorkerThreads
+
+    attr_reader :q_name, :workers
+
+    # Parameters:
+    # * :q_name              Queue to receive messages from
+    # * :workers             Number of worker threads, each with its own connection. Default: 1
+    # * :poll_ms             Longest time in milli-seconds a worker waits for a message
+    #                        before checking whether it was stopped. Default: 1000
+    # * :commit_every        Commit after this many messages. Default: 1
+    # * :commit_interval_ms  Also commit once the first message in the unit of work
+    #                        was received this many milli-seconds ago. Default: nil
+    # * :get                 Additional parameters for Queue#each. E.g. get: {convert: true}
+    # * :reconnect_interval  Seconds to wait before reconnecting after a connection failure.
+    #                        Default: 5
+    # * All other parameters are passed to WMQ::QueueManager.new
+    #
+    # The block is called with every message and the WMQ::QueueManager of the
+    # worker, and returns the reply data or WMQ::Message, or nil for no reply.
+    def initialize(params, &handler)
+      params              = params.dup
+      @q_name             = params.delete(:q_name)
+      @workers            = params.delete(:workers) || 1
+      @poll_ms            = params.delete(:poll_ms) || 1000
+      @reconnect_interval = params.delete(:reconnect_interval) || 5
+      @each_params        = (params.delete(:get) || {}).merge(
+        sync:               true,
+        wait:               @poll_ms,
+        commit_every:       params.delete(:commit_every) || 1,
+        commit_interval_ms: params.delete(:commit_interval_ms)
+      )
+      @params             = params.merge(release_gvl: true)
+      raise(ArgumentError, 'WMQ::Server requires :q_name and a block to process the messages') unless @q_name && handler
+
+      @handler    = handler
+      @middleware = []
+      @threads    = []
+      @stats      = []
+      @mutex      = Mutex.new
+      @running    = false
+    end
+
+    # Add a middleware, called with each message around the handler and the
+    # middleware added after it
+    #
+    # The middleware is called with the message, the WMQ::QueueManager and a
+    # block, and must call the block and return its result, the reply.
+    #
+    # Parameters:
+    # * middleware  Object responding to call(message, queue_manager, &block), or a block
+    def use(middleware = nil, &block)
+      @middleware << (middleware || block)
+      self
+    end
+
+    # Returns an Array with a Hash of counters for each worker
+    # * :messages             Messages processed
+    # * :replies              Replies put
+    # * :dead_letters         Requests put to the dead letter queue since their reply failed
+    # * :errors               Messages backed out since the handler raised an exception
+    # * :reconnects           Connection failures
+    # * :messages_per_second  Messages processed per second since the worker started
+    def stats
+      @mutex.synchronize do
+        now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        @stats.collect do |stats|
+          elapsed = now - stats[:started_at]
+          stats.reject { |key, _| key == :started_at }.merge(
+            messages_per_second: elapsed > 0 ? stats[:messages] / elapsed : 0.0
+          )
+        end
+      end
+    end
+
+    private
+
+    def start_threads
+      @stats = @workers.times.collect { new_stats }
+      @stats.collect { |stats| Thread.new { work(stats) } }
+    end
+
+    def new_stats
+      {messages: 0, replies: 0, dead_letters: 0, errors: 0, reconnects: 0, started_at: Process.clock_gettime(Process::CLOCK_MONOTONIC)}
+    end
+
+    def work(stats)
+      while @running
+        begin
+          WMQ::QueueManager.connect(@params) do |qmgr|
+            qmgr.open_queue(q_name: @q_name, mode: :input_shared) do |queue|
+              consume(qmgr, queue, stats) while @running
+            end
+          end
+        rescue WMQ::WMQException
+          count(stats, :reconnects)
+          wait_to_reconnect
+        end
+      end
+    end
+
+    def consume(qmgr, queue, stats)
+      queue.each(@each_params.dup) do |message|
+        process(qmgr, queue, message, stats)
+        # Queue#each commits the messages already processed on break
+        break unless @running
+      end
+      qmgr.commit
+    rescue WMQ::WMQException
+      raise unless qmgr.alive?
+      count(stats, :errors)
+    rescue StandardError
+      count(stats, :errors)
+    end
+
+    def process(qmgr, queue, message, stats)
+      result = invoke(0, message, qmgr)
+      count(stats, :messages)
+      return if result.nil? || (message.descriptor[:msg_type] != WMQ::MQMT_REQUEST)
+
+      reply = result.is_a?(WMQ::Message) ? result : WMQ::Message.new(data: result.to_s)
+      begin
+        replied = qmgr.put_to_reply_q(message: reply, request_message: message, sync: true)
+      rescue WMQ::WMQException
+        replied = false
+      end
+
+      if replied
+        count(stats, :replies)
+      else
+        qmgr.put_to_dead_letter_q(message: message, reason: qmgr.reason_code, q_name: queue.name, sync: true)
+        count(stats, :dead_letters)
+      end
+    end
+
+    def invoke(index, message, qmgr)
+      return @handler.call(message, qmgr) if index == @middleware.size
+
+      @middleware[index].call(message, qmgr) { invoke(index + 1, message, qmgr) }
+    end
+
+    def count(stats, key)
+      @mutex.synchronize { stats[key] += 1 }
+    end
+  end
+end
@@ -1,3 +1,3 @@
 module WMQ #:nodoc
-  VERSION = '2.1.1'
+  VERSION = '2.1.1'.freeze
 end
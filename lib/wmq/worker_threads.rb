@@ -0,0 +1,59 @@
+module WMQ
+  # Starting, stopping and waiting for the threads of WMQ::Server and
+  # WMQ::PartitionedDispatcher
+  #
+  # The including class sets @mutex, @running, @threads, @poll_ms and
+  # @reconnect_interval, and implements #start_threads, which starts the
+  # threads and returns them. The threads run while #running? is true.
+  module WorkerThreads
+    # Start the threads and return
+    def start
+      @mutex.synchronize do
+        raise(WMQ::WMQException, "#{self.class.name} is already running") if @running
+
+        @running = true
+        @threads = start_threads
+      end
+      self
+    end
+
+    # Start the threads and wait for them to stop
+    def run
+      start
+      join
+    end
+
+    # Make every thread stop once it has finished, and committed, its current message
+    #
+    # Can be called from a signal handler
+    def stop
+      @running = false
+      nil
+    end
+
+    # Whether the threads were started and not stopped
+    def running?
+      @running
+    end
+
+    # Wait for the threads to stop
+    #
+    # Returns false when they did not all stop within timeout seconds
+    def join(timeout = nil)
+      deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout if timeout
+      @threads.each do |thread|
+        remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC) if deadline
+        return false unless thread.join(remaining && [remaining, 0].max)
+      end
+      true
+    end
+
+    private
+
+    # Wait :reconnect_interval seconds after a connection failure, unless stopped
+    def wait_to_reconnect
+      deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + @reconnect_interval
+      sleep([@poll_ms / 1000.0, @reconnect_interval].min) while @running && (Process.clock_gettime(Process::CLOCK_MONOTONIC) < deadline)
+    end
+  end
+end
@@ -0,0 +1,128 @@
+require_relative 'test_helper'
+
+# Unit Test for WMQ::Message that do not require a queue manager
+class MessageTest < Minitest::Test
+  context WMQ::Message do
+    context '.decode_name_value' do
+      should 'decode name value pairs' do
+        assert_equal({'name1' => 'value1', 'name 2' => 'value "2"', '' => ['', '"']},
+          WMQ::Message.decode_name_value('name1 value1  "name 2" "value ""2""" "" ""  "" """"'))
+      end
+
+      should 'not limit the token length' do
+        value = 'x' * 4096
+        assert_equal({'name' => value, 'quoted' => "#{value} #{value}"},
+          WMQ::Message.decode_name_value("name #{value} quoted \"#{value} #{value}\""))
+      end
+
+      should 'return the same results as the legacy decoder' do
+        random   = Random.new(42)
+        alphabet = ['a', 'b', ' ', '"', 'xyz', '0123456789']
+        1000.times do
+          pairs = Array.new(random.rand(6)) do
+            Array.new(2) { Array.new(random.rand(40)) { alphabet[random.rand(alphabet.size)] }.join }
+          end
+          str = pairs.collect { |pair| pair.collect { |element| encode_name_value(element) }.join(' ') }.join(' ' * (1 + random.rand(20)))
+          assert_equal WMQ::Message.decode_name_value(str, true), WMQ::Message.decode_name_value(str), str
+        end
+      end
+
+      should 'reject invalid name value strings like the legacy decoder' do
+        ['name', 'name "value', 'na"me value', 'name "val"ue" next'].each do |str|
+          [true, false].each do |legacy|
+            assert_raises(ArgumentError) { WMQ::Message.decode_name_value(str, legacy) }
+          end
+        end
+      end
+    end
+
+    context WMQ::RFH2Folders do
+      setup do
+        @folders = WMQ::RFH2Folders.new(
+          [
+            '<mcd><Msd>jms_text</Msd></mcd>',
+            '<usr><OrderId dt="i4">1234</OrderId><Price dt="r8">12.5</Price><Express dt="boolean">1</Express>' +
+              '<Key dt="bin.hex">0aFF</Key><Note xsi:nil="true"/><Text>a &lt;b&gt; &amp; &#x41;</Text>' +
+              '<Item><Sku>A1</Sku><Sku>B2</Sku></Item></usr>'
+          ]
+        )
+      end
+
+      should 'list folder names' do
+        assert_equal [:mcd, :usr], @folders.keys
+      end
+
+      should 'decode properties according to their data type' do
+        usr = @folders[:usr]
+        assert_equal 1234, usr['OrderId']
+        assert_equal 12.5, usr['Price']
+        assert_equal true, usr['Express']
+        assert_equal "\x0a\xff".b, usr['Key']
+        assert_nil usr['Note']
+        assert_equal 'a <b> & A', usr['Text']
+        assert_equal({'Sku' => ['A1', 'B2']}, usr['Item'])
+      end
+
+      should 'decode a folder only once' do
+        assert_same @folders[:usr], @folders['usr']
+      end
+
+      should 'return nil for missing folders' do
+        assert_nil @folders[:jms]
+      end
+
+      should 'return all folders' do
+        assert_equal({'Msd' => 'jms_text'}, @folders.to_h[:mcd])
+      end
+
+      should 'raise on malformed folders every time' do
+        folders = WMQ::RFH2Folders.new(['<usr><A>1</B></usr>'])
+        2.times { assert_raises(ArgumentError) { folders[:usr] } }
+      end
+
+      should 'return values not matching their data type as strings' do
+        folders = WMQ::RFH2Folders.new(['<usr><Count dt="i4">12x</Count><Price dt="r8">1.5e</Price></usr>'])
+        assert_equal({'Count' => '12x', 'Price' => '1.5e'}, folders[:usr])
+      end
+    end
+
+    context '.convert' do
+      should 'convert between EBCDIC and ASCII' do
+        assert_equal 'Hello [World]', WMQ::Message.convert("\xC8\x85\x93\x93\x96\x40\xBA\xE6\x96\x99\x93\x84\xBB".b, 37, 819)
+        assert_equal "\xC8\x85\x93\x93\x96\x40\xAD\xE6\x96\x99\x93\x84\xBD".b, WMQ::Message.convert('Hello [World]', 819, 1047)
+      end
+
+      should 'convert to and from UTF-8' do
+        assert_equal "caf\xC3\xA9".b, WMQ::Message.convert("\x83\x81\x86\x51".b, 500, 1208)
+        assert_equal "\x83\x81\x86\x51".b, WMQ::Message.convert("caf\xC3\xA9".b, 1208, 37)
+      end
+
+      should 'round trip every character' do
+        all = (0..255).collect(&:chr).join.b
+        [37, 500, 1047, 819].each do |ccsid|
+          [37, 500, 1047, 819, 1208].each do |to|
+            assert_equal all, WMQ::Message.convert(WMQ::Message.convert(all, ccsid, to), to, ccsid), "#{ccsid} => #{to}"
+          end
+        end
+      end
+
+      should 'substitute characters that cannot be converted' do
+        assert_equal "\x81\x3F\x3F\x82".b, WMQ::Message.convert("a\xE2\x82\xAC\xFFb".b, 1208, 37)
+        assert_equal "a\x1A\x1Ab".b, WMQ::Message.convert("a\xE2\x82\xAC\xFFb".b, 1208, 819)
+      end
+
+      should 'reject unsupported CCSIDs' do
+        assert_raises(ArgumentError) { WMQ::Message.convert('data', 1200, 819) }
+      end
+    end
+  end
+
+  # Encode a name or value as it would appear in an RFH NameValueString
+  def encode_name_value(element)
+    if element.empty? || element.include?(' ') || element.include?('"')
+      "\"#{element.gsub('"', '""')}\""
+    else
+      element
+    end
+  end
+end
@@ -103,6 +103,112 @@ class WMQTest < Minitest::Test
         assert_equal data, message.data
       end
 
+      should 'share handle between threads' do
+        WMQ::QueueManager.connect(q_mgr_name: 'TEST', share_handle: true) do |qmgr|
+          threads = 4.times.collect do |i|
+            Thread.new { qmgr.put(q_name: @in_queue.name, data: "Thread #{i}") && qmgr.reason_code }
+          end
+          assert_equal [WMQ::MQRC_NONE] * 4, threads.collect(&:value)
+        end
+
+        data = []
+        @in_queue.each { |message| data << message.data }
+        assert_equal 4.times.collect { |i| "Thread #{i}" }, data.sort
+      end
+
+      should 'be alive' do
+        assert_equal true, @queue_manager.alive?
+        assert_equal false, WMQ::QueueManager.new(q_mgr_name: 'TEST').alive?
+      end
+
+      should 'reconnect in a forked child' do
+        skip 'fork not available' unless Process.respond_to?(:fork)
+        WMQ::QueueManager.connect(q_mgr_name: 'TEST') do |qmgr|
+          qmgr.open_queue(q_name: @in_queue.name, mode: :output) do |queue|
+            pid = fork do
+              # Connects again on first use, rather than using the connection of the parent
+              put = queue.put(data: 'Child') && qmgr.connected?
+              exit!(put && queue.close && qmgr.disconnect ? 0 : 1)
+            end
+            Process.wait(pid)
+            assert_equal 0, $?.exitstatus
+
+            assert_equal true, qmgr.connected?
+            assert_equal true, queue.put(data: 'Parent')
+          end
+        end
+
+        data = []
+        @in_queue.each { |message| data << message.data }
+        assert_equal %w[Child Parent], data
+      end
+
+      should 'reopen queues after reconnecting' do
+        WMQ::QueueManager.connect(q_mgr_name: 'TEST', reconnect: 1) do |qmgr|
+          qmgr.open_queue(q_name: @in_queue.name, mode: :output) do |queue|
+            qmgr.disconnect
+            qmgr.connect
+            assert_equal true, queue.put(data: 'Reopened')
+            assert_nil $!
+          end
+        end
+
+        message = WMQ::Message.new
+        assert_equal true, @in_queue.get(message: message)
+        assert_equal 'Reopened', message.data
+      end
+
+      should 'pool connections' do
+        pool = WMQ::ConnectionPool.new(size: 2, q_mgr_name: 'TEST')
+        queues = 2.times.collect do
+          pool.checkout do |qmgr|
+            assert_equal true, qmgr.alive?
+            queue = pool.queue(q_name: @in_queue.name, mode: :output)
+            assert_equal true, queue.put(data: 'Pooled')
+            queue
+          end
+        end
+        assert_same queues.first, queues.last
+        assert_equal 1, pool.connections
+        pool.close
+
+        message = WMQ::Message.new
+        assert_equal true, @in_queue.get(message: message)
+        assert_equal 'Pooled', message.data
+      end
+
+      should 'batch puts' do
+        producer = WMQ::BatchingProducer.new(q_mgr_name: 'TEST', q_name: @in_queue.name, batch_size: 2, linger_ms: 1000)
+        promises = 3.times.collect { |i| producer.put(data: "Batched #{i}") }
+        assert_equal true, promises[1].value(5)
+        producer.close
+        assert_equal [true] * 3, promises.collect(&:value)
+        assert_equal 2, producer.stats[:batches]
+
+        message = WMQ::Message.new
+        assert_equal true, @in_queue.get(message: message)
+        assert_equal 'Batched 0', message.data
+      end
+
+      should 'connect from separate Ractors' do
+        skip 'Ractor not available' unless defined?(Ractor)
+        ractors = 2.times.collect do |i|
+          Ractor.new(@in_queue.name, i) do |q_name, i|
+            result = nil
+            WMQ::QueueManager.connect(q_mgr_name: 'TEST') do |qmgr|
+              message = WMQ::Message.new(data: "Ractor #{i}", headers: [{header_type: :rf_header, name_value: {'id' => i.to_s}}])
+              result  = qmgr.put(q_name: q_name, message: message)
+            end
+            result
+          end
+        end
+        assert_equal [true, true], ractors.collect { |r| r.respond_to?(:value) ? r.value : r.take }
+
+        data = []
+        @in_queue.each { |message| data << message.data }
+        assert_equal ['Ractor 0', 'Ractor 1'], data.sort
+      end
+
     end
 
     context 'Queue' do
@@ -113,6 +219,216 @@ class WMQTest < Minitest::Test
         assert_equal message.data, 'Hello World'
       end
 
+      should 'convert messages locally' do
+        message = WMQ::Message.new(data: "\xC8\x85\x93\x93\x96\x40\x51".b)
+        message.descriptor[:format]            = WMQ::MQFMT_STRING
+        message.descriptor[:coded_char_set_id] = 37
+        assert_equal true, @out_queue.put(message: message)
+
+        message = WMQ::Message.new
+        assert_equal true, @in_queue.get(message: message, convert: 1208)
+        assert_equal "Hello \xC3\xA9".b, message.data
+        assert_equal 1208, message.descriptor[:coded_char_set_id]
+
+        assert_raises(ArgumentError) { @in_queue.get(message: message, convert: 1200) }
+      end
+
+      should 'prefetch messages' do
+        10.times { |i| assert_equal true, @out_queue.put(data: "Prefetch #{i}") }
+
+        data = []
+        @queue_manager.open_queue(q_name: @in_queue.name, mode: :browse) do |browse_queue|
+          assert_equal true, browse_queue.each(prefetch: 3) { |message| data << message.data }
+        end
+        assert_equal 10.times.collect { |i| "Prefetch #{i}" }, data
+      end
+
+      should 'leave messages not yet consumed by prefetch on the queue' do
+        # The prefetch connection opens the queue again, so it must be shared
+        WMQ::Queue.open(queue_manager: @queue_manager, mode: :input_shared, dynamic_q_name: 'UNIT.PREFETCH.*', q_name: 'SYSTEM.DEFAULT.MODEL.QUEUE') do |queue|
+          10.times { |i| assert_equal true, @queue_manager.put(q_name: queue.name, data: "Prefetch #{i}") }
+
+          data = []
+          queue.each(prefetch: 3) do |message|
+            data << message.data
+            break if data.size == 2
+          end
+          assert_equal ['Prefetch 0', 'Prefetch 1'], data
+
+          data = []
+          queue.each { |message| data << message.data }
+          assert_equal 2.upto(9).collect { |i| "Prefetch #{i}" }, data
+        end
+      end
+
+      should 'commit messages in batches' do
+        25.times { |i| assert_equal true, @out_queue.put(data: "Batch #{i}") }
+
+        count = 0
+        assert_raises(RuntimeError) do
+          @in_queue.each(commit_every: 10) { |message| count += 1; raise 'Backout' if count == 15 }
+        end
+        assert_equal true, @in_queue.each(commit_every: 10, commit_interval_ms: 1000) { |message| count += 1 }
+        assert_equal 30, count
+
+        stats = @in_queue.stats
+        assert_equal 3, stats[:commits]
+        assert_equal 25, stats[:committed_messages]
+        assert_equal 10, stats[:max_commit_size]
+        assert_equal 1, stats[:backouts]
+      end
+
+      should 'move poison messages to the backout requeue queue' do
+        WMQ::Queue.open(queue_manager: @queue_manager, mode: :input, dynamic_q_name: 'UNIT.BOQ.*', q_name: 'SYSTEM.DEFAULT.MODEL.QUEUE') do |backout_queue|
+          @queue_manager.mqsc("alter ql(#{@in_queue.name}) bothresh(2) boqname(#{backout_queue.name})")
+          assert_equal true, @out_queue.put(data: 'Poison')
+          assert_equal true, @out_queue.put(data: 'Good')
+
+          2.times do
+            assert_raises(RuntimeError) { @in_queue.each(commit_every: 10) { |message| raise 'Backout' } }
+          end
+          data = []
+          @in_queue.each(commit_every: 10) { |message| data << message.data }
+          assert_equal ['Good'], data
+          assert_equal 1, @in_queue.stats[:poison_messages]
+
+          message = WMQ::Message.new
+          assert_equal true, backout_queue.get(message: message)
+          assert_equal 'Poison', message.data
+        end
+      end
+
+      should 'retry messages later' do
+        WMQ::Queue.open(queue_manager: @queue_manager, mode: :input, dynamic_q_name: 'UNIT.RETRY.*', q_name: 'SYSTEM.DEFAULT.MODEL.QUEUE') do |retry_queue|
+          scheduler = WMQ::RetryScheduler.new(queue_manager: @queue_manager, retry_q_name: retry_queue.name, delay_ms: 100)
+          later     = WMQ::RetryScheduler.new(queue_manager: @queue_manager, retry_q_name: retry_queue.name, delay_ms: 300_000)
+          assert_equal true, @out_queue.put(data: 'Later')
+          assert_equal true, @out_queue.put(data: 'Retry')
+
+          # A message that is not yet due ahead of one that is
+          message = WMQ::Message.new
+          assert_equal true, @in_queue.get(message: message, sync: true)
+          assert_equal true, later.retry(message, q_name: @in_queue.name)
+          message = WMQ::Message.new
+          assert_equal true, @in_queue.get(message: message, sync: true)
+          assert_equal true, scheduler.retry(message, q_name: @in_queue.name)
+          @queue_manager.commit
+          assert_equal 0, scheduler.move_due
+
+          sleep 0.2
+          assert_equal 1, scheduler.move_due
+          scheduler.close
+
+          message = WMQ::Message.new
+          assert_equal true, @in_queue.get(message: message)
+          assert_equal 'Retry', message.data
+          assert_equal 1, WMQ::RetryScheduler.attempts(message)
+          assert_equal false, @in_queue.get(message: message)
+        end
+      end
+
+      should 'correlate replies' do
+        requester = WMQ::Requester.new(q_mgr_name: 'TEST', q_name: @in_queue.name, timeout: 5)
+        replies   = 2.times.collect { |i| requester.send_request(data: "Request #{i}") }
+
+        # Reply in reverse order
+        requests = 2.times.collect do
+          message = WMQ::Message.new
+          assert_equal true, @in_queue.get(message: message)
+          message
+        end
+        requests.reverse_each do |request|
+          reply = WMQ::Message.new(data: "Reply to #{request.data}")
+          reply.descriptor[:correl_id] = request.descriptor[:msg_id]
+          assert_equal true, @queue_manager.put(q_name: request.descriptor[:reply_to_q], message: reply)
+        end
+
+        assert_equal ['Reply to Request 0', 'Reply to Request 1'], replies.collect { |reply| reply.wait(5).data }
+        assert_equal 0, requester.pending
+        requester.close
+      end
+
+      should 'discard replies that arrive after their request timed out' do
+        requester = WMQ::Requester.new(q_mgr_name: 'TEST', q_name: @in_queue.name, timeout: 5)
+        replies   = 2.times.collect { |i| requester.send_request(data: "Request #{i}") }
+        assert_nil replies.first.wait(0.1)
+
+        2.times do
+          request = WMQ::Message.new
+          assert_equal true, @in_queue.get(message: request)
+          reply = WMQ::Message.new(data: "Reply to #{request.data}")
+          reply.descriptor[:correl_id] = request.descriptor[:msg_id]
+          assert_equal true, @queue_manager.put(q_name: request.descriptor[:reply_to_q], message: reply)
+        end
+
+        assert_equal 'Reply to Request 1', replies.last.wait(5).data
+        assert_equal 1, requester.stats[:discarded]
+        requester.close
+      end
+
+      should 'pool dynamic queues' do
+        pool = WMQ::DynamicQueuePool.new(queue_manager: @queue_manager, dynamic_q_name: 'UNIT.POOL.*', size: 1)
+        name = pool.checkout do |queue|
+          assert_equal true, @queue_manager.put(q_name: queue.name, data: 'Leftover')
+          # Larger than the get buffer, drained without reading all of it
+          assert_equal true, @queue_manager.put(q_name: queue.name, data: 'L' * 100_000)
+          queue.name
+        end
+        assert_equal 2, pool.stats[:drained_messages]
+
+        pool.checkout do |queue|
+          assert_equal name, queue.name
+          assert_equal false, queue.get(message: WMQ::Message.new)
+        end
+        assert_equal 1, pool.stats[:created]
+        pool.close
+      end
+
+      should 'serve requests' do
+        # The Server opens the queue again, so it must be shared
+        WMQ::Queue.open(queue_manager: @queue_manager, mode: :input_shared, dynamic_q_name: 'UNIT.SERVER.*', q_name: 'SYSTEM.DEFAULT.MODEL.QUEUE') do |queue|
+          request = WMQ::Message.new(data: 'Request')
+          request.descriptor[:msg_type]   = WMQ::MQMT_REQUEST
+          request.descriptor[:reply_to_q] = queue.name
+          assert_equal true, @queue_manager.put(q_name: queue.name, message: request)
+
+          server = WMQ::Server.new(q_mgr_name: 'TEST', q_name: queue.name, workers: 2, poll_ms: 100) do |message, qmgr|
+            "Reply to #{message.data}" if message.descriptor[:msg_type] == WMQ::MQMT_REQUEST
+          end
+          server.start
+          # The request and then its reply
+          assert_equal true, wait_until { server.stats.sum { |stats| stats[:messages] } == 2 }
+          server.stop
+          assert_equal true, server.join(5)
+          assert_equal 1, server.stats.sum { |stats| stats[:replies] }
+          assert_equal 0, server.stats.sum { |stats| stats[:reconnects] }
+        end
+      end
+
+      should 'process messages in order per key' do
+        # The lanes open the queue again, so it must be shared
+        WMQ::Queue.open(queue_manager: @queue_manager, mode: :input_shared, dynamic_q_name: 'UNIT.DISPATCH.*', q_name: 'SYSTEM.DEFAULT.MODEL.QUEUE') do |queue|
+          10.times do |i|
+            message = WMQ::Message.new(data: i.to_s)
+            message.descriptor[:correl_id] = "KEY#{i % 2}"
+            assert_equal true, @queue_manager.put(q_name: queue.name, message: message)
+          end
+
+          received   = Hash.new { |hash, key| hash[key] = [] }
+          mutex      = Mutex.new
+          dispatcher = WMQ::PartitionedDispatcher.new(q_mgr_name: 'TEST', q_name: queue.name, key: :correl_id, lanes: 2, poll_ms: 100) do |message, qmgr|
+            mutex.synchronize { received[message.descriptor[:correl_id]] << message.data.to_i }
+          end
+          dispatcher.start
+          assert_equal true, wait_until { dispatcher.stats[:lanes].sum { |lane| lane[:messages] } == 10 }
+          dispatcher.stop
+          assert_equal true, dispatcher.join(5)
+          assert_equal [0, 2, 4, 6, 8], received['KEY0']
+          assert_equal [1, 3, 5, 7, 9], received['KEY1']
+          assert_equal 0, dispatcher.stats[:lanes].sum { |lane| lane[:reconnects] }
+        end
+      end
+
       should 'group messages' do
         # Clear out queue of any messages
         @in_queue.each { |message|}
@@ -163,6 +479,19 @@ class WMQTest < Minitest::Test
         end
       end
 
+      should 'truncate browsed messages larger than the buffer' do
+        data = '0123456789ABCDEF' * 4096
+        assert_equal true, @out_queue.put(data: data)
+
+        @queue_manager.open_queue(mode: :browse, q_name: @in_queue.name) do |browse_queue|
+          message = WMQ::Message.new
+          assert_equal true, browse_queue.get(message: message, options: WMQ::MQGMO_BROWSE_FIRST | WMQ::MQGMO_ACCEPT_TRUNCATED_MSG, match: WMQ::MQMO_NONE)
+          assert_equal WMQ::MQRC_TRUNCATED_MSG_ACCEPTED, browse_queue.reason_code
+          assert_equal true, message.data.length < data.length
+          assert_equal data[0, message.data.length], message.data
+        end
+      end
+
       should 'dead letter header' do
         # TODO: Something has changed with DLH since MQ V6
         skip
@@ -231,6 +560,91 @@ class WMQTest < Minitest::Test
         verify_header(rfh2, WMQ::MQFMT_STRING)
       end
 
+      should 'rf_header_2 folders' do
+        usr  = {'OrderId' => 1234, 'Price' => 12.5, 'Express' => true, 'Note' => nil, 'Text' => 'a <b> & c', 'Item' => {'Sku' => ['A1', 'B2']}}
+        note = +'First'
+        rfh2 = {
+          header_type: :rf_header_2,
+          # Only the deeply frozen mcd folder is cached, the note can still change
+          xml:         {mcd: {Msd: 'jms_text'.freeze}.freeze, usr: usr, ext: {'Note' => note}.freeze}
+        }
+        %w[First Second].each do |expected|
+          message                     = WMQ::Message.new(data: 'Some Test Data', headers: [rfh2])
+          message.descriptor[:format] = WMQ::MQFMT_STRING
+          assert_equal(true, @out_queue.put(message: message))
+
+          message = WMQ::Message.new
+          assert_equal true, @in_queue.get(message: message)
+          folders = message.headers.first[:folders]
+          assert_equal [:mcd, :usr, :ext], folders.keys
+          assert_equal({'Msd' => 'jms_text'}, folders[:mcd])
+          assert_equal usr, folders[:usr]
+          assert_equal({'Note' => expected}, folders[:ext])
+          note.replace('Second')
+        end
+      end
+
+      should 'rf_header_2 in big endian encoding' do
+        folder = '<usr><a>1</a></usr>'
+        data   = 'RFH ' + [2, 36 + 4 + folder.size, 0x111, 1208].pack('N4') + WMQ::MQFMT_STRING + [0, 1208, folder.size].pack('N3') + folder + 'Some Test Data'
+        message                       = WMQ::Message.new(data: data)
+        message.descriptor[:format]   = WMQ::MQFMT_RF_HEADER_2
+        message.descriptor[:encoding] = 0x111
+        assert_equal(true, @out_queue.put(message: message))
+
+        message = WMQ::Message.new
+        assert_equal true, @in_queue.get(message: message)
+        assert_equal 'Some Test Data', message.data
+        assert_equal [folder], message.headers.first[:xml]
+        assert_equal WMQ::MQENC_NATIVE & WMQ::MQENC_INTEGER_MASK, message.descriptor[:encoding] & WMQ::MQENC_INTEGER_MASK
+      end
+
+      should 'message properties' do
+        properties = {'OrderId' => 1234, 'Express' => true, 'Text' => 'abc', 'Price' => 12.5}
+        assert_equal(true, @out_queue.put(data: 'Some Test Data', properties: properties))
+
+        message = WMQ::Message.new
+        assert_equal true, @in_queue.get(message: message, properties: true)
+        assert_equal 'Some Test Data', message.data
+        assert_equal 1234, message.properties['OrderId']
+        assert_equal 'abc', message.properties[:Text]
+        assert_equal nil, message.properties['Missing']
+        assert_equal properties, message.properties.to_h.select { |name, _| properties.key?(name) }
+
+        assert_equal(true, @queue_manager.put(q_name: @in_queue.name, data: 'Put1 Data', properties: {'OrderId' => 5678}))
+        assert_equal true, @in_queue.get(message: message, properties: true)
+        assert_equal 5678, message.properties['OrderId']
+      end
+
+      should 'select messages' do
+        @queue_manager.open_queue(mode: :input, dynamic_q_name: 'UNIT.SELECT.*', q_name: 'SYSTEM.DEFAULT.MODEL.QUEUE', selector: "Region = 'EU'") do |queue|
+          assert_equal(true, @queue_manager.put(q_name: queue.name, data: 'US Data', properties: {'Region' => 'US'}))
+          assert_equal(true, @queue_manager.put(q_name: queue.name, data: 'EU Data', properties: {'Region' => 'EU'}))
+
+          message = WMQ::Message.new
+          assert_equal true, queue.get(message: message)
+          assert_equal 'EU Data', message.data
+          assert_equal false, queue.get(message: message)
+        end
+      end
+
+      should 'consume asynchronously' do
+        WMQ::QueueManager.connect(q_mgr_name: 'TEST') do |qmgr|
+          qmgr.open_queue(mode: :input, dynamic_q_name: 'UNIT.ASYNC.*', q_name: 'SYSTEM.DEFAULT.MODEL.QUEUE') do |queue|
+            assert_equal(true, qmgr.put(q_name: queue.name, data: 'Async Data'))
+
+            consumer = WMQ::AsyncConsumer.new(queue_manager: qmgr, capacity: 10)
+            assert_equal true, consumer.register(queue)
+            assert_equal true, consumer.start
+            message, from = consumer.pop(5)
+            assert_equal true, consumer.stop
+            assert_equal 'Async Data', message.data
+            assert_same queue, from
+            assert_nil consumer.pop
+          end
+        end
+      end
+
       should 'multiple_headers' do
         headers = [
           {header_type: :rf_header_2,
@@ -306,6 +720,16 @@ class WMQTest < Minitest::Test
     end
   end
 
+  # Returns whether the block returned true within timeout seconds
+  def wait_until(timeout = 10)
+    deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout
+    until yield
+      return false if Process.clock_gettime(Process::CLOCK_MONOTONIC) > deadline
+      sleep 0.05
+    end
+    true
+  end
+
   def verify_header(header, format)
     verify_multiple_headers([header], format)
   end
@@ -318,6 +742,7 @@ class WMQTest < Minitest::Test
     message.headers             = headers
     #assert_equal(true,@queue_manager.put(q_name: @in_queue.name, message: message))
     assert_equal(true, @out_queue.put(message: message))
+    assert_equal 0, @out_queue.stats[:build_reallocations]
 
     message = WMQ::Message.new
     assert_equal true, @in_queue.get(message: message)